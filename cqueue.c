@@ -4,7 +4,36 @@
   Licensed under the terms of the New BSD license.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // syscall
+#endif
+
 #include "cqueue.h"
+#include "cqueue_internal.h"
+
+#include <sched.h>      // sched_yield
+#include <time.h>       // clock_gettime
+#include <fcntl.h>      // O_* constants
+#include <unistd.h>     // ftruncate, close
+#include <sys/mman.h>   // mmap, shm_open
+#include <sys/stat.h>   // fstat
+#include <string.h>     // memcpy
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>  // SSE2, AVX2 intrinsics, __rdtsc
+//! the SIMD and non-temporal copy kernels are available
+#define X86_COPY
+//! CQUEUE_CLOCK_TSC is available
+#define X86_TSC
+#endif
+
+#ifdef __linux__
+#include <unistd.h>         // syscall, read, write
+#include <sys/syscall.h>    // SYS_futex, SYS_mbind
+#include <sys/eventfd.h>    // eventfd
+#include <linux/futex.h>    // FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <linux/mempolicy.h> // MPOL_BIND
+#endif
 
 /*! internal representation of a spsc slot
 
@@ -20,113 +49,524 @@ typedef struct cqueue_spsc_slot {
   unsigned char data[]; //!< pointer to data provided to pushers/poppers
 } cqueue_spsc_slot;
 
+//! cqueue_spsc flags: the queue lives in a mapping shared between processes
+#define SPSC_SHARED 0x1
+//! cqueue_spsc flags: the queue is a private mapping of its own
+#define SPSC_MAPPED 0x2
+//! cqueue_spsc flags: the mapping uses explicit huge pages
+#define SPSC_HUGETLB 0x4
+
+//! size of an explicit huge page, the default on x86_64 and arm64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+//! largest supported cqueue_spsc_opts.line_size
+#define MAX_LINE_SIZE 4096
+//! size of the node mask passed to mbind
+#define SPSC_MAX_NUMA_NODES 1024
+#define NODE_MASK_BITS (8 * sizeof(unsigned long))
+
+//! largest element copied with copy_small() by CQUEUE_COPY_AUTO
+#define SMALL_COPY 64
+//! most cachelines of the next slot prefetched by cqueue_spsc_pop()
+#define PREFETCH_LINES 16
+
+//! size of a cqueue_bytering record header
+#define BYTERING_HDR sizeof(size_t)
+//! cqueue_bytering header value marking the rest of the array as unused
+#define BYTERING_SKIP SIZE_MAX
+
+#ifdef CQUEUE_STATS
+//! add n to a counter of q that only the calling side writes
+#define STATS_ADD(q, field, n) \
+  atomic_store_explicit(&(q)->field, \
+    atomic_load_explicit(&(q)->field, memory_order_relaxed) + (n), \
+    memory_order_relaxed)
+#else
+#define STATS_ADD(q, field, n) ((void)0)
+#endif
+
+#define CQUEUE_SHM_MAGIC 0x4351554555455350ULL  // "CQUEUESP"
+#define CQUEUE_SHM_VERSION 1
+
+/*! header in front of a cqueue_spsc in shared memory
+
+  Lets a process that attaches to the mapping check that it was created by
+  a compatible build before touching the queue.
+*/
+typedef struct cqueue_shm_header {
+  _Atomic uint64_t magic; //!< CQUEUE_SHM_MAGIC once the queue is initialized
+  uint32_t version;       //!< CQUEUE_SHM_VERSION, bumped on layout changes
+  uint32_t line_size;     //!< LEVEL1_DCACHE_LINESIZE of the creator
+  uint64_t elem_size;     //!< elem_size the creator asked for
+  uint64_t map_size;      //!< size of the whole mapping
+  uint64_t struct_size;   //!< sizeof(cqueue_spsc), which CQUEUE_STATS changes
+  char pad[LEVEL1_DCACHE_LINESIZE - 5 * sizeof(uint64_t)];
+} cqueue_shm_header;
+
+/*! internal representation of a cqueue_spsc_unbounded segment
+
+  The header takes a cacheline of its own, so the slots that follow are
+  cacheline aligned like a cqueue_spsc array.
+*/
+typedef struct cqueue_spsc_segment {
+  //! the segment the producer moved on to, or NULL while it is still on this
+  //! one
+  _Atomic(struct cqueue_spsc_segment *) next;
+  char pad[LEVEL1_DCACHE_LINESIZE - sizeof(struct cqueue_spsc_segment *)];
+  unsigned char array[];
+} cqueue_spsc_segment;
+
+//! number of drained segments cached for reuse by a cqueue_spsc_unbounded
+//! without a memory limit
+#define SEGMENT_CACHE_SIZE 4
+
+/*! internal representation of a mpmc slot
+
+  Same layout as cqueue_spsc_slot, but seq holds a sequence number instead
+  of a used flag. For the slot at position pos (pos & (capacity-1) being its
+  index), seq == pos means the slot is free for the pusher of pos,
+  seq == pos+1 means it holds data for the popper of pos. Finishing a pop
+  sets seq to pos+capacity, ie free for the pusher one lap later.
+  cqueue_mpsc uses the same slots.
+*/
+typedef struct cqueue_mpmc_slot {
+  _Atomic size_t seq; //!< sequence number of the slot
+  unsigned char data[]; //!< pointer to data provided to pushers/poppers
+} cqueue_mpmc_slot;
+
+/*! internal state of the latency sampling of a cqueue_spsc
+
+  The stamps are written by the producer and read by the consumer, ordered
+  by the used flags of their slots like the slots' data. The histogram is
+  only written by the consumer; its counters are atomic so that
+  cqueue_spsc_get_latency() may read them from any thread.
+*/
+typedef struct cqueue_spsc_latency {
+  size_t mask;              //!< sampling period - 1
+  unsigned shift;           //!< log2 of the sampling period
+  cqueue_clock clock;
+  uint64_t *stamps;         //!< one per sampled slot
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(size_t) - sizeof(unsigned)
+            - sizeof(cqueue_clock) - sizeof(uint64_t *)];
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+  _Atomic uint64_t buckets[CQUEUE_HIST_BUCKETS];
+} cqueue_spsc_latency;
+
+/*! internal representation of a cqueue_conflate key entry
+
+  Takes whole cachelines like a cqueue_spsc slot. seq and data form a
+  sequence lock, as in cqueue_mailbox.
+*/
+typedef struct cqueue_conflate_entry {
+  _Atomic size_t seq;         //!< twice the number of updates, odd during one
+  _Atomic uint32_t pending;   //!< nonzero while the key is queued on ready
+  size_t delivered;           //!< seq of the value last popped, consumer only
+  _Atomic uint64_t data[];
+} cqueue_conflate_entry;
+
+//! a buffer sent through the forward ring of a cqueue_pool
+typedef struct cqueue_pool_msg {
+  void *buf;
+  size_t len;
+} cqueue_pool_msg;
+
+/*! internal representation of a cqueue_deque slot
+
+  fn and arg are atomic because a thief may read them while the owner
+  rewrites the slot after winning its task; the thief's CAS on top then
+  fails and the torn task is discarded.
+*/
+typedef struct cqueue_deque_slot {
+  _Atomic(cqueue_task_fn) fn;
+  _Atomic(void *) arg;
+} cqueue_deque_slot;
+
+//! internal representation of a cqueue_deque array
+typedef struct cqueue_deque_array {
+  size_t capacity;                  //!< number of slots, a power of 2
+  struct cqueue_deque_array *prev;  //!< next older outgrown array
+  cqueue_deque_slot slots[];
+} cqueue_deque_array;
+
 // private function declarations
+static inline unsigned char* spsc_array(cqueue_spsc *q);
+static int spsc_layout(size_t capacity, size_t elem_size, size_t line,
+                       size_t *realcap, size_t *slot, size_t *offset,
+                       size_t *size);
+static size_t spsc_map_size(cqueue_spsc *q);
+static void* spsc_map(size_t *size, const cqueue_spsc_opts *opts,
+                      unsigned *flags);
+static int spsc_bind(void *p, size_t size, int node);
+static void spsc_init(cqueue_spsc *q, size_t capacity, size_t slot,
+                      size_t offset, unsigned flags);
+static inline void cpu_relax(void);
+static void deadline_after(struct timespec *deadline, uint64_t timeout_ns);
+static int deadline_passed(const struct timespec *deadline);
+static void park(_Atomic uint32_t *word, uint32_t val,
+                 const struct timespec *deadline, int shared);
+static void unpark(_Atomic uint32_t *word, int shared);
+static int spsc_wait(cqueue_spsc *q, _Atomic size_t *used, size_t want,
+                     _Atomic uint32_t *parked, const struct timespec *deadline);
+static inline void spsc_wake(cqueue_spsc *q, _Atomic uint32_t *parked,
+                             _Atomic uint32_t *armed, int fd);
+static inline void spsc_high_water(cqueue_spsc *q, size_t push_idx);
+static int spsc_arm_fd(_Atomic size_t *used, size_t want,
+                       _Atomic uint32_t *armed, int fd);
+static void spsc_set_ready(cqueue_spsc *q);
+static void spsc_stamp(cqueue_spsc *q, size_t push_idx, size_t n);
+static void spsc_measure(cqueue_spsc *q, size_t pop_idx, size_t n);
+static inline uint64_t clock_now(cqueue_clock clock);
+static inline size_t hist_bucket(uint64_t v);
+static void spsc_copy_in(cqueue_spsc *q, void *dst, const void *src,
+                         size_t len);
+static void spsc_copy_out(cqueue_spsc *q, void *dst, const void *src,
+                          size_t len);
+static inline void copy_small(void *dst, const void *src, size_t len);
+static int cpu_has_avx2(void);
+#ifdef X86_COPY
+static void copy_sse2(void *dst, const void *src, size_t len);
+static void copy_avx2(void *dst, const void *src, size_t len);
+static void copy_nt_sse2(void *dst, const void *src, size_t len);
+static void copy_nt_avx2(void *dst, const void *src, size_t len);
+#endif
+static size_t set_next_ready(cqueue_spsc_set *s, size_t from);
+static void* set_idle(cqueue_spsc_set *s, size_t i);
+static inline unsigned ctz64(uint64_t x);
+static inline unsigned clz64(uint64_t x);
+static inline unsigned popcount64(uint64_t x);
+static inline size_t spsc_push_idx(cqueue_spsc *q);
+static inline size_t spsc_pop_idx(cqueue_spsc *q);
 static size_t next_power2(size_t i);
 static int is_power2(size_t i);
+static size_t slot_size(size_t elem_size, size_t overhead);
+static unsigned char* array_alloc(size_t capacity, size_t slot_size);
+static unsigned char* seq_array_alloc(size_t capacity, size_t slot_size);
+static void* seq_push_slot(_Atomic size_t *push_idx, unsigned char *array,
+                           size_t capacity, size_t elem_size);
+static void* seq_trypush_slot(_Atomic size_t *push_idx, unsigned char *array,
+                              size_t capacity, size_t elem_size);
+static void seq_push_slot_finish(void *p);
+static int bcast_full(cqueue_bcast *q);
+static inline size_t bytering_record_size(size_t len);
+#ifndef NDEBUG
+static int pool_owns(cqueue_pool *p, const void *buf);
+#endif
+static void seqlock_write(_Atomic size_t *seq, _Atomic uint64_t *data,
+                          const void *src, size_t len);
+static size_t seqlock_read(_Atomic size_t *seq, _Atomic uint64_t *data,
+                           void *dst, size_t len);
+static cqueue_spsc_segment* segment_get(cqueue_spsc_unbounded *q);
+static void segment_put(cqueue_spsc_unbounded *q, cqueue_spsc_segment *seg);
+static cqueue_deque_array* deque_array_alloc(size_t capacity);
+static cqueue_deque_array* deque_grow(cqueue_deque *q, cqueue_deque_array *a,
+                                      size_t top, size_t bottom);
 
 
 // public functions declared in the header
 
 cqueue_spsc* cqueue_spsc_new(size_t capacity, size_t elem_size) {
-  size_t realcap, i, n_cachelines;
+  size_t realcap, slot, offset, size;
   cqueue_spsc *q;
-  cqueue_spsc_slot *slot;
 
-  if (!elem_size)
+  if (!spsc_layout(capacity, elem_size, LEVEL1_DCACHE_LINESIZE, &realcap,
+                   &slot, &offset, &size))
     return NULL;
 
-  realcap = next_power2(capacity);
-  if (!realcap)
+  // allocate the struct and its array as one cacheline-aligned chunk, where
+  // each element has a size that is a multiple of the cacheline size
+  q = cacheline_alloc(size);
+  if (!q)
     return NULL;
 
-  // check posix_memalign conditions
-  assert(is_power2(LEVEL1_DCACHE_LINESIZE));
-  assert(LEVEL1_DCACHE_LINESIZE % sizeof(void *) == 0);
+  spsc_init(q, realcap, slot, offset, 0);
+  return q;
+}
 
-  n_cachelines = sizeof(cqueue_spsc) / LEVEL1_DCACHE_LINESIZE;
-  if (n_cachelines * LEVEL1_DCACHE_LINESIZE < sizeof(cqueue_spsc))
-    n_cachelines++;
+void cqueue_spsc_opts_init(cqueue_spsc_opts *opts) {
+  assert(opts);
 
-#ifdef SANITIZE
-  posix_memalign((void **)&q, LEVEL1_DCACHE_LINESIZE,
-                    LEVEL1_DCACHE_LINESIZE * n_cachelines);
-#else
-  q = aligned_alloc(LEVEL1_DCACHE_LINESIZE,
-                    LEVEL1_DCACHE_LINESIZE * n_cachelines);
-#endif
+  opts->numa_node = CQUEUE_NUMA_ANY;
+  opts->huge_pages = 0;
+  opts->prefault = 0;
+  opts->line_size = 0;
+}
+
+cqueue_spsc* cqueue_spsc_new_opts(size_t capacity, size_t elem_size,
+                                  const cqueue_spsc_opts *opts) {
+  size_t realcap, slot, offset, size, line;
+  cqueue_spsc_opts defaults;
+  unsigned flags;
+  cqueue_spsc *q;
+
+  if (!opts) {
+    cqueue_spsc_opts_init(&defaults);
+    opts = &defaults;
+  }
+
+  line = opts->line_size ? opts->line_size : LEVEL1_DCACHE_LINESIZE;
+  if (!is_power2(line) || line < LEVEL1_DCACHE_LINESIZE ||
+      line > MAX_LINE_SIZE)
+    return NULL;
+
+  if (!spsc_layout(capacity, elem_size, line, &realcap, &slot, &offset,
+                   &size))
+    return NULL;
 
+  q = spsc_map(&size, opts, &flags);
   if (!q)
     return NULL;
 
-  q->capacity = realcap;
+  spsc_init(q, realcap, slot, offset, flags);
 
-  // round the elem size up to the nearest cacheline and account for
-  // slot overhead
-  n_cachelines = (elem_size + sizeof(_Atomic size_t))/ LEVEL1_DCACHE_LINESIZE;
-  if (n_cachelines * LEVEL1_DCACHE_LINESIZE <
-      (elem_size + sizeof(_Atomic size_t)))
-    n_cachelines++;
+  if (opts->prefault)
+    cqueue_spsc_prefault(q);
 
-  // check for n_cachelines overflow
-  if (n_cachelines > SIZE_MAX/LEVEL1_DCACHE_LINESIZE) {
-      free(q);
-      return NULL;
-  }
-  q->elem_size = n_cachelines * LEVEL1_DCACHE_LINESIZE;
+  return q;
+}
 
-  // check for capacity * elem_size overflow
-  if ((q->capacity > (size_t)(SIZE_MAX/(q->elem_size))) ||
-      (q->elem_size > (size_t)(SIZE_MAX/(q->capacity)))) {
-    free(q);
+void cqueue_spsc_prefault(cqueue_spsc *q) {
+  volatile unsigned char *p = (volatile unsigned char *)q;
+  size_t size, page, off;
+
+  assert(q);
+
+  if (q->flags & SPSC_HUGETLB)
+    page = HUGE_PAGE_SIZE;
+  else
+    page = (size_t)sysconf(_SC_PAGESIZE);
+  size = q->array_offset + q->capacity * q->elem_size;
+
+  // a read would only map the shared zero page, so write the zero back
+  for (off = 0; off < size; off += page)
+    p[off] = p[off];
+}
+
+cqueue_spsc* cqueue_spsc_new_shm_fd(int fd, size_t capacity, size_t elem_size) {
+  size_t realcap, slot, offset, size;
+  cqueue_shm_header *h;
+  cqueue_spsc *q;
+  void *base;
+
+  if (!spsc_layout(capacity, elem_size, LEVEL1_DCACHE_LINESIZE, &realcap,
+                   &slot, &offset, &size))
     return NULL;
-  }
 
-  // allocate array as a cacheline-aligned chunk of elements, where each
-  // element has a size that is a multiple of the cacheline size
-#ifdef SANITIZE
-  posix_memalign((void **)&(q->array), LEVEL1_DCACHE_LINESIZE,
-                  q->capacity * q->elem_size);
-#else
-  q->array = aligned_alloc(LEVEL1_DCACHE_LINESIZE, q->capacity * q->elem_size);
-#endif
-  if (!q->array) {
-    free(q);
+  if (size > SIZE_MAX - sizeof(cqueue_shm_header))
+    return NULL;
+  size += sizeof(cqueue_shm_header);
+
+  if ((off_t)size < 0 || ftruncate(fd, (off_t)size))
+    return NULL;
+
+  base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  // the file may have held a queue before, invalidate it while we set up
+  h = base;
+  atomic_store_explicit(&h->magic, 0, memory_order_relaxed);
+  h->version = CQUEUE_SHM_VERSION;
+  h->line_size = LEVEL1_DCACHE_LINESIZE;
+  h->elem_size = elem_size;
+  h->map_size = size;
+  h->struct_size = sizeof(cqueue_spsc);
+
+  q = (cqueue_spsc *)((unsigned char *)base + sizeof(cqueue_shm_header));
+  spsc_init(q, realcap, slot, offset, SPSC_SHARED);
+
+  // publish the queue to attachers
+  atomic_store_explicit(&h->magic, CQUEUE_SHM_MAGIC, memory_order_release);
+  return q;
+}
+
+cqueue_spsc* cqueue_spsc_new_shm(const char *name, size_t capacity,
+                                 size_t elem_size) {
+  cqueue_spsc *q;
+  int fd;
+
+  assert(name);
+
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    return NULL;
+
+  q = cqueue_spsc_new_shm_fd(fd, capacity, elem_size);
+  if (!q)
+    shm_unlink(name);
+
+  // the mapping stays valid after closing
+  close(fd);
+  return q;
+}
+
+cqueue_spsc* cqueue_spsc_attach_shm_fd(int fd, size_t elem_size) {
+  cqueue_shm_header *h;
+  struct stat st;
+  void *base;
+
+  if (fstat(fd, &st))
+    return NULL;
+  if ((size_t)st.st_size < sizeof(cqueue_shm_header) + sizeof(cqueue_spsc))
     return NULL;
-  }
 
-  for (i=0; i < q->capacity; i++) {
-    slot = (cqueue_spsc_slot *)(q->array + i*q->elem_size);
-    slot->used = ATOMIC_VAR_INIT(0);
+  base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  h = base;
+  if (atomic_load_explicit(&h->magic, memory_order_acquire) != CQUEUE_SHM_MAGIC
+      || h->version != CQUEUE_SHM_VERSION
+      || h->line_size != LEVEL1_DCACHE_LINESIZE
+      || h->elem_size != elem_size
+      || h->map_size != (uint64_t)st.st_size
+      || h->struct_size != sizeof(cqueue_spsc)) {
+    munmap(base, st.st_size);
+    return NULL;
   }
 
-  q->push_idx = 0;
-  q->pop_idx = 0;
-  q->n_used_slots = 0;
+  return (cqueue_spsc *)((unsigned char *)base + sizeof(cqueue_shm_header));
+}
+
+cqueue_spsc* cqueue_spsc_attach_shm(const char *name, size_t elem_size) {
+  cqueue_spsc *q;
+  int fd;
+
+  assert(name);
+
+  fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return NULL;
+
+  q = cqueue_spsc_attach_shm_fd(fd, elem_size);
+  close(fd);
   return q;
 }
 
 void cqueue_spsc_delete(cqueue_spsc **p) {
   cqueue_spsc *q = *p;
+  cqueue_shm_header *h;
+
   if(!q)
     return;
 
-  if(q->array)
-    free(q->array);
+  if (q->flags & SPSC_SHARED) {
+    h = (cqueue_shm_header *)((unsigned char *)q - sizeof(cqueue_shm_header));
+    munmap(h, h->map_size);
+    *p = NULL;
+    return;
+  }
 
-  free(q);
+  if (q->push_fd >= 0)
+    close(q->push_fd);
+  if (q->pop_fd >= 0)
+    close(q->pop_fd);
+  if (q->lat) {
+    free(q->lat->stamps);
+    free(q->lat);
+  }
+
+  if (q->flags & SPSC_MAPPED)
+    munmap(q, spsc_map_size(q));
+  else
+    free(q);
   *p = NULL;
 }
 
+void cqueue_spsc_set_wait(cqueue_spsc *q, cqueue_wait wait, unsigned spin) {
+  assert(q);
+  assert(wait <= CQUEUE_WAIT_PARK);
+
+  q->wait = wait;
+  q->spin = spin;
+}
+
+int cqueue_spsc_enable_fds(cqueue_spsc *q) {
+  assert(q);
+
+#ifdef __linux__
+  // fds would only be valid in the process that created them
+  if (q->flags & SPSC_SHARED)
+    return -1;
+
+  if (q->pop_fd >= 0)
+    return 0;
+
+  q->push_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->push_fd < 0)
+    return -1;
+
+  q->pop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->pop_fd < 0) {
+    close(q->push_fd);
+    q->push_fd = -1;
+    return -1;
+  }
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+int cqueue_spsc_get_pop_fd(cqueue_spsc *q) {
+  assert(q);
+
+  return q->pop_fd;
+}
+
+int cqueue_spsc_get_push_fd(cqueue_spsc *q) {
+  assert(q);
+
+  return q->push_fd;
+}
+
+int cqueue_spsc_arm_pop_fd(cqueue_spsc *q) {
+  assert(q);
+  assert(q->pop_fd >= 0);
+
+  cqueue_spsc_slot *slot;
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_pop_idx(q) * q->elem_size);
+
+  return spsc_arm_fd(&slot->used, 1, &q->pop_armed, q->pop_fd);
+}
+
+int cqueue_spsc_arm_push_fd(cqueue_spsc *q) {
+  assert(q);
+  assert(q->push_fd >= 0);
+
+  cqueue_spsc_slot *slot;
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_push_idx(q) * q->elem_size);
+
+  return spsc_arm_fd(&slot->used, 0, &q->push_armed, q->push_fd);
+}
+
 void* cqueue_spsc_push_slot(cqueue_spsc *q) {
   assert(q);
 
   cqueue_spsc_slot *slot;
-  slot = (cqueue_spsc_slot *)(q->array + q->push_idx * q->elem_size);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_push_idx(q) * q->elem_size);
 
   // check if the queue is full, ie we are trying to write to a used slot
-  while(atomic_load_explicit(&slot->used, memory_order_acquire));
+  if (atomic_load_explicit(&slot->used, memory_order_acquire))
+    spsc_wait(q, &slot->used, 0, &q->push_parked, NULL);
+
+  return slot->data;
+}
+
+void* cqueue_spsc_push_slot_timeout(cqueue_spsc *q, uint64_t timeout_ns) {
+  assert(q);
+
+  cqueue_spsc_slot *slot;
+  struct timespec deadline;
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_push_idx(q) * q->elem_size);
 
-  atomic_fetch_add_explicit(&q->n_used_slots, 1, memory_order_relaxed);
+  // check if the queue is full, ie we are trying to write to a used slot
+  if (atomic_load_explicit(&slot->used, memory_order_acquire)) {
+    deadline_after(&deadline, timeout_ns);
+    if (!spsc_wait(q, &slot->used, 0, &q->push_parked, &deadline))
+      return NULL;
+  }
 
   return slot->data;
 }
@@ -135,11 +575,13 @@ void* cqueue_spsc_trypush_slot(cqueue_spsc *q) {
   assert(q);
 
   cqueue_spsc_slot *slot;
-  slot = (cqueue_spsc_slot *)(q->array + q->push_idx * q->elem_size);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_push_idx(q) * q->elem_size);
 
   // check if the queue is full, ie we are trying to write to a used slot
-  if (atomic_load_explicit(&slot->used, memory_order_acquire))
+  if (atomic_load_explicit(&slot->used, memory_order_acquire)) {
+    STATS_ADD(q, push_full, 1);
     return NULL;
+  }
 
   return slot->data;
 }
@@ -148,24 +590,48 @@ void cqueue_spsc_push_slot_finish(cqueue_spsc *q) {
   assert(q);
 
   cqueue_spsc_slot *slot;
-  slot = (cqueue_spsc_slot *)(q->array + q->push_idx * q->elem_size);
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) +
+                             (push_idx & (q->capacity - 1)) * q->elem_size);
 
+  if (q->lat)
+    spsc_stamp(q, push_idx, 1);
   atomic_store_explicit(&slot->used, 1, memory_order_release);
-  q->push_idx = (q->push_idx + 1) & (q->capacity - 1);
+  atomic_store_explicit(&q->push_idx, push_idx + 1, memory_order_relaxed);
+  spsc_high_water(q, push_idx + 1);
 
-  atomic_fetch_add_explicit(&q->n_used_slots, 1, memory_order_relaxed);
+  spsc_wake(q, &q->pop_parked, &q->pop_armed, q->pop_fd);
+  if (q->set)
+    spsc_set_ready(q);
 }
 
 void* cqueue_spsc_pop_slot(cqueue_spsc *q) {
   assert(q);
 
   cqueue_spsc_slot *slot;
-  slot = (cqueue_spsc_slot *)(q->array + q->pop_idx * q->elem_size);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_pop_idx(q) * q->elem_size);
+
+  // check if the queue is empty, ie we are trying to read an unused slot
+  if (!atomic_load_explicit(&slot->used, memory_order_acquire))
+    spsc_wait(q, &slot->used, 1, &q->pop_parked, NULL);
+
+  return slot->data;
+}
+
+void* cqueue_spsc_pop_slot_timeout(cqueue_spsc *q, uint64_t timeout_ns) {
+  assert(q);
+
+  cqueue_spsc_slot *slot;
+  struct timespec deadline;
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_pop_idx(q) * q->elem_size);
 
   // check if the queue is empty, ie we are trying to read an unused slot
-  while(!atomic_load_explicit(&slot->used, memory_order_acquire));
+  if (!atomic_load_explicit(&slot->used, memory_order_acquire)) {
+    deadline_after(&deadline, timeout_ns);
+    if (!spsc_wait(q, &slot->used, 1, &q->pop_parked, &deadline))
+      return NULL;
+  }
 
-  atomic_fetch_sub_explicit(&q->n_used_slots, 1, memory_order_relaxed);
   return slot->data;
 }
 
@@ -173,11 +639,13 @@ void* cqueue_spsc_trypop_slot(cqueue_spsc *q) {
   assert(q);
 
   cqueue_spsc_slot *slot;
-  slot = (cqueue_spsc_slot *)(q->array + q->pop_idx * q->elem_size);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) + spsc_pop_idx(q) * q->elem_size);
 
   // check if the queue is empty, ie we are trying to read an unused slot
-  if (!atomic_load_explicit(&slot->used, memory_order_acquire))
+  if (!atomic_load_explicit(&slot->used, memory_order_acquire)) {
+    STATS_ADD(q, pop_empty, 1);
     return NULL;
+  }
 
   return slot->data;
 }
@@ -186,65 +654,3245 @@ void cqueue_spsc_pop_slot_finish(cqueue_spsc *q) {
   assert(q);
 
   cqueue_spsc_slot *slot;
-  slot = (cqueue_spsc_slot *)(q->array + q->pop_idx * q->elem_size);
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) +
+                             (pop_idx & (q->capacity - 1)) * q->elem_size);
 
+  if (q->lat)
+    spsc_measure(q, pop_idx, 1);
   atomic_store_explicit(&slot->used, 0, memory_order_release);
-  q->pop_idx = (q->pop_idx + 1) & (q->capacity - 1);
-  atomic_fetch_sub_explicit(&q->n_used_slots, 1, memory_order_relaxed);
+  atomic_store_explicit(&q->pop_idx, pop_idx + 1, memory_order_relaxed);
+
+  spsc_wake(q, &q->push_parked, &q->push_armed, q->push_fd);
 }
 
-size_t cqueue_spsc_get_no_used_slots(cqueue_spsc *q) {
-  return atomic_load_explicit(&q->n_used_slots, memory_order_acquire);
+/*
+  Batches are published and released with relaxed stores to the used flags
+  of all but the first slot of the run, followed by a release store to the
+  first slot's flag. Both sides scan runs front to back with acquire loads
+  and stop at the first slot that is not ready, so they always synchronize
+  with the release on a run's first slot before looking at the rest of it.
+*/
+
+void* cqueue_spsc_push_slots(cqueue_spsc *q, size_t n, size_t *got) {
+  assert(q);
+  assert(got);
+
+  cqueue_spsc_slot *slot;
+  unsigned char *first;
+  size_t i;
+
+  // don't wrap around the end of the array
+  if (n > q->capacity - spsc_push_idx(q))
+    n = q->capacity - spsc_push_idx(q);
+
+  first = spsc_array(q) + spsc_push_idx(q) * q->elem_size;
+  for (i=0; i < n; i++) {
+    slot = (cqueue_spsc_slot *)(first + i * q->elem_size);
+    if (atomic_load_explicit(&slot->used, memory_order_acquire))
+      break;
+  }
+
+  *got = i;
+  if (!i) {
+    STATS_ADD(q, push_full, 1);
+    return NULL;
+  }
+
+  return ((cqueue_spsc_slot *)first)->data;
 }
 
-#ifdef CQUEUE_DEBUG
-void cqueue_spsc_print(cqueue_spsc *q) {
+void cqueue_spsc_push_slots_finish(cqueue_spsc *q, size_t n) {
   assert(q);
+  assert(n <= q->capacity - spsc_push_idx(q));
 
   cqueue_spsc_slot *slot;
-  unsigned char *buf;
+  unsigned char *first;
+  size_t push_idx;
 
-  printf("push_idx: %zu\n", q->push_idx);
-  printf("pop_idx: %zu\n", q->pop_idx);
-  for (size_t i=0; i < q->capacity; i++) {
-    slot = (cqueue_spsc_slot *)(q->array + i * q->elem_size);
-    printf("slot[%zu]:", i);
+  if (!n)
+    return;
 
-    if (slot->used)
-      printf(" (used)\n");
-    else
-      printf("\n");
+  push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  first = spsc_array(q) + (push_idx & (q->capacity - 1)) * q->elem_size;
+  for (size_t i=n-1; i > 0; i--) {
+    slot = (cqueue_spsc_slot *)(first + i * q->elem_size);
+    atomic_store_explicit(&slot->used, 1, memory_order_relaxed);
+  }
+  if (q->lat)
+    spsc_stamp(q, push_idx, n);
+  slot = (cqueue_spsc_slot *)first;
+  atomic_store_explicit(&slot->used, 1, memory_order_release);
+  atomic_store_explicit(&q->push_idx, push_idx + n, memory_order_relaxed);
+  spsc_high_water(q, push_idx + n);
 
-    buf = (unsigned char *)&slot->data;
-    for (size_t j=0; j < q->elem_size - sizeof(size_t); j++)
-      printf("%02x ", buf[j]);
-    printf("\n");
+  spsc_wake(q, &q->pop_parked, &q->pop_armed, q->pop_fd);
+  if (q->set)
+    spsc_set_ready(q);
+}
+
+void* cqueue_spsc_pop_slots(cqueue_spsc *q, size_t n, size_t *got) {
+  assert(q);
+  assert(got);
+
+  cqueue_spsc_slot *slot;
+  unsigned char *first;
+  size_t i;
+
+  // don't wrap around the end of the array
+  if (n > q->capacity - spsc_pop_idx(q))
+    n = q->capacity - spsc_pop_idx(q);
+
+  first = spsc_array(q) + spsc_pop_idx(q) * q->elem_size;
+  for (i=0; i < n; i++) {
+    slot = (cqueue_spsc_slot *)(first + i * q->elem_size);
+    if (!atomic_load_explicit(&slot->used, memory_order_acquire))
+      break;
+  }
+
+  *got = i;
+  if (!i) {
+    STATS_ADD(q, pop_empty, 1);
+    return NULL;
   }
 
+  return ((cqueue_spsc_slot *)first)->data;
 }
-#endif  // CQUEUE_DEBUG
 
-// private utility functions
+void cqueue_spsc_pop_slots_finish(cqueue_spsc *q, size_t n) {
+  assert(q);
+  assert(n <= q->capacity - spsc_pop_idx(q));
 
-/*! Round up to the next power of 2
+  cqueue_spsc_slot *slot;
+  unsigned char *first;
+  size_t pop_idx;
 
-  \param[in] i the int to round, 0 <= i <= SIZE_MAX/2 +1
-  \returns the next highest power of 2
-  \returns i if is already a power of 2
-  \returns 0 when i > SIZE_MAX/2 +1
-*/
-size_t next_power2(size_t i) {
-  if (i == 0)
-    return 1;
+  if (!n)
+    return;
 
-  i--;
-  for (uint64_t j = 1; j < CHAR_BIT*sizeof(size_t)-1; j*=2)
-    i |= i >> j;
-  i++;
+  pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  first = spsc_array(q) + (pop_idx & (q->capacity - 1)) * q->elem_size;
+  for (size_t i=n-1; i > 0; i--) {
+    slot = (cqueue_spsc_slot *)(first + i * q->elem_size);
+    atomic_store_explicit(&slot->used, 0, memory_order_relaxed);
+  }
+  if (q->lat)
+    spsc_measure(q, pop_idx, n);
+  slot = (cqueue_spsc_slot *)first;
+  atomic_store_explicit(&slot->used, 0, memory_order_release);
+  atomic_store_explicit(&q->pop_idx, pop_idx + n, memory_order_relaxed);
+
+  spsc_wake(q, &q->push_parked, &q->push_armed, q->push_fd);
+}
+
+size_t cqueue_spsc_peek(cqueue_spsc *q, size_t max) {
+  assert(q);
+
+  cqueue_spsc_slot *slot;
+  size_t pop_idx, i;
+
+  if (max > q->capacity)
+    max = q->capacity;
+
+  // scan front to back like cqueue_spsc_pop_slots(), wrapping around
+  pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  for (i=0; i < max; i++) {
+    slot = (cqueue_spsc_slot *)(spsc_array(q) +
+                               ((pop_idx + i) & (q->capacity - 1))
+                               * q->elem_size);
+    if (!atomic_load_explicit(&slot->used, memory_order_acquire))
+      break;
+  }
+
+  if (!i)
+    STATS_ADD(q, pop_empty, 1);
+  return i;
+}
+
+void* cqueue_spsc_peek_slot(cqueue_spsc *q, size_t i) {
+  assert(q);
+  assert(i < q->capacity);
+
+  cqueue_spsc_slot *slot;
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) +
+                             ((pop_idx + i) & (q->capacity - 1))
+                             * q->elem_size);
+  assert(atomic_load_explicit(&slot->used, memory_order_relaxed));
+
+  return slot->data;
+}
+
+void cqueue_spsc_pop_finish_n(cqueue_spsc *q, size_t n) {
+  assert(q);
+  assert(n <= q->capacity);
+
+  cqueue_spsc_slot *slot;
+  size_t pop_idx;
+
+  if (!n)
+    return;
+
+  // the pusher reaches the head slot before any other slot of the run, so
+  // the release store to it covers the whole run even when it wraps
+  pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  for (size_t i=n-1; i > 0; i--) {
+    slot = (cqueue_spsc_slot *)(spsc_array(q) +
+                               ((pop_idx + i) & (q->capacity - 1))
+                               * q->elem_size);
+    atomic_store_explicit(&slot->used, 0, memory_order_relaxed);
+  }
+  if (q->lat)
+    spsc_measure(q, pop_idx, n);
+  slot = (cqueue_spsc_slot *)(spsc_array(q) +
+                             (pop_idx & (q->capacity - 1)) * q->elem_size);
+  atomic_store_explicit(&slot->used, 0, memory_order_release);
+  atomic_store_explicit(&q->pop_idx, pop_idx + n, memory_order_relaxed);
+
+  spsc_wake(q, &q->push_parked, &q->push_armed, q->push_fd);
+}
+
+int cqueue_spsc_set_copy(cqueue_spsc *q, cqueue_copy copy,
+                         uint32_t nt_threshold, int prefetch) {
+  assert(q);
+
+#ifdef X86_COPY
+  if (copy == CQUEUE_COPY_AVX2 && !q->avx2)
+    return -1;
+#else
+  if (copy == CQUEUE_COPY_SSE2 || copy == CQUEUE_COPY_AVX2 ||
+      copy == CQUEUE_COPY_NT)
+    return -1;
+#endif
+
+  q->copy = copy;
+  q->nt_threshold = nt_threshold;
+  q->prefetch = !!prefetch;
+  return 0;
+}
+
+int cqueue_spsc_push(cqueue_spsc *q, const void *src, size_t len) {
+  assert(q);
+
+  void *p;
+
+  if (len > q->elem_size - sizeof(cqueue_spsc_slot))
+    return -1;
+
+  p = cqueue_spsc_push_slot(q);
+  spsc_copy_in(q, p, src, len);
+  cqueue_spsc_push_slot_finish(q);
+  return 0;
+}
+
+int cqueue_spsc_trypush(cqueue_spsc *q, const void *src, size_t len) {
+  assert(q);
+
+  void *p;
+
+  if (len > q->elem_size - sizeof(cqueue_spsc_slot))
+    return -1;
+
+  p = cqueue_spsc_trypush_slot(q);
+  if (!p)
+    return -1;
+  spsc_copy_in(q, p, src, len);
+  cqueue_spsc_push_slot_finish(q);
+  return 0;
+}
+
+int cqueue_spsc_pop(cqueue_spsc *q, void *dst, size_t len) {
+  assert(q);
+
+  void *p;
+
+  if (len > q->elem_size - sizeof(cqueue_spsc_slot))
+    return -1;
+
+  p = cqueue_spsc_pop_slot(q);
+  spsc_copy_out(q, dst, p, len);
+  cqueue_spsc_pop_slot_finish(q);
+  return 0;
+}
+
+int cqueue_spsc_trypop(cqueue_spsc *q, void *dst, size_t len) {
+  assert(q);
+
+  void *p;
+
+  if (len > q->elem_size - sizeof(cqueue_spsc_slot))
+    return -1;
+
+  p = cqueue_spsc_trypop_slot(q);
+  if (!p)
+    return -1;
+  spsc_copy_out(q, dst, p, len);
+  cqueue_spsc_pop_slot_finish(q);
+  return 0;
+}
+
+size_t cqueue_spsc_get_no_used_slots(cqueue_spsc *q) {
+  size_t pop, push;
+
+  pop = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+  push = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+
+  // the indices are stored relaxed after the slots' used flags, which are
+  // what the two sides synchronize on, so either may be seen behind the
+  // other: pop_idx ahead of push_idx, or push_idx a lap past a stale pop_idx
+  if ((ptrdiff_t)(push - pop) < 0)
+    return 0;
+  if (push - pop > q->capacity)
+    return q->capacity;
+  return push - pop;
+}
+
+int cqueue_spsc_enable_latency(cqueue_spsc *q, size_t period,
+                               cqueue_clock clock) {
+  assert(q);
+
+  cqueue_spsc_latency *lat;
+  size_t n;
+
+  // the producer and the consumer of a shared queue see different heaps
+  if ((q->flags & SPSC_SHARED) || q->lat || !period ||
+      period > SIZE_MAX / 2 + 1)
+    return -1;
+#ifndef X86_TSC
+  if (clock == CQUEUE_CLOCK_TSC)
+    return -1;
+#endif
+
+  lat = cacheline_alloc(sizeof(cqueue_spsc_latency));
+  if (!lat)
+    return -1;
+
+  period = next_power2(period);
+  lat->mask = period - 1;
+  lat->shift = ctz64(period);
+  lat->clock = clock;
+  atomic_init(&lat->count, 0);
+  atomic_init(&lat->sum, 0);
+  atomic_init(&lat->max, 0);
+  for (size_t i=0; i < CQUEUE_HIST_BUCKETS; i++)
+    atomic_init(&lat->buckets[i], 0);
+
+  // sampled pushes land on every period-th slot, or always on slot 0
+  n = period < q->capacity ? q->capacity / period : 1;
+  lat->stamps = cacheline_alloc(n * sizeof(uint64_t));
+  if (!lat->stamps) {
+    free(lat);
+    return -1;
+  }
+
+  q->lat = lat;
+  return 0;
+}
+
+void cqueue_spsc_get_latency(cqueue_spsc *q, cqueue_hist *hist) {
+  assert(q);
+  assert(hist);
+
+  cqueue_spsc_latency *lat = q->lat;
+
+  if (!lat) {
+    memset(hist, 0, sizeof(*hist));
+    return;
+  }
+
+  hist->count = atomic_load_explicit(&lat->count, memory_order_relaxed);
+  hist->sum = atomic_load_explicit(&lat->sum, memory_order_relaxed);
+  hist->max = atomic_load_explicit(&lat->max, memory_order_relaxed);
+  for (size_t i=0; i < CQUEUE_HIST_BUCKETS; i++)
+    hist->buckets[i] = atomic_load_explicit(&lat->buckets[i],
+                                            memory_order_relaxed);
+}
+
+uint64_t cqueue_hist_bucket_low(size_t i) {
+  const size_t sub = (size_t)1 << CQUEUE_HIST_SUB_BITS;
+
+  assert(i < CQUEUE_HIST_BUCKETS);
+
+  if (i < sub)
+    return i;
+  // group g holds [2^(g+SUB_BITS-1), 2^(g+SUB_BITS)) in sub buckets
+  return (uint64_t)(sub + i % sub) << (i / sub - 1);
+}
+
+uint64_t cqueue_hist_percentile(const cqueue_hist *hist, double p) {
+  assert(hist);
+
+  uint64_t rank, seen = 0, high;
+
+  if (!hist->count)
+    return 0;
+
+  rank = p <= 0 ? 1 : p >= 1 ? hist->count : (uint64_t)(p * hist->count);
+  if (!rank)
+    rank = 1;
+  for (size_t i=0; i < CQUEUE_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank) {
+      high = i + 1 < CQUEUE_HIST_BUCKETS ? cqueue_hist_bucket_low(i + 1) - 1
+                                         : UINT64_MAX;
+      return high < hist->max ? high : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+#ifdef CQUEUE_STATS
+void cqueue_spsc_get_stats(cqueue_spsc *q, cqueue_spsc_stats *stats) {
+  assert(q);
+  assert(stats);
+
+  stats->pops = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  stats->pushes = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  stats->push_full = atomic_load_explicit(&q->push_full, memory_order_relaxed);
+  stats->pop_empty = atomic_load_explicit(&q->pop_empty, memory_order_relaxed);
+  stats->push_spins = atomic_load_explicit(&q->push_spins,
+                                           memory_order_relaxed);
+  stats->pop_spins = atomic_load_explicit(&q->pop_spins, memory_order_relaxed);
+  stats->high_water = atomic_load_explicit(&q->high_water,
+                                           memory_order_relaxed);
+}
+#endif  // CQUEUE_STATS
+
+#ifdef CQUEUE_DEBUG
+void cqueue_spsc_print(cqueue_spsc *q) {
+  assert(q);
+
+  cqueue_spsc_slot *slot;
+  unsigned char *buf;
+
+  printf("push_idx: %zu\n", atomic_load(&q->push_idx));
+  printf("pop_idx: %zu\n", atomic_load(&q->pop_idx));
+  for (size_t i=0; i < q->capacity; i++) {
+    slot = (cqueue_spsc_slot *)(spsc_array(q) + i * q->elem_size);
+    printf("slot[%zu]:", i);
+
+    if (slot->used)
+      printf(" (used)\n");
+    else
+      printf("\n");
+
+    buf = (unsigned char *)&slot->data;
+    for (size_t j=0; j < q->elem_size - sizeof(size_t); j++)
+      printf("%02x ", buf[j]);
+    printf("\n");
+  }
+
+}
+#endif  // CQUEUE_DEBUG
+
+cqueue_spsc_set* cqueue_spsc_set_new(size_t max_queues) {
+  cqueue_spsc_set *s;
+
+  if (!max_queues || max_queues > UINT_MAX)
+    return NULL;
+
+  s = cacheline_alloc(sizeof(cqueue_spsc_set));
+  if (!s)
+    return NULL;
+
+  s->max_queues = max_queues;
+  s->n_queues = 0;
+  s->n_words = (max_queues + 63) / 64;
+  s->cursor = 0;
+  s->credit = 0;
+  s->members = malloc(max_queues * sizeof(cqueue_spsc_set_member));
+  // producers of different queues set bits in the same words, keep those
+  // off the consumer's lines
+  s->ready = cacheline_alloc(s->n_words * sizeof(_Atomic uint64_t));
+  if (!s->members || !s->ready) {
+    free(s->members);
+    free(s->ready);
+    free(s);
+    return NULL;
+  }
+
+  for (size_t i=0; i < s->n_words; i++)
+    atomic_init(&s->ready[i], 0);
+  return s;
+}
+
+void cqueue_spsc_set_delete(cqueue_spsc_set **p) {
+  cqueue_spsc_set *s = *p;
+  if(!s)
+    return;
+
+  for (size_t i=0; i < s->n_queues; i++) {
+    s->members[i].q->set = NULL;
+    atomic_store_explicit(&s->members[i].q->set_armed, 0,
+                          memory_order_relaxed);
+  }
+
+  free(s->members);
+  free(s->ready);
+  free(s);
+  *p = NULL;
+}
+
+int cqueue_spsc_set_add(cqueue_spsc_set *s, cqueue_spsc *q, unsigned weight) {
+  assert(s);
+  assert(q);
+
+  size_t i = s->n_queues;
+
+  if (i == s->max_queues || !weight || q->set || (q->flags & SPSC_SHARED))
+    return -1;
+
+  s->members[i].q = q;
+  s->members[i].weight = weight;
+  s->n_queues++;
+  q->set = s;
+  q->set_idx = i;
+
+  // start out ready: the first look at the queue arms it if it is empty
+  atomic_store_explicit(&q->set_armed, 0, memory_order_relaxed);
+  atomic_fetch_or_explicit(&s->ready[i / 64], UINT64_C(1) << (i % 64),
+                           memory_order_relaxed);
+  return (int)i;
+}
+
+void* cqueue_spsc_set_trypop_slot(cqueue_spsc_set *s, cqueue_spsc **q) {
+  assert(s);
+  assert(q);
+
+  void *slot;
+  size_t i;
+
+  // keep serving the current queue while it has credit left
+  if (s->credit) {
+    i = s->cursor;
+    slot = cqueue_spsc_trypop_slot(s->members[i].q);
+    if (!slot)
+      slot = set_idle(s, i);
+    if (slot) {
+      s->credit--;
+      *q = s->members[i].q;
+      return slot;
+    }
+  }
+
+  // each pass either pops or clears a ready bit, so this terminates
+  for (size_t tries=0; tries < s->n_queues; tries++) {
+    i = set_next_ready(s, s->cursor + 1 < s->n_queues ? s->cursor + 1 : 0);
+    if (i == SIZE_MAX)
+      break;
+
+    s->cursor = i;
+    slot = cqueue_spsc_trypop_slot(s->members[i].q);
+    if (!slot)
+      slot = set_idle(s, i);
+    if (slot) {
+      s->credit = s->members[i].weight - 1;
+      *q = s->members[i].q;
+      return slot;
+    }
+  }
+
+  s->credit = 0;
+  return NULL;
+}
+
+size_t cqueue_spsc_set_get_no_ready(cqueue_spsc_set *s) {
+  size_t n = 0;
+
+  assert(s);
+
+  for (size_t i=0; i < s->n_words; i++)
+    n += popcount64(atomic_load_explicit(&s->ready[i], memory_order_relaxed));
+  return n;
+}
+
+void* cqueue_spsc_set_trypop_slot_first(cqueue_spsc_set *s, cqueue_spsc **q) {
+  assert(s);
+  assert(q);
+
+  void *slot;
+  size_t i;
+
+  // each pass either pops or clears a ready bit, so this terminates
+  for (size_t tries=0; tries < s->n_queues; tries++) {
+    i = set_next_ready(s, 0);
+    if (i == SIZE_MAX)
+      break;
+
+    slot = cqueue_spsc_trypop_slot(s->members[i].q);
+    if (!slot)
+      slot = set_idle(s, i);
+    if (slot) {
+      s->cursor = i;
+      s->credit = 0;
+      *q = s->members[i].q;
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+cqueue_lanes* cqueue_lanes_new(size_t n_lanes, const size_t *capacities,
+                               size_t elem_size, cqueue_lanes_policy policy,
+                               const unsigned *weights) {
+  cqueue_lanes *l;
+  size_t i;
+
+  if (!n_lanes || !capacities || n_lanes > SIZE_MAX / sizeof(cqueue_spsc *))
+    return NULL;
+
+  l = cacheline_alloc(sizeof(cqueue_lanes));
+  if (!l)
+    return NULL;
+
+  l->n_lanes = n_lanes;
+  l->policy = policy;
+  l->popping = NULL;
+  l->set = cqueue_spsc_set_new(n_lanes);
+  l->lanes = calloc(n_lanes, sizeof(cqueue_spsc *));
+  if (!l->set || !l->lanes)
+    goto fail;
+
+  for (i=0; i < n_lanes; i++) {
+    l->lanes[i] = cqueue_spsc_new(capacities[i], elem_size);
+    if (!l->lanes[i] ||
+        cqueue_spsc_set_add(l->set, l->lanes[i], weights ? weights[i] : 1) < 0)
+      goto fail;
+  }
+  return l;
+
+fail:
+  cqueue_spsc_set_delete(&l->set);
+  if (l->lanes)
+    for (i=0; i < n_lanes; i++)
+      cqueue_spsc_delete(&l->lanes[i]);
+  free(l->lanes);
+  free(l);
+  return NULL;
+}
+
+void cqueue_lanes_delete(cqueue_lanes **p) {
+  cqueue_lanes *l = *p;
+  if(!l)
+    return;
+
+  cqueue_spsc_set_delete(&l->set);
+  for (size_t i=0; i < l->n_lanes; i++)
+    cqueue_spsc_delete(&l->lanes[i]);
+  free(l->lanes);
+  free(l);
+  *p = NULL;
+}
+
+void* cqueue_lanes_trypush_slot(cqueue_lanes *l, size_t lane) {
+  assert(l);
+  assert(lane < l->n_lanes);
+
+  return cqueue_spsc_trypush_slot(l->lanes[lane]);
+}
+
+void cqueue_lanes_push_slot_finish(cqueue_lanes *l, size_t lane) {
+  assert(l);
+  assert(lane < l->n_lanes);
+
+  // marks the lane ready in the set if the consumer found it empty
+  cqueue_spsc_push_slot_finish(l->lanes[lane]);
+}
+
+void* cqueue_lanes_trypop_slot(cqueue_lanes *l, size_t *lane) {
+  assert(l);
+
+  void *slot;
+
+  if (l->policy == CQUEUE_LANES_STRICT)
+    slot = cqueue_spsc_set_trypop_slot_first(l->set, &l->popping);
+  else
+    slot = cqueue_spsc_set_trypop_slot(l->set, &l->popping);
+
+  if (slot && lane)
+    *lane = l->popping->set_idx;
+  return slot;
+}
+
+void cqueue_lanes_pop_slot_finish(cqueue_lanes *l) {
+  assert(l);
+  assert(l->popping);
+
+  cqueue_spsc_pop_slot_finish(l->popping);
+}
+
+size_t cqueue_lanes_get_no_used_slots(cqueue_lanes *l, size_t lane) {
+  assert(l);
+  assert(lane < l->n_lanes);
+
+  return cqueue_spsc_get_no_used_slots(l->lanes[lane]);
+}
+
+cqueue_spsc_unbounded* cqueue_spsc_unbounded_new(size_t seg_capacity,
+                                                 size_t elem_size,
+                                                 size_t max_bytes) {
+  size_t realcap, slot, seg_size;
+  cqueue_spsc_unbounded *q;
+
+  if (!elem_size)
+    return NULL;
+
+  realcap = next_power2(seg_capacity);
+  if (!realcap)
+    return NULL;
+
+  slot = slot_size(elem_size, sizeof(_Atomic size_t));
+  if (!slot || realcap > (SIZE_MAX - sizeof(cqueue_spsc_segment)) / slot)
+    return NULL;
+  seg_size = sizeof(cqueue_spsc_segment) + realcap * slot;
+
+  q = cacheline_alloc(sizeof(cqueue_spsc_unbounded));
+  if (!q)
+    return NULL;
+
+  q->seg_capacity = realcap;
+  q->elem_size = slot;
+  q->max_segments = 0;
+  if (max_bytes) {
+    // the producer's and the consumer's segments
+    q->max_segments = max_bytes / seg_size;
+    if (q->max_segments < 2)
+      q->max_segments = 2;
+  }
+
+  // with a limit, every segment fits in the cache and none is ever freed
+  q->cache = cqueue_spsc_new(q->max_segments ? q->max_segments
+                                             : SEGMENT_CACHE_SIZE,
+                             sizeof(cqueue_spsc_segment*));
+  if (!q->cache) {
+    free(q);
+    return NULL;
+  }
+
+  atomic_init(&q->push_idx, 0);
+  q->push_seg_start = 0;
+  q->n_allocated = 0;
+  atomic_init(&q->pop_idx, 0);
+  q->pop_seg_start = 0;
+  atomic_init(&q->n_freed, 0);
+
+  q->push_seg = segment_get(q);
+  if (!q->push_seg) {
+    cqueue_spsc_delete(&q->cache);
+    free(q);
+    return NULL;
+  }
+  q->pop_seg = q->push_seg;
+  return q;
+}
+
+void cqueue_spsc_unbounded_delete(cqueue_spsc_unbounded **p) {
+  cqueue_spsc_unbounded *q = *p;
+  cqueue_spsc_segment *seg, *next, **cached;
+
+  if(!q)
+    return;
+
+  for (seg = q->pop_seg; seg; seg = next) {
+    next = atomic_load_explicit(&seg->next, memory_order_relaxed);
+    free(seg);
+  }
+
+  while ((cached = cqueue_spsc_trypop_slot(q->cache)) != NULL) {
+    free(*cached);
+    cqueue_spsc_pop_slot_finish(q->cache);
+  }
+  cqueue_spsc_delete(&q->cache);
+
+  free(q);
+  *p = NULL;
+}
+
+void* cqueue_spsc_unbounded_push_slot(cqueue_spsc_unbounded *q) {
+  void *p;
+
+  while ((p = cqueue_spsc_unbounded_trypush_slot(q)) == NULL)
+    cpu_relax();
+  return p;
+}
+
+void* cqueue_spsc_unbounded_trypush_slot(cqueue_spsc_unbounded *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  cqueue_spsc_segment *seg;
+  cqueue_spsc_slot *slot;
+
+  // move on to a new segment once this one is full. The consumer may follow
+  // the link right away, it finds the new segment's slots unused
+  if (push_idx - q->push_seg_start == q->seg_capacity) {
+    seg = segment_get(q);
+    if (!seg)
+      return NULL;
+
+    atomic_store_explicit(&q->push_seg->next, seg, memory_order_release);
+    q->push_seg = seg;
+    q->push_seg_start = push_idx;
+  }
+
+  slot = (cqueue_spsc_slot *)(q->push_seg->array +
+                              (push_idx - q->push_seg_start) * q->elem_size);
+  return slot->data;
+}
+
+void cqueue_spsc_unbounded_push_slot_finish(cqueue_spsc_unbounded *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  cqueue_spsc_slot *slot;
+
+  slot = (cqueue_spsc_slot *)(q->push_seg->array +
+                              (push_idx - q->push_seg_start) * q->elem_size);
+  atomic_store_explicit(&slot->used, 1, memory_order_release);
+  atomic_store_explicit(&q->push_idx, push_idx + 1, memory_order_relaxed);
+}
+
+void* cqueue_spsc_unbounded_pop_slot(cqueue_spsc_unbounded *q) {
+  void *p;
+
+  while ((p = cqueue_spsc_unbounded_trypop_slot(q)) == NULL)
+    cpu_relax();
+  return p;
+}
+
+void* cqueue_spsc_unbounded_trypop_slot(cqueue_spsc_unbounded *q) {
+  assert(q);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  cqueue_spsc_segment *seg;
+  cqueue_spsc_slot *slot;
+
+  // follow the producer to the next segment once this one is drained
+  if (pop_idx - q->pop_seg_start == q->seg_capacity) {
+    seg = atomic_load_explicit(&q->pop_seg->next, memory_order_acquire);
+    if (!seg)
+      return NULL;
+
+    segment_put(q, q->pop_seg);
+    q->pop_seg = seg;
+    q->pop_seg_start = pop_idx;
+  }
+
+  slot = (cqueue_spsc_slot *)(q->pop_seg->array +
+                              (pop_idx - q->pop_seg_start) * q->elem_size);
+  if (!atomic_load_explicit(&slot->used, memory_order_acquire))
+    return NULL;
+
+  return slot->data;
+}
+
+void cqueue_spsc_unbounded_pop_slot_finish(cqueue_spsc_unbounded *q) {
+  assert(q);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  cqueue_spsc_slot *slot;
+
+  // leave the slot unused, ready for when the segment is reused
+  slot = (cqueue_spsc_slot *)(q->pop_seg->array +
+                              (pop_idx - q->pop_seg_start) * q->elem_size);
+  atomic_store_explicit(&slot->used, 0, memory_order_relaxed);
+  atomic_store_explicit(&q->pop_idx, pop_idx + 1, memory_order_relaxed);
+}
+
+size_t cqueue_spsc_unbounded_get_no_used_slots(cqueue_spsc_unbounded *q) {
+  size_t push, pop;
+
+  assert(q);
+
+  pop = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+  push = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+
+  // as in cqueue_spsc, push_idx is stored relaxed after the used flag the
+  // consumer synchronizes on, and may be seen behind pop_idx
+  if ((ptrdiff_t)(push - pop) < 0)
+    return 0;
+  return push - pop;
+}
+
+cqueue_spsc_dense* cqueue_spsc_dense_new(size_t capacity, size_t elem_size) {
+  size_t realcap, align;
+  cqueue_spsc_dense *q;
+
+  if (!elem_size)
+    return NULL;
+
+  realcap = next_power2(capacity);
+  if (!realcap)
+    return NULL;
+
+  // pack elements tightly, but keep every slot aligned for its contents
+  align = _Alignof(max_align_t);
+  if (elem_size < align)
+    elem_size = next_power2(elem_size);
+  else if (elem_size % align) {
+    if (elem_size > SIZE_MAX - align)
+      return NULL;
+    elem_size += align - elem_size % align;
+  }
+
+  q = cacheline_alloc(sizeof(cqueue_spsc_dense));
+  if (!q)
+    return NULL;
+
+  q->capacity = realcap;
+  q->elem_size = elem_size;
+
+  q->array = array_alloc(q->capacity, q->elem_size);
+  if (!q->array) {
+    free(q);
+    return NULL;
+  }
+
+  atomic_init(&q->push_idx, 0);
+  q->pop_idx_cache = 0;
+  atomic_init(&q->pop_idx, 0);
+  q->push_idx_cache = 0;
+  return q;
+}
+
+void cqueue_spsc_dense_delete(cqueue_spsc_dense **p) {
+  cqueue_spsc_dense *q = *p;
+  if(!q)
+    return;
+
+  if(q->array)
+    free(q->array);
+
+  free(q);
+  *p = NULL;
+}
+
+void* cqueue_spsc_dense_push_slot(cqueue_spsc_dense *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+
+  // only look at the consumer's cacheline when the cached copy says full
+  while (push_idx - q->pop_idx_cache == q->capacity)
+    q->pop_idx_cache = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+
+  return q->array + (push_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void* cqueue_spsc_dense_trypush_slot(cqueue_spsc_dense *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+
+  // only look at the consumer's cacheline when the cached copy says full
+  if (push_idx - q->pop_idx_cache == q->capacity) {
+    q->pop_idx_cache = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+    if (push_idx - q->pop_idx_cache == q->capacity)
+      return NULL;
+  }
+
+  return q->array + (push_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void cqueue_spsc_dense_push_slot_finish(cqueue_spsc_dense *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  atomic_store_explicit(&q->push_idx, push_idx + 1, memory_order_release);
+}
+
+void* cqueue_spsc_dense_pop_slot(cqueue_spsc_dense *q) {
+  assert(q);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+
+  // only look at the producer's cacheline when the cached copy says empty
+  while (pop_idx == q->push_idx_cache)
+    q->push_idx_cache = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+
+  return q->array + (pop_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void* cqueue_spsc_dense_trypop_slot(cqueue_spsc_dense *q) {
+  assert(q);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+
+  // only look at the producer's cacheline when the cached copy says empty
+  if (pop_idx == q->push_idx_cache) {
+    q->push_idx_cache = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+    if (pop_idx == q->push_idx_cache)
+      return NULL;
+  }
+
+  return q->array + (pop_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void cqueue_spsc_dense_pop_slot_finish(cqueue_spsc_dense *q) {
+  assert(q);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  atomic_store_explicit(&q->pop_idx, pop_idx + 1, memory_order_release);
+}
+
+size_t cqueue_spsc_dense_get_no_used_slots(cqueue_spsc_dense *q) {
+  size_t pop, push;
+
+  // load pop first: push_idx can only have grown by the time it is loaded
+  pop = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+  push = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+  return push - pop;
+}
+
+cqueue_mpmc* cqueue_mpmc_new(size_t capacity, size_t elem_size) {
+  size_t realcap;
+  cqueue_mpmc *q;
+
+  if (!elem_size)
+    return NULL;
+
+  // a single slot cannot tell a full lap from an empty one
+  realcap = next_power2(capacity < 2 ? 2 : capacity);
+  if (!realcap)
+    return NULL;
+
+  q = cacheline_alloc(sizeof(cqueue_mpmc));
+  if (!q)
+    return NULL;
+
+  q->capacity = realcap;
+  q->elem_size = slot_size(elem_size, sizeof(_Atomic size_t));
+  if (!q->elem_size) {
+    free(q);
+    return NULL;
+  }
+
+  q->array = seq_array_alloc(q->capacity, q->elem_size);
+  if (!q->array) {
+    free(q);
+    return NULL;
+  }
+
+  atomic_init(&q->push_idx, 0);
+  atomic_init(&q->pop_idx, 0);
+  return q;
+}
+
+void cqueue_mpmc_delete(cqueue_mpmc **p) {
+  cqueue_mpmc *q = *p;
+  if(!q)
+    return;
+
+  if(q->array)
+    free(q->array);
+
+  free(q);
+  *p = NULL;
+}
+
+void* cqueue_mpmc_push_slot(cqueue_mpmc *q) {
+  assert(q);
+
+  return seq_push_slot(&q->push_idx, q->array, q->capacity, q->elem_size);
+}
+
+void* cqueue_mpmc_trypush_slot(cqueue_mpmc *q) {
+  assert(q);
+
+  return seq_trypush_slot(&q->push_idx, q->array, q->capacity, q->elem_size);
+}
+
+void cqueue_mpmc_push_slot_finish(cqueue_mpmc *q, void *p) {
+  assert(q);
+  assert(p);
+  (void)q;
+
+  seq_push_slot_finish(p);
+}
+
+void* cqueue_mpmc_pop_slot(cqueue_mpmc *q) {
+  assert(q);
+
+  cqueue_mpmc_slot *slot;
+  size_t pos;
+
+  // claim a position unconditionally, then wait for its slot to be filled
+  pos = atomic_fetch_add_explicit(&q->pop_idx, 1, memory_order_relaxed);
+  slot = (cqueue_mpmc_slot *)(q->array + (pos & (q->capacity - 1)) * q->elem_size);
+
+  while(atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1);
+
+  return slot->data;
+}
+
+void* cqueue_mpmc_trypop_slot(cqueue_mpmc *q) {
+  assert(q);
+
+  cqueue_mpmc_slot *slot;
+  size_t pos, seq;
+
+  pos = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  while(1) {
+    slot = (cqueue_mpmc_slot *)(q->array + (pos & (q->capacity - 1)) * q->elem_size);
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if (seq == pos + 1) {
+      // the slot holds data, try to claim it
+      if (atomic_compare_exchange_weak_explicit(&q->pop_idx, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        return slot->data;
+    } else if ((ptrdiff_t)(seq - (pos + 1)) < 0) {
+      // the slot has not been pushed yet, ie the queue is empty
+      return NULL;
+    } else {
+      // another popper claimed pos
+      pos = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+    }
+  }
+}
+
+void cqueue_mpmc_pop_slot_finish(cqueue_mpmc *q, void *p) {
+  assert(q);
+  assert(p);
+
+  cqueue_mpmc_slot *slot;
+  size_t seq;
+
+  slot = (cqueue_mpmc_slot *)((unsigned char *)p - offsetof(cqueue_mpmc_slot, data));
+
+  // we own the slot, so seq == pos+1; free it for the pusher one lap later
+  seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + q->capacity - 1, memory_order_release);
+}
+
+size_t cqueue_mpmc_get_no_used_slots(cqueue_mpmc *q) {
+  size_t pop, push;
+
+  // load pop first: push_idx can only have grown by the time it is loaded
+  pop = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+  push = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+
+  // blocked poppers may have claimed positions ahead of the pushers
+  if ((ptrdiff_t)(push - pop) < 0)
+    return 0;
+  if (push - pop > q->capacity)
+    return q->capacity;
+  return push - pop;
+}
+
+#ifdef CQUEUE_DEBUG
+void cqueue_mpmc_print(cqueue_mpmc *q) {
+  assert(q);
+
+  cqueue_mpmc_slot *slot;
+  unsigned char *buf;
+
+  printf("push_idx: %zu\n", atomic_load(&q->push_idx));
+  printf("pop_idx: %zu\n", atomic_load(&q->pop_idx));
+  for (size_t i=0; i < q->capacity; i++) {
+    slot = (cqueue_mpmc_slot *)(q->array + i * q->elem_size);
+    printf("slot[%zu]: seq %zu\n", i, atomic_load(&slot->seq));
+
+    buf = (unsigned char *)&slot->data;
+    for (size_t j=0; j < q->elem_size - sizeof(size_t); j++)
+      printf("%02x ", buf[j]);
+    printf("\n");
+  }
+}
+#endif  // CQUEUE_DEBUG
+
+cqueue_mpsc* cqueue_mpsc_new(size_t capacity, size_t elem_size) {
+  size_t realcap;
+  cqueue_mpsc *q;
+
+  if (!elem_size)
+    return NULL;
+
+  // a single slot cannot tell a full lap from an empty one
+  realcap = next_power2(capacity < 2 ? 2 : capacity);
+  if (!realcap)
+    return NULL;
+
+  q = cacheline_alloc(sizeof(cqueue_mpsc));
+  if (!q)
+    return NULL;
+
+  q->capacity = realcap;
+  q->elem_size = slot_size(elem_size, sizeof(_Atomic size_t));
+  if (!q->elem_size) {
+    free(q);
+    return NULL;
+  }
+
+  q->array = seq_array_alloc(q->capacity, q->elem_size);
+  if (!q->array) {
+    free(q);
+    return NULL;
+  }
+
+  atomic_init(&q->push_idx, 0);
+  q->pop_idx = 0;
+  return q;
+}
+
+void cqueue_mpsc_delete(cqueue_mpsc **p) {
+  cqueue_mpsc *q = *p;
+  if(!q)
+    return;
+
+  if(q->array)
+    free(q->array);
+
+  free(q);
+  *p = NULL;
+}
+
+void* cqueue_mpsc_push_slot(cqueue_mpsc *q) {
+  assert(q);
+
+  return seq_push_slot(&q->push_idx, q->array, q->capacity, q->elem_size);
+}
+
+void* cqueue_mpsc_trypush_slot(cqueue_mpsc *q) {
+  assert(q);
+
+  return seq_trypush_slot(&q->push_idx, q->array, q->capacity, q->elem_size);
+}
+
+void cqueue_mpsc_push_slot_finish(cqueue_mpsc *q, void *p) {
+  assert(q);
+  assert(p);
+  (void)q;
+
+  seq_push_slot_finish(p);
+}
+
+void* cqueue_mpsc_pop_slot(cqueue_mpsc *q) {
+  assert(q);
+
+  cqueue_mpmc_slot *slot;
+  slot = (cqueue_mpmc_slot *)(q->array + (q->pop_idx & (q->capacity - 1)) * q->elem_size);
+
+  // check if the queue is empty, ie the slot has not been pushed this lap
+  while(atomic_load_explicit(&slot->seq, memory_order_acquire) != q->pop_idx + 1);
+
+  return slot->data;
+}
+
+void* cqueue_mpsc_trypop_slot(cqueue_mpsc *q) {
+  assert(q);
+
+  cqueue_mpmc_slot *slot;
+  slot = (cqueue_mpmc_slot *)(q->array + (q->pop_idx & (q->capacity - 1)) * q->elem_size);
+
+  // check if the queue is empty, ie the slot has not been pushed this lap
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != q->pop_idx + 1)
+    return NULL;
+
+  return slot->data;
+}
+
+void cqueue_mpsc_pop_slot_finish(cqueue_mpsc *q) {
+  assert(q);
+
+  cqueue_mpmc_slot *slot;
+  slot = (cqueue_mpmc_slot *)(q->array + (q->pop_idx & (q->capacity - 1)) * q->elem_size);
+
+  // free the slot for the pusher one lap later
+  atomic_store_explicit(&slot->seq, q->pop_idx + q->capacity, memory_order_release);
+  q->pop_idx++;
+}
+
+cqueue_bcast* cqueue_bcast_new(size_t capacity, size_t elem_size,
+                               size_t n_consumers) {
+  size_t realcap;
+  cqueue_bcast *q;
+
+  if (!elem_size || !n_consumers)
+    return NULL;
+
+  realcap = next_power2(capacity);
+  if (!realcap)
+    return NULL;
+
+  // check for n_consumers * sizeof(cqueue_bcast_cursor) overflow
+  if (n_consumers > (SIZE_MAX - sizeof(cqueue_bcast))/sizeof(cqueue_bcast_cursor))
+    return NULL;
+
+  q = cacheline_alloc(sizeof(cqueue_bcast)
+                      + n_consumers * sizeof(cqueue_bcast_cursor));
+  if (!q)
+    return NULL;
+
+  q->capacity = realcap;
+  q->n_consumers = n_consumers;
+
+  // slots have no header, the producer's and consumers' indices tell
+  // whether a slot holds data
+  q->elem_size = slot_size(elem_size, 0);
+  if (!q->elem_size) {
+    free(q);
+    return NULL;
+  }
+
+  q->array = array_alloc(q->capacity, q->elem_size);
+  if (!q->array) {
+    free(q);
+    return NULL;
+  }
+
+  atomic_init(&q->push_idx, 0);
+  q->pop_idx_cache = 0;
+  for (size_t i=0; i < n_consumers; i++) {
+    atomic_init(&q->cursors[i].pop_idx, 0);
+    q->cursors[i].push_idx_cache = 0;
+  }
+  return q;
+}
+
+void cqueue_bcast_delete(cqueue_bcast **p) {
+  cqueue_bcast *q = *p;
+  if(!q)
+    return;
+
+  if(q->array)
+    free(q->array);
+
+  free(q);
+  *p = NULL;
+}
+
+void* cqueue_bcast_push_slot(cqueue_bcast *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+
+  while(bcast_full(q));
+
+  return q->array + (push_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void* cqueue_bcast_trypush_slot(cqueue_bcast *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+
+  if (bcast_full(q))
+    return NULL;
+
+  return q->array + (push_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void cqueue_bcast_push_slot_finish(cqueue_bcast *q) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  atomic_store_explicit(&q->push_idx, push_idx + 1, memory_order_release);
+}
+
+const void* cqueue_bcast_pop_slot(cqueue_bcast *q, size_t consumer) {
+  assert(q);
+  assert(consumer < q->n_consumers);
+
+  cqueue_bcast_cursor *c = &q->cursors[consumer];
+  size_t pop_idx = atomic_load_explicit(&c->pop_idx, memory_order_relaxed);
+
+  // only look at the producer's cacheline when the cached copy says empty
+  while (pop_idx == c->push_idx_cache)
+    c->push_idx_cache = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+
+  return q->array + (pop_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+const void* cqueue_bcast_trypop_slot(cqueue_bcast *q, size_t consumer) {
+  assert(q);
+  assert(consumer < q->n_consumers);
+
+  cqueue_bcast_cursor *c = &q->cursors[consumer];
+  size_t pop_idx = atomic_load_explicit(&c->pop_idx, memory_order_relaxed);
+
+  // only look at the producer's cacheline when the cached copy says empty
+  if (pop_idx == c->push_idx_cache) {
+    c->push_idx_cache = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+    if (pop_idx == c->push_idx_cache)
+      return NULL;
+  }
+
+  return q->array + (pop_idx & (q->capacity - 1)) * q->elem_size;
+}
+
+void cqueue_bcast_pop_slot_finish(cqueue_bcast *q, size_t consumer) {
+  assert(q);
+  assert(consumer < q->n_consumers);
+
+  cqueue_bcast_cursor *c = &q->cursors[consumer];
+  size_t pop_idx = atomic_load_explicit(&c->pop_idx, memory_order_relaxed);
+
+  // release: the producer may overwrite the slot once it sees the new index
+  atomic_store_explicit(&c->pop_idx, pop_idx + 1, memory_order_release);
+}
+
+cqueue_bytering* cqueue_bytering_new(size_t capacity) {
+  size_t realcap;
+  cqueue_bytering *q;
+
+  // room for at least one record with a byte of data
+  if (capacity < 4 * BYTERING_HDR)
+    capacity = 4 * BYTERING_HDR;
+
+  realcap = next_power2(capacity);
+  if (!realcap)
+    return NULL;
+
+  q = cacheline_alloc(sizeof(cqueue_bytering));
+  if (!q)
+    return NULL;
+
+  q->capacity = realcap;
+  q->max_len = realcap / 2 - BYTERING_HDR;
+
+  q->array = cacheline_alloc(q->capacity);
+  if (!q->array) {
+    free(q);
+    return NULL;
+  }
+
+  atomic_init(&q->push_idx, 0);
+  q->pop_idx_cache = 0;
+  q->push_skip = 0;
+  atomic_init(&q->pop_idx, 0);
+  q->push_idx_cache = 0;
+  q->pop_size = 0;
+  return q;
+}
+
+void cqueue_bytering_delete(cqueue_bytering **p) {
+  cqueue_bytering *q = *p;
+  if(!q)
+    return;
+
+  if(q->array)
+    free(q->array);
+
+  free(q);
+  *p = NULL;
+}
+
+void* cqueue_bytering_push_slot(cqueue_bytering *q, size_t len) {
+  void *p;
+
+  assert(q);
+
+  if (len > q->max_len)
+    return NULL;
+
+  while ((p = cqueue_bytering_trypush_slot(q, len)) == NULL);
+  return p;
+}
+
+void* cqueue_bytering_trypush_slot(cqueue_bytering *q, size_t len) {
+  assert(q);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  size_t off = push_idx & (q->capacity - 1);
+  size_t need, skip;
+
+  if (len > q->max_len)
+    return NULL;
+
+  // a record that would straddle the end goes to the start of the array,
+  // behind a skip record. Since records are at most half the array, the
+  // pair always fits in an empty ring
+  need = bytering_record_size(len);
+  skip = need > q->capacity - off ? q->capacity - off : 0;
+
+  // only look at the consumer's cacheline when the cached copy says full
+  if (push_idx + skip + need - q->pop_idx_cache > q->capacity) {
+    q->pop_idx_cache = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+    if (push_idx + skip + need - q->pop_idx_cache > q->capacity)
+      return NULL;
+  }
+
+  // published along with the record by push_slot_finish's release
+  if (skip)
+    *(size_t *)(q->array + off) = BYTERING_SKIP;
+  q->push_skip = skip;
+
+  return q->array + ((push_idx + skip) & (q->capacity - 1)) + BYTERING_HDR;
+}
+
+void cqueue_bytering_push_slot_finish(cqueue_bytering *q, size_t len) {
+  assert(q);
+  assert(len <= q->max_len);
+
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+
+  push_idx += q->push_skip;
+  *(size_t *)(q->array + (push_idx & (q->capacity - 1))) = len;
+  atomic_store_explicit(&q->push_idx, push_idx + bytering_record_size(len),
+                        memory_order_release);
+}
+
+void* cqueue_bytering_pop_slot(cqueue_bytering *q, size_t *len) {
+  void *p;
+
+  while ((p = cqueue_bytering_trypop_slot(q, len)) == NULL);
+  return p;
+}
+
+void* cqueue_bytering_trypop_slot(cqueue_bytering *q, size_t *len) {
+  assert(q);
+  assert(len);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  size_t off = pop_idx & (q->capacity - 1);
+  size_t skip = 0;
+
+  // only look at the producer's cacheline when the cached copy says empty
+  if (pop_idx == q->push_idx_cache) {
+    q->push_idx_cache = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+    if (pop_idx == q->push_idx_cache)
+      return NULL;
+  }
+
+  // a skip record is always followed by a record at the start of the array
+  if (*(size_t *)(q->array + off) == BYTERING_SKIP) {
+    skip = q->capacity - off;
+    off = 0;
+  }
+
+  *len = *(size_t *)(q->array + off);
+  q->pop_size = skip + bytering_record_size(*len);
+  return q->array + off + BYTERING_HDR;
+}
+
+void cqueue_bytering_pop_slot_finish(cqueue_bytering *q) {
+  assert(q);
+
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed);
+  atomic_store_explicit(&q->pop_idx, pop_idx + q->pop_size,
+                        memory_order_release);
+}
+
+size_t cqueue_bytering_get_no_used_bytes(cqueue_bytering *q) {
+  size_t push, pop;
+
+  assert(q);
+
+  // load pop first: push_idx can only have grown by the time it is loaded
+  pop = atomic_load_explicit(&q->pop_idx, memory_order_acquire);
+  push = atomic_load_explicit(&q->push_idx, memory_order_acquire);
+  return push - pop;
+}
+
+cqueue_mailbox* cqueue_mailbox_new(size_t elem_size) {
+  size_t words;
+  cqueue_mailbox *m;
+
+  if (!elem_size || elem_size > SIZE_MAX - sizeof(cqueue_mailbox)
+                                - sizeof(uint64_t))
+    return NULL;
+
+  words = (elem_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  m = cacheline_alloc(sizeof(cqueue_mailbox) + words * sizeof(uint64_t));
+  if (!m)
+    return NULL;
+
+  m->elem_size = elem_size;
+  atomic_init(&m->seq, 0);
+  for (size_t i=0; i < words; i++)
+    atomic_init(&m->data[i], 0);
+  return m;
+}
+
+void cqueue_mailbox_delete(cqueue_mailbox **p) {
+  cqueue_mailbox *m = *p;
+  if(!m)
+    return;
+
+  free(m);
+  *p = NULL;
+}
+
+void cqueue_mailbox_write(cqueue_mailbox *m, const void *src) {
+  assert(m);
+  assert(src);
+
+  seqlock_write(&m->seq, m->data, src, m->elem_size);
+}
+
+uint64_t cqueue_mailbox_read(cqueue_mailbox *m, void *dst) {
+  assert(m);
+  assert(dst);
+
+  return seqlock_read(&m->seq, m->data, dst, m->elem_size) / 2;
+}
+
+int cqueue_mailbox_tryread(cqueue_mailbox *m, void *dst, uint64_t *version) {
+  assert(m);
+  assert(dst);
+  assert(version);
+
+  // a write in progress leaves seq / 2 at the previous version
+  if (atomic_load_explicit(&m->seq, memory_order_acquire) / 2 == *version)
+    return -1;
+
+  *version = seqlock_read(&m->seq, m->data, dst, m->elem_size) / 2;
+  return 0;
+}
+
+cqueue_conflate* cqueue_conflate_new(size_t n_keys, size_t elem_size) {
+  cqueue_conflate_entry *e;
+  cqueue_conflate *q;
+
+  if (!n_keys || !elem_size || elem_size > SIZE_MAX - sizeof(uint64_t))
+    return NULL;
+
+  q = cacheline_alloc(sizeof(cqueue_conflate));
+  if (!q)
+    return NULL;
+
+  q->n_keys = n_keys;
+  q->elem_size = elem_size;
+  q->entry_size = slot_size((elem_size + sizeof(uint64_t) - 1)
+                            / sizeof(uint64_t) * sizeof(uint64_t),
+                            sizeof(cqueue_conflate_entry));
+  q->entries = q->entry_size ? array_alloc(n_keys, q->entry_size) : NULL;
+  q->ready = cqueue_spsc_dense_new(n_keys, sizeof(size_t));
+  if (!q->entries || !q->ready) {
+    free(q->entries);
+    cqueue_spsc_dense_delete(&q->ready);
+    free(q);
+    return NULL;
+  }
+
+  for (size_t k=0; k < n_keys; k++) {
+    e = (cqueue_conflate_entry *)(q->entries + k * q->entry_size);
+    atomic_init(&e->seq, 0);
+    atomic_init(&e->pending, 0);
+    e->delivered = 0;
+    for (size_t i=0; i * sizeof(uint64_t) < elem_size; i++)
+      atomic_init(&e->data[i], 0);
+  }
+  return q;
+}
+
+void cqueue_conflate_delete(cqueue_conflate **p) {
+  cqueue_conflate *q = *p;
+  if(!q)
+    return;
+
+  free(q->entries);
+  cqueue_spsc_dense_delete(&q->ready);
+  free(q);
+  *p = NULL;
+}
+
+int cqueue_conflate_push(cqueue_conflate *q, size_t key, const void *src) {
+  assert(q);
+  assert(src);
+
+  cqueue_conflate_entry *e;
+  size_t *k;
+
+  if (key >= q->n_keys)
+    return -1;
+
+  e = (cqueue_conflate_entry *)(q->entries + key * q->entry_size);
+  seqlock_write(&e->seq, e->data, src, q->elem_size);
+
+  // pairs with the fence in cqueue_conflate_trypop: either the consumer
+  // sees the new seq when it reads the key, or we see the key no longer
+  // pending and queue it again. Acquire pairs with the release clearing
+  // pending, so that we then also see the ready slot the key was popped
+  // from free again
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_exchange_explicit(&e->pending, 1, memory_order_acquire))
+    return 0;
+
+  // a key is only queued while it is not pending, ie at most once
+  k = cqueue_spsc_dense_trypush_slot(q->ready);
+  assert(k);
+  *k = key;
+  cqueue_spsc_dense_push_slot_finish(q->ready);
+  return 0;
+}
+
+int cqueue_conflate_trypop(cqueue_conflate *q, size_t *key, void *dst) {
+  assert(q);
+  assert(key);
+  assert(dst);
+
+  cqueue_conflate_entry *e;
+  size_t *k, kv;
+
+  while ((k = cqueue_spsc_dense_trypop_slot(q->ready)) != NULL) {
+    kv = *k;
+    cqueue_spsc_dense_pop_slot_finish(q->ready);
+    e = (cqueue_conflate_entry *)(q->entries + kv * q->entry_size);
+
+    // clear pending before reading the value, so that an update racing
+    // with the read queues the key again rather than being lost. Release
+    // publishes the pop above to the producer that sees it cleared
+    atomic_store_explicit(&e->pending, 0, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // the key was queued again by an update that the previous read of the
+    // key already returned
+    if (atomic_load_explicit(&e->seq, memory_order_acquire) == e->delivered)
+      continue;
+
+    e->delivered = seqlock_read(&e->seq, e->data, dst, q->elem_size);
+    *key = kv;
+    return 0;
+  }
+
+  return -1;
+}
+
+size_t cqueue_conflate_get_no_pending(cqueue_conflate *q) {
+  assert(q);
+
+  return cqueue_spsc_dense_get_no_used_slots(q->ready);
+}
+
+cqueue_pool* cqueue_pool_new(size_t n_buffers, size_t buf_size,
+                             const cqueue_spsc_opts *opts) {
+  cqueue_spsc_opts defaults;
+  size_t line, stride, page;
+  unsigned flags;
+  cqueue_pool *p;
+  void **slot;
+
+  if (!opts) {
+    cqueue_spsc_opts_init(&defaults);
+    opts = &defaults;
+  }
+
+  line = opts->line_size ? opts->line_size : LEVEL1_DCACHE_LINESIZE;
+  if (!n_buffers || !buf_size || !is_power2(line) ||
+      line < LEVEL1_DCACHE_LINESIZE || line > MAX_LINE_SIZE ||
+      buf_size > SIZE_MAX - line)
+    return NULL;
+
+  stride = (buf_size + line - 1) & ~(line - 1);
+  if (n_buffers > SIZE_MAX / stride)
+    return NULL;
+
+  p = cacheline_alloc(sizeof(cqueue_pool));
+  if (!p)
+    return NULL;
+
+  p->n_buffers = n_buffers;
+  p->buf_size = stride;
+  p->slab_size = n_buffers * stride;
+  p->slab = spsc_map(&p->slab_size, opts, &flags);
+  p->forward = cqueue_spsc_new(n_buffers, sizeof(cqueue_pool_msg));
+  p->recycle = cqueue_spsc_new(n_buffers, sizeof(void *));
+  if (!p->slab || !p->forward || !p->recycle) {
+    if (p->slab)
+      munmap(p->slab, p->slab_size);
+    cqueue_spsc_delete(&p->forward);
+    cqueue_spsc_delete(&p->recycle);
+    free(p);
+    return NULL;
+  }
+
+  // the slab is fresh zero pages, so writing a zero is enough to fault in
+  if (opts->prefault) {
+    page = flags & SPSC_HUGETLB ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t off=0; off < p->slab_size; off += page)
+      ((volatile unsigned char *)p->slab)[off] = 0;
+  }
+
+  // every buffer starts out free
+  for (size_t i=0; i < n_buffers; i++) {
+    slot = cqueue_spsc_trypush_slot(p->recycle);
+    assert(slot);
+    *slot = p->slab + i * stride;
+    cqueue_spsc_push_slot_finish(p->recycle);
+  }
+  return p;
+}
+
+void cqueue_pool_delete(cqueue_pool **p) {
+  cqueue_pool *pl = *p;
+  if(!pl)
+    return;
+
+  munmap(pl->slab, pl->slab_size);
+  cqueue_spsc_delete(&pl->forward);
+  cqueue_spsc_delete(&pl->recycle);
+  free(pl);
+  *p = NULL;
+}
+
+void* cqueue_pool_tryalloc(cqueue_pool *p) {
+  assert(p);
+
+  void **slot, *buf;
+
+  slot = cqueue_spsc_trypop_slot(p->recycle);
+  if (!slot)
+    return NULL;
+  buf = *slot;
+  cqueue_spsc_pop_slot_finish(p->recycle);
+  return buf;
+}
+
+void* cqueue_pool_alloc(cqueue_pool *p) {
+  assert(p);
+
+  void **slot, *buf;
+
+  slot = cqueue_spsc_pop_slot(p->recycle);
+  buf = *slot;
+  cqueue_spsc_pop_slot_finish(p->recycle);
+  return buf;
+}
+
+void cqueue_pool_send(cqueue_pool *p, void *buf, size_t len) {
+  assert(p);
+  assert(pool_owns(p, buf));
+
+  cqueue_pool_msg *m;
+
+  // room for every buffer, so never full
+  m = cqueue_spsc_trypush_slot(p->forward);
+  assert(m);
+  m->buf = buf;
+  m->len = len;
+  cqueue_spsc_push_slot_finish(p->forward);
+}
+
+void* cqueue_pool_tryrecv(cqueue_pool *p, size_t *len) {
+  assert(p);
+  assert(len);
+
+  cqueue_pool_msg *m;
+  void *buf;
+
+  m = cqueue_spsc_trypop_slot(p->forward);
+  if (!m)
+    return NULL;
+  buf = m->buf;
+  *len = m->len;
+  cqueue_spsc_pop_slot_finish(p->forward);
+  return buf;
+}
+
+void* cqueue_pool_recv(cqueue_pool *p, size_t *len) {
+  assert(p);
+  assert(len);
+
+  cqueue_pool_msg *m;
+  void *buf;
+
+  m = cqueue_spsc_pop_slot(p->forward);
+  buf = m->buf;
+  *len = m->len;
+  cqueue_spsc_pop_slot_finish(p->forward);
+  return buf;
+}
+
+void cqueue_pool_free(cqueue_pool *p, void *buf) {
+  assert(p);
+  assert(pool_owns(p, buf));
+
+  void **slot;
+
+  // room for every buffer, so never full
+  slot = cqueue_spsc_trypush_slot(p->recycle);
+  assert(slot);
+  *slot = buf;
+  cqueue_spsc_push_slot_finish(p->recycle);
+}
+
+size_t cqueue_pool_get_no_free(cqueue_pool *p) {
+  assert(p);
+
+  size_t n;
+
+  // the ring's capacity is n_buffers rounded up to a power of 2, and a
+  // count read while buffers move may be up to that
+  n = cqueue_spsc_get_no_used_slots(p->recycle);
+  return n < p->n_buffers ? n : p->n_buffers;
+}
+
+cqueue_deque* cqueue_deque_new(size_t capacity, size_t max_capacity) {
+  size_t realcap, realmax;
+  cqueue_deque_array *a;
+  cqueue_deque *q;
+
+  realcap = next_power2(capacity);
+  realmax = next_power2(max_capacity < capacity ? capacity : max_capacity);
+  if (!realcap || !realmax)
+    return NULL;
+
+  q = cacheline_alloc(sizeof(cqueue_deque));
+  if (!q)
+    return NULL;
+
+  a = deque_array_alloc(realcap);
+  if (!a) {
+    free(q);
+    return NULL;
+  }
+
+  q->max_capacity = realmax;
+  atomic_init(&q->top, 0);
+  atomic_init(&q->bottom, 0);
+  atomic_init(&q->array, a);
+  q->retired = NULL;
+  return q;
+}
+
+void cqueue_deque_delete(cqueue_deque **p) {
+  cqueue_deque_array *a, *prev;
+  cqueue_deque *q = *p;
+  if(!q)
+    return;
+
+  free(atomic_load_explicit(&q->array, memory_order_relaxed));
+  for (a = q->retired; a; a = prev) {
+    prev = a->prev;
+    free(a);
+  }
+
+  free(q);
+  *p = NULL;
+}
+
+int cqueue_deque_push(cqueue_deque *q, cqueue_task_fn fn, void *arg) {
+  assert(q);
+  assert(fn);
+
+  cqueue_deque_array *a;
+  cqueue_deque_slot *slot;
+  size_t b, t;
+
+  b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  t = atomic_load_explicit(&q->top, memory_order_acquire);
+  a = atomic_load_explicit(&q->array, memory_order_relaxed);
+
+  // thieves only ever shrink the deque, so b - t is an upper bound
+  if (b - t >= a->capacity) {
+    a = deque_grow(q, a, t, b);
+    if (!a)
+      return -1;
+  }
+
+  slot = &a->slots[b & (a->capacity - 1)];
+  atomic_store_explicit(&slot->fn, fn, memory_order_relaxed);
+  atomic_store_explicit(&slot->arg, arg, memory_order_relaxed);
+
+  // release: a thief that sees the new bottom sees the task
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_release);
+  return 0;
+}
+
+int cqueue_deque_pop(cqueue_deque *q, cqueue_task *task) {
+  assert(q);
+  assert(task);
+
+  cqueue_deque_array *a;
+  cqueue_deque_slot *slot;
+  size_t b, t;
+  int ret = 0;
+
+  // reserve the bottom task before looking at top; the fence pairs with
+  // the one in cqueue_deque_steal so that the owner and a thief cannot
+  // both miss each other's update
+  b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  a = atomic_load_explicit(&q->array, memory_order_relaxed);
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+  if ((ptrdiff_t)(b - t) < 0) {
+    // empty, undo the reservation
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return -1;
+  }
+
+  slot = &a->slots[b & (a->capacity - 1)];
+  task->fn = atomic_load_explicit(&slot->fn, memory_order_relaxed);
+  task->arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+  if (b != t)
+    return 0;
+
+  // the last task: thieves may be after it too, whoever moves top wins
+  if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    ret = -1;
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  return ret;
+}
+
+int cqueue_deque_steal(cqueue_deque *q, cqueue_task *task) {
+  assert(q);
+  assert(task);
+
+  cqueue_deque_array *a;
+  cqueue_deque_slot *slot;
+  cqueue_task_fn fn;
+  void *arg;
+  size_t b, t;
+
+  t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+  if ((ptrdiff_t)(b - t) <= 0)
+    return -1;
+
+  // an outgrown array still holds the task at t, so a stale pointer is fine
+  a = atomic_load_explicit(&q->array, memory_order_acquire);
+  slot = &a->slots[t & (a->capacity - 1)];
+  fn = atomic_load_explicit(&slot->fn, memory_order_relaxed);
+  arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+
+  if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return CQUEUE_DEQUE_RETRY;
+
+  task->fn = fn;
+  task->arg = arg;
+  return 0;
+}
+
+size_t cqueue_deque_get_no_used_slots(cqueue_deque *q) {
+  size_t b, t;
+
+  assert(q);
+
+  t = atomic_load_explicit(&q->top, memory_order_acquire);
+  b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+  // the owner's pop briefly moves bottom below top on an empty deque
+  if ((ptrdiff_t)(b - t) < 0)
+    return 0;
+  return b - t;
+}
+
+// private utility functions
+
+/*! Get an empty segment for the producer of q, from the cache if possible
+
+  \returns the segment, with all slots unused and no next segment, or NULL
+  if q is at its memory limit or allocation failed
+*/
+cqueue_spsc_segment* segment_get(cqueue_spsc_unbounded *q) {
+  cqueue_spsc_segment *seg, **cached;
+  size_t live;
+
+  cached = cqueue_spsc_trypop_slot(q->cache);
+  if (cached) {
+    seg = *cached;
+    cqueue_spsc_pop_slot_finish(q->cache);
+  } else {
+    live = q->n_allocated - atomic_load_explicit(&q->n_freed,
+                                                 memory_order_relaxed);
+    if (q->max_segments && live >= q->max_segments)
+      return NULL;
+
+    seg = cacheline_alloc(sizeof(cqueue_spsc_segment)
+                          + q->seg_capacity * q->elem_size);
+    if (!seg)
+      return NULL;
+    q->n_allocated++;
+
+    for (size_t i=0; i < q->seg_capacity; i++)
+      atomic_init(&((cqueue_spsc_slot *)(seg->array + i*q->elem_size))->used,
+                  0);
+  }
+
+  atomic_store_explicit(&seg->next, NULL, memory_order_relaxed);
+  return seg;
+}
+
+/*! Hand a drained segment of q back to the producer, or free it when the
+  cache is full
+*/
+void segment_put(cqueue_spsc_unbounded *q, cqueue_spsc_segment *seg) {
+  cqueue_spsc_segment **cached;
+
+  cached = cqueue_spsc_trypush_slot(q->cache);
+  if (cached) {
+    *cached = seg;
+    cqueue_spsc_push_slot_finish(q->cache);
+    return;
+  }
+
+  free(seg);
+  atomic_store_explicit(&q->n_freed,
+    atomic_load_explicit(&q->n_freed, memory_order_relaxed) + 1,
+    memory_order_relaxed);
+}
+
+/*! Allocate a cqueue_deque array of capacity empty slots
+
+  \returns the array, to be released with free(), or NULL on error
+*/
+cqueue_deque_array* deque_array_alloc(size_t capacity) {
+  cqueue_deque_array *a;
+
+  if (capacity > (SIZE_MAX - sizeof(cqueue_deque_array))
+                 / sizeof(cqueue_deque_slot))
+    return NULL;
+
+  a = cacheline_alloc(sizeof(cqueue_deque_array)
+                      + capacity * sizeof(cqueue_deque_slot));
+  if (!a)
+    return NULL;
+
+  a->capacity = capacity;
+  a->prev = NULL;
+  for (size_t i=0; i < capacity; i++) {
+    atomic_init(&a->slots[i].fn, NULL);
+    atomic_init(&a->slots[i].arg, NULL);
+  }
+  return a;
+}
+
+/*! Replace the owner's full array a with one twice its size
+
+  The tasks between top and bottom are copied over and a is retired rather
+  than freed, since thieves may still be reading it.
+  \returns the new array, or NULL when q is at max_capacity or allocation
+  failed
+*/
+cqueue_deque_array* deque_grow(cqueue_deque *q, cqueue_deque_array *a,
+                               size_t top, size_t bottom) {
+  cqueue_deque_array *na;
+  cqueue_deque_slot *from, *to;
+
+  if (a->capacity >= q->max_capacity)
+    return NULL;
+
+  na = deque_array_alloc(a->capacity * 2);
+  if (!na)
+    return NULL;
+
+  for (size_t i=top; i != bottom; i++) {
+    from = &a->slots[i & (a->capacity - 1)];
+    to = &na->slots[i & (na->capacity - 1)];
+    atomic_store_explicit(&to->fn, atomic_load_explicit(&from->fn,
+                          memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&to->arg, atomic_load_explicit(&from->arg,
+                          memory_order_relaxed), memory_order_relaxed);
+  }
+
+  a->prev = q->retired;
+  q->retired = a;
+
+  // release: a thief that loads the new array sees the copied tasks
+  atomic_store_explicit(&q->array, na, memory_order_release);
+  return na;
+}
+
+#ifndef NDEBUG
+/*! Check that buf is the start of a buffer of p, for assertions
+*/
+int pool_owns(cqueue_pool *p, const void *buf) {
+  const unsigned char *b = buf;
+
+  return b >= p->slab && b < p->slab + p->n_buffers * p->buf_size &&
+         (size_t)(b - p->slab) % p->buf_size == 0;
+}
+#endif
+
+/*! Store len bytes from src in the sequence locked words data
+
+  Single writer only. seq is odd while the words are being stored.
+*/
+void seqlock_write(_Atomic size_t *seq, _Atomic uint64_t *data,
+                   const void *src, size_t len) {
+  const unsigned char *s = src;
+  size_t n, seq0;
+  uint64_t w;
+
+  seq0 = atomic_load_explicit(seq, memory_order_relaxed);
+  atomic_store_explicit(seq, seq0 + 1, memory_order_relaxed);
+  // keep the data stores after the odd seq
+  atomic_thread_fence(memory_order_release);
+
+  for (size_t i=0; len; i++, len -= n, s += n) {
+    n = len < sizeof(w) ? len : sizeof(w);
+    w = 0;
+    memcpy(&w, s, n);
+    atomic_store_explicit(&data[i], w, memory_order_relaxed);
+  }
+
+  atomic_store_explicit(seq, seq0 + 2, memory_order_release);
+}
+
+/*! Copy len bytes out of the sequence locked words data to dst
+
+  Retries until a copy was not overlapped by a write.
+  \returns the even seq the copy is consistent with
+*/
+size_t seqlock_read(_Atomic size_t *seq, _Atomic uint64_t *data,
+                    void *dst, size_t len) {
+  unsigned char *d;
+  size_t n, left, seq0;
+  uint64_t w;
+
+  while (1) {
+    seq0 = atomic_load_explicit(seq, memory_order_acquire);
+    if (seq0 & 1) {
+      cpu_relax();
+      continue;
+    }
+
+    d = dst;
+    left = len;
+    for (size_t i=0; left; i++, left -= n, d += n) {
+      n = left < sizeof(w) ? left : sizeof(w);
+      w = atomic_load_explicit(&data[i], memory_order_relaxed);
+      memcpy(d, &w, n);
+    }
+
+    // keep the data loads before the second look at seq
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(seq, memory_order_relaxed) == seq0)
+      return seq0;
+    cpu_relax();
+  }
+}
+
+/*! Compute the space taken by a byte ring record of len bytes
+
+  \param[in] len the record length, at most the ring's max_len
+  \returns the header plus len rounded up to CQUEUE_BYTERING_ALIGN
+*/
+size_t bytering_record_size(size_t len) {
+  return BYTERING_HDR + ((len + CQUEUE_BYTERING_ALIGN - 1)
+                         & ~(CQUEUE_BYTERING_ALIGN - 1));
+}
+
+/*! Stamp the sampled slots among the n pushed from push_idx
+
+  Called by the producer before publishing them.
+*/
+void spsc_stamp(cqueue_spsc *q, size_t push_idx, size_t n) {
+  cqueue_spsc_latency *lat = q->lat;
+  size_t idx = (push_idx + lat->mask) & ~lat->mask;
+  uint64_t now;
+
+  if (idx - push_idx >= n)
+    return;
+
+  now = clock_now(lat->clock);
+  for (; idx - push_idx < n; idx += lat->mask + 1)
+    lat->stamps[(idx & (q->capacity - 1)) >> lat->shift] = now;
+}
+
+/*! Record the time the sampled slots among the n popped from pop_idx
+ waited
+
+  Called by the consumer before releasing them.
+*/
+void spsc_measure(cqueue_spsc *q, size_t pop_idx, size_t n) {
+  cqueue_spsc_latency *lat = q->lat;
+  size_t idx = (pop_idx + lat->mask) & ~lat->mask;
+  uint64_t now, stamp, d;
+  _Atomic uint64_t *b;
+
+  if (idx - pop_idx >= n)
+    return;
+
+  now = clock_now(lat->clock);
+  for (; idx - pop_idx < n; idx += lat->mask + 1) {
+    stamp = lat->stamps[(idx & (q->capacity - 1)) >> lat->shift];
+    // the TSCs of different cores may be slightly apart
+    d = now > stamp ? now - stamp : 0;
+
+    // the consumer is the only writer
+    b = &lat->buckets[hist_bucket(d)];
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&lat->count, atomic_load_explicit(&lat->count,
+                          memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&lat->sum, atomic_load_explicit(&lat->sum,
+                          memory_order_relaxed) + d, memory_order_relaxed);
+    if (d > atomic_load_explicit(&lat->max, memory_order_relaxed))
+      atomic_store_explicit(&lat->max, d, memory_order_relaxed);
+  }
+}
+
+//! the current time of clock
+uint64_t clock_now(cqueue_clock clock) {
+  struct timespec ts;
+
+#ifdef X86_TSC
+  if (clock == CQUEUE_CLOCK_TSC)
+    return __rdtsc();
+#else
+  (void)clock;
+#endif
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*! The cqueue_hist bucket of v
+
+  The group of v is its highest set bit, the sub bucket the
+  CQUEUE_HIST_SUB_BITS bits below it.
+*/
+size_t hist_bucket(uint64_t v) {
+  const uint64_t sub = (uint64_t)1 << CQUEUE_HIST_SUB_BITS;
+  unsigned top;
+
+  if (v < sub)
+    return v;
+  top = 63 - clz64(v);
+  return (size_t)(top - CQUEUE_HIST_SUB_BITS + 1) * sub
+         + ((v >> (top - CQUEUE_HIST_SUB_BITS)) & (sub - 1));
+}
+
+/*! Mark q ready in its set if the consumer armed it
+
+  Called by the producer after publishing. Like spsc_wake(), the fence
+  orders the release of the slot before the load of set_armed, so either
+  the producer sees the queue armed or the consumer's recheck in set_idle()
+  sees the slot. The exchange acquires the consumer's release of set_armed,
+  which orders the consumer's clear of the ready bit before the fetch_or
+  here; without it a weakly ordered cpu could let the clear land last and
+  leave a non-empty queue unarmed with its bit clear.
+*/
+void spsc_set_ready(cqueue_spsc *q) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&q->set_armed, memory_order_relaxed) &&
+      atomic_exchange_explicit(&q->set_armed, 0, memory_order_acq_rel))
+    atomic_fetch_or_explicit(&q->set->ready[q->set_idx / 64],
+                             UINT64_C(1) << (q->set_idx % 64),
+                             memory_order_release);
+}
+
+/*! Find the first ready queue of s at or after index from, wrapping around
+
+  \returns the queue's index, or SIZE_MAX when none is ready
+*/
+size_t set_next_ready(cqueue_spsc_set *s, size_t from) {
+  size_t w = from / 64;
+  uint64_t bits;
+
+  // the high bits of the first word, the other words, then the first word
+  // again for its low bits
+  bits = atomic_load_explicit(&s->ready[w], memory_order_acquire)
+         & (~UINT64_C(0) << (from % 64));
+  for (size_t i=0; i <= s->n_words; i++) {
+    if (bits)
+      return w * 64 + ctz64(bits);
+    w = w + 1 < s->n_words ? w + 1 : 0;
+    bits = atomic_load_explicit(&s->ready[w], memory_order_acquire);
+  }
+  return SIZE_MAX;
+}
+
+/*! Clear the ready bit of the empty queue i of s and arm it
+
+  Rechecks the queue after arming, as a push may have been published
+  before the producer could see the queue armed.
+  \returns a slot to pop if the recheck found one, with the bit set again,
+  or NULL
+*/
+void* set_idle(cqueue_spsc_set *s, size_t i) {
+  cqueue_spsc *q = s->members[i].q;
+  uint64_t bit = UINT64_C(1) << (i % 64);
+  void *slot;
+
+  atomic_fetch_and_explicit(&s->ready[i / 64], ~bit, memory_order_relaxed);
+  // release: whoever disarms the queue sets the bit after this clear
+  atomic_store_explicit(&q->set_armed, 1, memory_order_release);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  slot = cqueue_spsc_trypop_slot(q);
+  // if the producer disarmed the queue first, it sets the bit itself
+  if (slot && atomic_exchange_explicit(&q->set_armed, 0, memory_order_acq_rel))
+    atomic_fetch_or_explicit(&s->ready[i / 64], bit, memory_order_relaxed);
+  return slot;
+}
+
+//! number of trailing zero bits of x, which must not be 0
+unsigned ctz64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_ctzll(x);
+#else
+  unsigned n = 0;
+  for (; !(x & 1); x >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+//! number of leading zero bits of x, which must not be 0
+unsigned clz64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_clzll(x);
+#else
+  unsigned n = 0;
+  for (; !(x & (UINT64_C(1) << 63)); x <<= 1)
+    n++;
+  return n;
+#endif
+}
+
+//! number of set bits of x
+unsigned popcount64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_popcountll(x);
+#else
+  unsigned n = 0;
+  for (; x; x &= x - 1)
+    n++;
+  return n;
+#endif
+}
+
+/*! Copy an element into the slot data dst of q with the queue's kernel
+
+  Non-temporal stores are weakly ordered, so they are fenced here, before
+  the caller's release store publishes the slot.
+*/
+void spsc_copy_in(cqueue_spsc *q, void *dst, const void *src, size_t len) {
+  switch (q->copy) {
+  case CQUEUE_COPY_MEMCPY:
+    memcpy(dst, src, len);
+    return;
+#ifdef X86_COPY
+  case CQUEUE_COPY_SSE2:
+    copy_sse2(dst, src, len);
+    return;
+  case CQUEUE_COPY_AVX2:
+    copy_avx2(dst, src, len);
+    return;
+  case CQUEUE_COPY_NT:
+    break;
+#endif
+  default:
+    if (len <= SMALL_COPY) {
+      copy_small(dst, src, len);
+      return;
+    }
+#ifdef X86_COPY
+    if (!q->nt_threshold || len < q->nt_threshold) {
+      if (q->avx2)
+        copy_avx2(dst, src, len);
+      else
+        copy_sse2(dst, src, len);
+      return;
+    }
+    break;
+#else
+    memcpy(dst, src, len);
+    return;
+#endif
+  }
+
+#ifdef X86_COPY
+  if (q->avx2)
+    copy_nt_avx2(dst, src, len);
+  else
+    copy_nt_sse2(dst, src, len);
+  _mm_sfence();
+#endif
+}
+
+/*! Copy an element out of the slot data src of q with the queue's kernel
+
+  Prefetches the next slot first when the queue has prefetch set, so that
+  its lines arrive while this one is copied.
+*/
+void spsc_copy_out(cqueue_spsc *q, void *dst, const void *src, size_t len) {
+  if (q->prefetch) {
+    size_t next = (atomic_load_explicit(&q->pop_idx, memory_order_relaxed)
+                   + 1) & (q->capacity - 1);
+    unsigned char *slot = spsc_array(q) + next * q->elem_size;
+    size_t lines = (sizeof(cqueue_spsc_slot) + len + LEVEL1_DCACHE_LINESIZE
+                    - 1) / LEVEL1_DCACHE_LINESIZE;
+
+    if (lines > PREFETCH_LINES)
+      lines = PREFETCH_LINES;
+    for (size_t i=0; i < lines; i++)
+      __builtin_prefetch(slot + i * LEVEL1_DCACHE_LINESIZE, 0, 3);
+  }
+
+  switch (q->copy) {
+  case CQUEUE_COPY_MEMCPY:
+    memcpy(dst, src, len);
+    return;
+#ifdef X86_COPY
+  case CQUEUE_COPY_SSE2:
+    copy_sse2(dst, src, len);
+    return;
+  case CQUEUE_COPY_AVX2:
+    copy_avx2(dst, src, len);
+    return;
+#endif
+  default:
+    if (len <= SMALL_COPY) {
+      copy_small(dst, src, len);
+      return;
+    }
+#ifdef X86_COPY
+    if (q->avx2)
+      copy_avx2(dst, src, len);
+    else
+      copy_sse2(dst, src, len);
+#else
+    memcpy(dst, src, len);
+#endif
+  }
+}
+
+/*! Copy a few bytes with word sized moves the compiler inlines
+
+  Saves the call into the C library for elements of a few words.
+*/
+void copy_small(void *dst, const void *src, size_t len) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+
+  for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+    memcpy(d, s, sizeof(uint64_t));
+    d += sizeof(uint64_t);
+    s += sizeof(uint64_t);
+  }
+  while (len--)
+    *d++ = *s++;
+}
+
+//! \returns nonzero when the cpu supports AVX2
+int cpu_has_avx2(void) {
+#ifdef X86_COPY
+  return __builtin_cpu_supports("avx2");
+#else
+  return 0;
+#endif
+}
+
+#ifdef X86_COPY
+//! copy with unaligned 16 byte loads and stores, 64 bytes per iteration
+void copy_sse2(void *dst, const void *src, size_t len) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  __m128i a, b, c, e;
+
+  for (; len >= 64; len -= 64, d += 64, s += 64) {
+    a = _mm_loadu_si128((const __m128i *)s);
+    b = _mm_loadu_si128((const __m128i *)(s + 16));
+    c = _mm_loadu_si128((const __m128i *)(s + 32));
+    e = _mm_loadu_si128((const __m128i *)(s + 48));
+    _mm_storeu_si128((__m128i *)d, a);
+    _mm_storeu_si128((__m128i *)(d + 16), b);
+    _mm_storeu_si128((__m128i *)(d + 32), c);
+    _mm_storeu_si128((__m128i *)(d + 48), e);
+  }
+  for (; len >= 16; len -= 16, d += 16, s += 16)
+    _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+  copy_small(d, s, len);
+}
+
+//! copy with unaligned 32 byte loads and stores, 64 bytes per iteration
+__attribute__((target("avx2")))
+void copy_avx2(void *dst, const void *src, size_t len) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  __m256i a, b;
+
+  for (; len >= 64; len -= 64, d += 64, s += 64) {
+    a = _mm256_loadu_si256((const __m256i *)s);
+    b = _mm256_loadu_si256((const __m256i *)(s + 32));
+    _mm256_storeu_si256((__m256i *)d, a);
+    _mm256_storeu_si256((__m256i *)(d + 32), b);
+  }
+  for (; len >= 32; len -= 32, d += 32, s += 32)
+    _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+  copy_small(d, s, len);
+}
+
+/*! copy with 16 byte non-temporal stores
+
+  Streaming stores need an aligned destination: the bytes up to the first
+  16 byte boundary and the tail are copied normally. The caller fences.
+*/
+void copy_nt_sse2(void *dst, const void *src, size_t len) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  size_t head = -(uintptr_t)d & 15;
+  __m128i a, b, c, e;
+
+  if (head > len)
+    head = len;
+  copy_small(d, s, head);
+  d += head;
+  s += head;
+  len -= head;
+
+  for (; len >= 64; len -= 64, d += 64, s += 64) {
+    a = _mm_loadu_si128((const __m128i *)s);
+    b = _mm_loadu_si128((const __m128i *)(s + 16));
+    c = _mm_loadu_si128((const __m128i *)(s + 32));
+    e = _mm_loadu_si128((const __m128i *)(s + 48));
+    _mm_stream_si128((__m128i *)d, a);
+    _mm_stream_si128((__m128i *)(d + 16), b);
+    _mm_stream_si128((__m128i *)(d + 32), c);
+    _mm_stream_si128((__m128i *)(d + 48), e);
+  }
+  for (; len >= 16; len -= 16, d += 16, s += 16)
+    _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+  copy_small(d, s, len);
+}
+
+//! copy with 32 byte non-temporal stores, see copy_nt_sse2()
+__attribute__((target("avx2")))
+void copy_nt_avx2(void *dst, const void *src, size_t len) {
+  unsigned char *d = dst;
+  const unsigned char *s = src;
+  size_t head = -(uintptr_t)d & 31;
+  __m256i a, b;
+
+  if (head > len)
+    head = len;
+  copy_small(d, s, head);
+  d += head;
+  s += head;
+  len -= head;
+
+  for (; len >= 64; len -= 64, d += 64, s += 64) {
+    a = _mm256_loadu_si256((const __m256i *)s);
+    b = _mm256_loadu_si256((const __m256i *)(s + 32));
+    _mm256_stream_si256((__m256i *)d, a);
+    _mm256_stream_si256((__m256i *)(d + 32), b);
+  }
+  for (; len >= 32; len -= 32, d += 32, s += 32)
+    _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+  copy_small(d, s, len);
+}
+#endif
+
+/*! Round up to the next power of 2
+
+  \param[in] i the int to round, 0 <= i <= SIZE_MAX/2 +1
+  \returns the next highest power of 2
+  \returns i if is already a power of 2
+  \returns 0 when i > SIZE_MAX/2 +1
+*/
+size_t next_power2(size_t i) {
+  if (i == 0)
+    return 1;
+
+  i--;
+  for (uint64_t j = 1; j < CHAR_BIT*sizeof(size_t)-1; j*=2)
+    i |= i >> j;
+  i++;
 
   return i;
 }
 
+/*! Get the slot index of the next push, only to be called by the pusher
+*/
+size_t spsc_push_idx(cqueue_spsc *q) {
+  return atomic_load_explicit(&q->push_idx, memory_order_relaxed)
+         & (q->capacity - 1);
+}
+
+/*! Get the slot index of the next pop, only to be called by the popper
+*/
+size_t spsc_pop_idx(cqueue_spsc *q) {
+  return atomic_load_explicit(&q->pop_idx, memory_order_relaxed)
+         & (q->capacity - 1);
+}
+
+/*! Wait for a slot's used flag to become want, according to q's wait
+  strategy
+
+  Parking follows the usual announce-then-recheck protocol: the waiter sets
+  *parked and rechecks the flag before sleeping, and spsc_wake() has the
+  other side publish the flag, fence, then check *parked. At least one of
+  the two sees the other's write, so a wake up cannot be lost.
+  \param[in] used the slot's used flag
+  \param[in] want the value to wait for
+  \param[in,out] parked this side's parked word
+  \param[in] deadline the CLOCK_MONOTONIC time to give up at, or NULL to
+  wait forever
+  \returns 1 once *used == want, 0 if deadline passed first
+*/
+int spsc_wait(cqueue_spsc *q, _Atomic size_t *used, size_t want,
+              _Atomic uint32_t *parked, const struct timespec *deadline) {
+  unsigned n;
+
+  for (n = 0; ; n++) {
+    if (atomic_load_explicit(used, memory_order_acquire) == want)
+      return 1;
+
+    // the wait is on behalf of the side whose parked word we were given
+    if (parked == &q->push_parked)
+      STATS_ADD(q, push_spins, 1);
+    else
+      STATS_ADD(q, pop_spins, 1);
+
+    if (q->wait == CQUEUE_WAIT_SPIN || q->wait == CQUEUE_WAIT_PAUSE
+        || n < q->spin) {
+      if (q->wait != CQUEUE_WAIT_SPIN)
+        cpu_relax();
+      // only look at the clock every so often while spinning
+      if (deadline && n % 1024 == 1023 && deadline_passed(deadline))
+        return 0;
+      continue;
+    }
+
+    // stay in the fallback phase instead of wrapping n around
+    n = q->spin;
+    if (deadline && deadline_passed(deadline))
+      return 0;
+
+    if (q->wait == CQUEUE_WAIT_YIELD) {
+      sched_yield();
+      continue;
+    }
+
+    atomic_store_explicit(parked, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(used, memory_order_seq_cst) != want)
+      park(parked, 1, deadline, q->flags & SPSC_SHARED);
+    atomic_store_explicit(parked, 0, memory_order_relaxed);
+  }
+}
+
+/*! Wake the other side of q if it is parked or waiting on its eventfd
+
+  Only costs a fence and a load of a mostly read-only cacheline when the
+  other side is not waiting, and nothing unless q uses CQUEUE_WAIT_PARK or
+  has its eventfds enabled.
+  \param[in,out] parked the other side's parked word
+  \param[in,out] armed the other side's armed word
+  \param[in] fd the other side's eventfd, or -1
+*/
+void spsc_wake(cqueue_spsc *q, _Atomic uint32_t *parked,
+               _Atomic uint32_t *armed, int fd) {
+  if (q->wait != CQUEUE_WAIT_PARK && fd < 0)
+    return;
+
+  // order the caller's release of the slot before the loads of parked and
+  // armed
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(parked, memory_order_relaxed)) {
+    // change the word so a waiter about to sleep on it returns at once
+    atomic_store_explicit(parked, 0, memory_order_relaxed);
+    unpark(parked, q->flags & SPSC_SHARED);
+  }
+
+#ifdef __linux__
+  if (fd >= 0 && atomic_load_explicit(armed, memory_order_relaxed) &&
+      atomic_exchange_explicit(armed, 0, memory_order_relaxed)) {
+    uint64_t one = 1;
+    ssize_t r = write(fd, &one, sizeof(one));
+    (void)r;  // only fails when the counter would overflow, ie is readable
+  }
+#else
+  (void)armed;
+#endif
+}
+
+/*! Arm an eventfd, then recheck whether waiting on it is still needed
+
+  Same protocol as parking in spsc_wait(), with *armed as the announcement.
+  \param[in] used the used flag of the slot the caller waits for
+  \param[in] want the value of *used the caller waits for
+  \param[in,out] armed the caller's armed word
+  \param[in] fd the caller's eventfd
+  \returns 0 if the caller should wait for fd, 1 if *used == want already
+*/
+int spsc_arm_fd(_Atomic size_t *used, size_t want,
+                _Atomic uint32_t *armed, int fd) {
+#ifdef __linux__
+  uint64_t count;
+  ssize_t r;
+
+  // consume a stale signal, the eventfd is nonblocking
+  r = read(fd, &count, sizeof(count));
+  (void)r;
+#else
+  (void)fd;
+#endif
+
+  atomic_store_explicit(armed, 1, memory_order_seq_cst);
+  if (atomic_load_explicit(used, memory_order_seq_cst) != want)
+    return 0;
+
+  atomic_store_explicit(armed, 0, memory_order_relaxed);
+  return 1;
+}
+
+/*! Get the slot array of q, which follows q in memory
+*/
+unsigned char* spsc_array(cqueue_spsc *q) {
+  return (unsigned char *)q + q->array_offset;
+}
+
+/*! Compute the layout of a cqueue_spsc and its array
+
+  \param[in] line the granularity to pad slots to, a power of 2 multiple of
+  LEVEL1_DCACHE_LINESIZE
+  \param[out] realcap the capacity rounded up to a power of 2
+  \param[out] slot the size of each slot
+  \param[out] offset the offset of the array, past the struct and aligned to
+  line so that the slots are
+  \param[out] size the size of the struct followed by the array
+  \returns 1 on success, 0 if the parameters are invalid or overflow
+*/
+int spsc_layout(size_t capacity, size_t elem_size, size_t line,
+                size_t *realcap, size_t *slot, size_t *offset, size_t *size) {
+  if (!elem_size)
+    return 0;
+
+  *realcap = next_power2(capacity);
+  if (!*realcap)
+    return 0;
+
+  // round the elem size up to the nearest cacheline and account for
+  // slot overhead
+  *slot = slot_size(elem_size, sizeof(_Atomic size_t));
+  if (!*slot || *slot > SIZE_MAX - line)
+    return 0;
+  *slot = (*slot + line - 1) & ~(line - 1);
+
+  *offset = (sizeof(cqueue_spsc) + line - 1) & ~(line - 1);
+
+  // check for capacity * slot overflow
+  if (*realcap > SIZE_MAX / *slot || *realcap * *slot > SIZE_MAX - *offset)
+    return 0;
+
+  *size = *offset + *realcap * *slot;
+  return 1;
+}
+
+/*! Compute the size of the mapping of a queue made by cqueue_spsc_new_opts()
+*/
+size_t spsc_map_size(cqueue_spsc *q) {
+  size_t size = q->array_offset + q->capacity * q->elem_size;
+
+  if (q->flags & SPSC_HUGETLB)
+    size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+  return size;
+}
+
+/*! Map size bytes of private anonymous memory according to opts
+
+  Tries explicit huge pages first if asked for, falling back to regular
+  pages with a transparent huge page hint, then binds the mapping to
+  opts->numa_node. Nothing is touched, so the pages are zero filled and
+  placed on first touch.
+  \param[in,out] size the size needed, rounded up to the huge page size if
+  explicit huge pages are used
+  \param[out] flags SPSC_* flags describing the mapping
+  \returns the mapping, or NULL on error
+*/
+void* spsc_map(size_t *size, const cqueue_spsc_opts *opts, unsigned *flags) {
+  void *p = MAP_FAILED;
+
+  *flags = SPSC_MAPPED;
+
+#ifdef MAP_HUGETLB
+  size_t huge;
+
+  if (opts->huge_pages && *size <= SIZE_MAX - HUGE_PAGE_SIZE) {
+    huge = (*size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    p = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      *size = huge;
+      *flags |= SPSC_HUGETLB;
+    }
+  }
+#endif
+
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+    if (p == MAP_FAILED)
+      return NULL;
+#ifdef MADV_HUGEPAGE
+    // only a hint, THP may be disabled
+    if (opts->huge_pages)
+      madvise(p, *size, MADV_HUGEPAGE);
+#endif
+  }
+
+  if (opts->numa_node != CQUEUE_NUMA_ANY && spsc_bind(p, *size,
+                                                      opts->numa_node)) {
+    munmap(p, *size);
+    return NULL;
+  }
+
+  return p;
+}
+
+/*! Bind size bytes at p to NUMA node
+
+  Must be called before the memory is touched to take effect.
+  \returns 0 on success, -1 on error or if the system does not support it
+*/
+int spsc_bind(void *p, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long mask[SPSC_MAX_NUMA_NODES / NODE_MASK_BITS] = { 0 };
+  const size_t bits = NODE_MASK_BITS;
+
+  if (node < 0 || node >= SPSC_MAX_NUMA_NODES)
+    return -1;
+
+  mask[node / bits] |= 1UL << (node % bits);
+  return syscall(SYS_mbind, p, size, MPOL_BIND, mask, SPSC_MAX_NUMA_NODES,
+                 0) ? -1 : 0;
+#else
+  (void)p;
+  (void)size;
+  (void)node;
+  return -1;
+#endif
+}
+
+/*! Initialize a cqueue_spsc laid out by spsc_layout()
+
+  \param[in] flags SPSC_* flags describing the allocation
+*/
+void spsc_init(cqueue_spsc *q, size_t capacity, size_t slot, size_t offset,
+               unsigned flags) {
+  cqueue_spsc_slot *s;
+
+  q->capacity = capacity;
+  q->elem_size = slot;
+  q->array_offset = offset;
+  q->flags = flags;
+
+  // private mappings are zero filled already, and writing the slots would
+  // place every page on this thread's NUMA node
+  for (size_t i=0; !(flags & SPSC_MAPPED) && i < q->capacity; i++) {
+    s = (cqueue_spsc_slot *)(spsc_array(q) + i*q->elem_size);
+    atomic_init(&s->used, 0);
+  }
+
+  q->wait = CQUEUE_WAIT_SPIN;
+  q->spin = 0;
+  atomic_init(&q->push_idx, 0);
+  atomic_init(&q->pop_idx, 0);
+  atomic_init(&q->push_parked, 0);
+  atomic_init(&q->pop_parked, 0);
+  q->push_fd = -1;
+  q->pop_fd = -1;
+  atomic_init(&q->push_armed, 0);
+  atomic_init(&q->pop_armed, 0);
+  q->set = NULL;
+  q->set_idx = 0;
+  q->copy = CQUEUE_COPY_AUTO;
+  q->nt_threshold = CQUEUE_NT_THRESHOLD;
+  q->prefetch = 0;
+  // resolved once so that the copy paths don't query the cpu per element
+  q->avx2 = cpu_has_avx2();
+  atomic_init(&q->set_armed, 0);
+  q->lat = NULL;
+#ifdef CQUEUE_STATS
+  atomic_init(&q->push_full, 0);
+  atomic_init(&q->push_spins, 0);
+  atomic_init(&q->high_water, 0);
+  atomic_init(&q->pop_empty, 0);
+  atomic_init(&q->pop_spins, 0);
+#endif
+}
+
+/*! Record the occupancy after a push in q's high_water counter
+
+  Compiles to nothing without CQUEUE_STATS.
+  \param[in] push_idx the push index after the push
+*/
+void spsc_high_water(cqueue_spsc *q, size_t push_idx) {
+#ifdef CQUEUE_STATS
+  // pop_idx is stored after the slot is released, so it may lag by the
+  // elements popped since; never report more than the capacity
+  size_t used = push_idx - atomic_load_explicit(&q->pop_idx,
+                                                memory_order_relaxed);
+
+  if (used > q->capacity)
+    used = q->capacity;
+
+  if (used > atomic_load_explicit(&q->high_water, memory_order_relaxed))
+    atomic_store_explicit(&q->high_water, used, memory_order_relaxed);
+#else
+  (void)q;
+  (void)push_idx;
+#endif
+}
+
+/*! Sleep while *word == val, until woken by unpark() or deadline passes
+
+  Spurious wake ups are possible, callers must recheck their condition.
+  \param[in] deadline the CLOCK_MONOTONIC time to give up at, or NULL
+  \param[in] shared non-zero if word may be mapped in other processes
+*/
+void park(_Atomic uint32_t *word, uint32_t val,
+          const struct timespec *deadline, int shared) {
+#ifdef __linux__
+  struct timespec now, rel, *timeout = NULL;
+
+  if (deadline) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rel.tv_sec = deadline->tv_sec - now.tv_sec;
+    rel.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (rel.tv_nsec < 0) {
+      rel.tv_sec--;
+      rel.tv_nsec += 1000000000L;
+    }
+    if (rel.tv_sec < 0)
+      return;
+    timeout = &rel;
+  }
+
+  // FUTEX_WAIT's relative timeout is measured against CLOCK_MONOTONIC
+  syscall(SYS_futex, (uint32_t *)word,
+          shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+#else
+  (void)word;
+  (void)val;
+  (void)deadline;
+  (void)shared;
+  sched_yield();
+#endif
+}
+
+/*! Wake a thread sleeping in park() on word
+*/
+void unpark(_Atomic uint32_t *word, int shared) {
+#ifdef __linux__
+  syscall(SYS_futex, (uint32_t *)word,
+          shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+  (void)word;
+  (void)shared;
+#endif
+}
+
+/*! Compute the CLOCK_MONOTONIC time timeout_ns nanoseconds from now
+*/
+void deadline_after(struct timespec *deadline, uint64_t timeout_ns) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout_ns / 1000000000u;
+  deadline->tv_nsec += timeout_ns % 1000000000u;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+/*! Check if the CLOCK_MONOTONIC time deadline has passed
+  \returns 1 if it has, 0 otherwise
+*/
+int deadline_passed(const struct timespec *deadline) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec > deadline->tv_sec ||
+         (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/*! Hint to the cpu that we are busy waiting
+*/
+void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// declared in cqueue_internal.h for the other modules
+void* cacheline_alloc(size_t size) {
+  void *p = NULL;
+  size_t n_cachelines;
+
+  // check posix_memalign conditions
+  assert(is_power2(LEVEL1_DCACHE_LINESIZE));
+  assert(LEVEL1_DCACHE_LINESIZE % sizeof(void *) == 0);
+
+  n_cachelines = size / LEVEL1_DCACHE_LINESIZE;
+  if (n_cachelines * LEVEL1_DCACHE_LINESIZE < size)
+    n_cachelines++;
+
+  if (!n_cachelines || n_cachelines > SIZE_MAX/LEVEL1_DCACHE_LINESIZE)
+    return NULL;
+
+#ifdef SANITIZE
+  if (posix_memalign(&p, LEVEL1_DCACHE_LINESIZE,
+                     LEVEL1_DCACHE_LINESIZE * n_cachelines))
+    return NULL;
+#else
+  p = aligned_alloc(LEVEL1_DCACHE_LINESIZE,
+                    LEVEL1_DCACHE_LINESIZE * n_cachelines);
+#endif
+
+  return p;
+}
+
+/*! Compute the size of a slot holding elem_size bytes of data
+
+  \param[in] elem_size the maximum size of any element
+  \param[in] overhead the size of the slot header preceding the data
+  \returns elem_size + overhead rounded up to the nearest cacheline, or 0 on
+  overflow
+*/
+size_t slot_size(size_t elem_size, size_t overhead) {
+  size_t n_cachelines;
+
+  if (elem_size > SIZE_MAX - overhead)
+    return 0;
+
+  n_cachelines = (elem_size + overhead) / LEVEL1_DCACHE_LINESIZE;
+  if (n_cachelines * LEVEL1_DCACHE_LINESIZE < elem_size + overhead)
+    n_cachelines++;
+
+  // check for n_cachelines overflow
+  if (n_cachelines > SIZE_MAX/LEVEL1_DCACHE_LINESIZE)
+    return 0;
+
+  return n_cachelines * LEVEL1_DCACHE_LINESIZE;
+}
+
+/*! Allocate a cacheline-aligned array of capacity slots
+
+  \param[in] capacity the number of slots
+  \param[in] slot_size the size of each slot
+  \returns the allocated array, to be released with free(), or NULL on error
+*/
+unsigned char* array_alloc(size_t capacity, size_t slot_size) {
+  // check for capacity * slot_size overflow
+  if ((capacity > (size_t)(SIZE_MAX/slot_size)) ||
+      (slot_size > (size_t)(SIZE_MAX/capacity)))
+    return NULL;
+
+  return cacheline_alloc(capacity * slot_size);
+}
+
+/*! Allocate an array of sequence numbered slots
+
+  Every slot's seq is initialized to its index, ie free for the first lap
+  of pushers.
+  \param[in] capacity the number of slots, a power of 2
+  \param[in] slot_size the size of each slot, a multiple of the cacheline size
+  \returns the allocated array, to be released with free(), or NULL on error
+*/
+unsigned char* seq_array_alloc(size_t capacity, size_t slot_size) {
+  unsigned char *array;
+  cqueue_mpmc_slot *slot;
+
+  array = array_alloc(capacity, slot_size);
+  if (!array)
+    return NULL;
+
+  for (size_t i=0; i < capacity; i++) {
+    slot = (cqueue_mpmc_slot *)(array + i*slot_size);
+    atomic_init(&slot->seq, i);
+  }
+
+  return array;
+}
+
+/*! Claim the next slot of a sequence numbered array for pushing, blocking
+  (spinning) until it has been popped
+
+  Shared by every queue type that allows multiple pushers.
+  \param[in,out] push_idx the position shared by all pushers
+  \returns a pointer to the claimed slot's data
+*/
+void* seq_push_slot(_Atomic size_t *push_idx, unsigned char *array,
+                    size_t capacity, size_t elem_size) {
+  cqueue_mpmc_slot *slot;
+  size_t pos;
+
+  // claim a position unconditionally, then wait for its slot to be freed
+  pos = atomic_fetch_add_explicit(push_idx, 1, memory_order_relaxed);
+  slot = (cqueue_mpmc_slot *)(array + (pos & (capacity - 1)) * elem_size);
+
+  while(atomic_load_explicit(&slot->seq, memory_order_acquire) != pos);
+
+  return slot->data;
+}
+
+/*! Claim the next slot of a sequence numbered array for pushing
+
+  \param[in,out] push_idx the position shared by all pushers
+  \returns a pointer to the claimed slot's data, or NULL when the array is full
+*/
+void* seq_trypush_slot(_Atomic size_t *push_idx, unsigned char *array,
+                       size_t capacity, size_t elem_size) {
+  cqueue_mpmc_slot *slot;
+  size_t pos, seq;
+
+  pos = atomic_load_explicit(push_idx, memory_order_relaxed);
+  while(1) {
+    slot = (cqueue_mpmc_slot *)(array + (pos & (capacity - 1)) * elem_size);
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if (seq == pos) {
+      // the slot is free, try to claim it
+      if (atomic_compare_exchange_weak_explicit(push_idx, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        return slot->data;
+    } else if ((ptrdiff_t)(seq - pos) < 0) {
+      // the slot still holds data from the previous lap, ie the queue is full
+      return NULL;
+    } else {
+      // another pusher claimed pos
+      pos = atomic_load_explicit(push_idx, memory_order_relaxed);
+    }
+  }
+}
+
+/*! Publish a slot claimed by seq_push_slot() or seq_trypush_slot()
+
+  \param[in] p the pointer to the slot's data
+*/
+void seq_push_slot_finish(void *p) {
+  cqueue_mpmc_slot *slot;
+  size_t seq;
+
+  slot = (cqueue_mpmc_slot *)((unsigned char *)p - offsetof(cqueue_mpmc_slot, data));
+
+  // we own the slot, so seq == pos
+  seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+/*! Check whether the producer would overwrite a slot some consumer has
+  not read yet
+
+  The consumers' cursors are only scanned when the producer's cached copy
+  of the slowest one says the queue is full.
+  \returns 1 if the queue is full, 0 otherwise
+*/
+int bcast_full(cqueue_bcast *q) {
+  size_t push_idx, min, pop_idx;
+
+  push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed);
+  if (push_idx - q->pop_idx_cache < q->capacity)
+    return 0;
+
+  min = push_idx;
+  for (size_t i=0; i < q->n_consumers; i++) {
+    pop_idx = atomic_load_explicit(&q->cursors[i].pop_idx, memory_order_acquire);
+    if ((ptrdiff_t)(pop_idx - min) < 0)
+      min = pop_idx;
+  }
+  q->pop_idx_cache = min;
+
+  return push_idx - min >= q->capacity;
+}
+
 /*! Check if i is a power of 2
 
   \param[in] i the int to check, 0 <= i <= SIZE_MAX
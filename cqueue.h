@@ -5,12 +5,15 @@
 
   Compilation Options:
   CQUEUE_DEBUG: enables the function cqueue_spsc_print()
+  CQUEUE_STATS: keeps cqueue_spsc usage counters and enables the function
+  cqueue_spsc_get_stats()
 */
 
 #ifndef _CQUEUE_
 #define _CQUEUE_
 
 #include <stdlib.h>     // aligned_alloc
+#include <stddef.h>     // offsetof, ptrdiff_t
 #include <stdint.h>     // uintXX_t
 #include <limits.h>     // CHAR_BIT
 #include <assert.h>
@@ -30,6 +33,112 @@
 #define LEVEL1_DCACHE_LINESIZE 64
 #endif
 
+/*! How the blocking push and pop calls of a cqueue_spsc wait for a slot
+
+  Every strategy but CQUEUE_WAIT_SPIN first spins for the queue's spin count
+  of iterations before falling back to its waiting mechanism.
+*/
+typedef enum cqueue_wait {
+  CQUEUE_WAIT_SPIN,   //!< busy spin (the default)
+  CQUEUE_WAIT_PAUSE,  //!< busy spin with a cpu relax hint (PAUSE on x86)
+  CQUEUE_WAIT_YIELD,  //!< spin with pause, then sched_yield() in a loop
+  CQUEUE_WAIT_PARK    //!< spin with pause, then sleep in the kernel (futex on
+                      //!< Linux, sched_yield() elsewhere) until woken
+} cqueue_wait;
+
+/*! How cqueue_spsc_push() copies elements into their slots
+
+  cqueue_spsc_pop() uses the same kernels without the non-temporal stores.
+*/
+typedef enum cqueue_copy {
+  CQUEUE_COPY_AUTO,   //!< by size: inline copies for small elements, the
+                      //!< widest SIMD copy the cpu has, and non-temporal
+                      //!< stores from the queue's nt_threshold (the default)
+  CQUEUE_COPY_MEMCPY, //!< always memcpy()
+  CQUEUE_COPY_SSE2,   //!< 16 byte SSE2 loads and stores
+  CQUEUE_COPY_AVX2,   //!< 32 byte AVX2 loads and stores
+  CQUEUE_COPY_NT      //!< always non-temporal (streaming) stores, which
+                      //!< bypass the producer's cache
+} cqueue_copy;
+
+//! default size from which CQUEUE_COPY_AUTO uses non-temporal stores
+#define CQUEUE_NT_THRESHOLD 4096
+
+//! Where the sampled enqueue times of cqueue_spsc_enable_latency() come from
+typedef enum cqueue_clock {
+  CQUEUE_CLOCK_MONOTONIC, //!< clock_gettime(CLOCK_MONOTONIC), in ns
+  CQUEUE_CLOCK_TSC        //!< the x86 time stamp counter, in cycles. Only
+                          //!< comparable across cores with an invariant TSC.
+} cqueue_clock;
+
+//! linear sub-buckets per power of 2 of a cqueue_hist, as a power of 2
+#define CQUEUE_HIST_SUB_BITS 3
+//! number of buckets of a cqueue_hist, covering all of uint64_t
+#define CQUEUE_HIST_BUCKETS ((64 - CQUEUE_HIST_SUB_BITS + 1) \
+                             << CQUEUE_HIST_SUB_BITS)
+
+/*! A snapshot of a log-linear histogram, see cqueue_spsc_get_latency()
+
+  Values below 2^CQUEUE_HIST_SUB_BITS have a bucket each. Above that, every
+  power of 2 is split in 2^CQUEUE_HIST_SUB_BITS buckets of equal width, so
+  a bucket is at most 12.5% wide relative to its values.
+*/
+typedef struct cqueue_hist {
+  uint64_t count;       //!< values recorded
+  uint64_t sum;         //!< sum of the values, for the mean
+  uint64_t max;         //!< largest value
+  uint64_t buckets[CQUEUE_HIST_BUCKETS];
+} cqueue_hist;
+
+//! cqueue_spsc_opts.numa_node value for the default memory policy
+#define CQUEUE_NUMA_ANY (-1)
+
+/*! Allocation options for cqueue_spsc_new_opts()
+
+  Initialize with cqueue_spsc_opts_init() before setting any fields, so that
+  fields added later keep their defaults.
+*/
+typedef struct cqueue_spsc_opts {
+  //! NUMA node to bind the queue's memory to, or CQUEUE_NUMA_ANY to leave
+  //! placement to the default policy. To have the consumer's node hold the
+  //! slots, leave this at CQUEUE_NUMA_ANY and prefault at 0, and call
+  //! cqueue_spsc_prefault() from the consumer thread before the first push
+  int numa_node;
+  //! non-zero to back the queue with huge pages: explicit (MAP_HUGETLB)
+  //! pages if the system has some reserved, transparent ones otherwise
+  int huge_pages;
+  //! non-zero to fault in every page of the queue from the creating thread
+  int prefault;
+  //! granularity that slots are padded to, a power of 2 multiple of
+  //! LEVEL1_DCACHE_LINESIZE of at most 4096, eg 128 on cpus whose adjacent
+  //! line prefetcher pulls in cachelines in pairs. 0 for
+  //! LEVEL1_DCACHE_LINESIZE. The struct's own padding is fixed at compile time
+  size_t line_size;
+} cqueue_spsc_opts;
+
+#ifdef CQUEUE_STATS
+/*! A snapshot of a cqueue_spsc's usage counters, see cqueue_spsc_get_stats()
+*/
+typedef struct cqueue_spsc_stats {
+  uint64_t pushes;      //!< elements pushed
+  uint64_t pops;        //!< elements popped
+  uint64_t push_full;   //!< trypush calls that found the queue full
+  uint64_t pop_empty;   //!< trypop calls that found the queue empty
+  uint64_t push_spins;  //!< wait loop iterations in the blocking pushes
+  uint64_t pop_spins;   //!< wait loop iterations in the blocking pops
+  uint64_t high_water;  //!< most used slots seen right after a push
+} cqueue_spsc_stats;
+
+#define CQUEUE_PUSH_STATS_SIZE (3 * sizeof(_Atomic uint64_t))
+#define CQUEUE_POP_STATS_SIZE (2 * sizeof(_Atomic uint64_t))
+#else
+#define CQUEUE_PUSH_STATS_SIZE 0
+#define CQUEUE_POP_STATS_SIZE 0
+#endif
+
+struct cqueue_spsc_set;
+struct cqueue_spsc_latency;
+
 /*! The main struct for spsc cqueues
 
   These should only be allocated by cqueue_spsc_new() since there are strict
@@ -43,16 +152,60 @@ typedef struct cqueue_spsc {
   // reading into the struct at most 1 cacheline
   size_t capacity;
   size_t elem_size;
-  unsigned char *array;
-  _Atomic size_t n_used_slots;
-  char pad1[LEVEL1_DCACHE_LINESIZE - 2 * sizeof(size_t)
-            - sizeof(unsigned char*) - sizeof(_Atomic size_t)];
+  // the slot array directly follows the struct in the same allocation, its
+  // offset rather than its address is stored so that the queue can live in
+  // memory that is mapped at different addresses by different processes
+  size_t array_offset;
+  cqueue_wait wait;   //!< wait strategy of the blocking calls
+  unsigned spin;      //!< spin iterations before the strategy's fallback
+  int push_fd;        //!< eventfd signalled when space frees up, or -1
+  int pop_fd;         //!< eventfd signalled when data arrives, or -1
+  unsigned flags;     //!< how the queue was allocated
+  unsigned set_idx;   //!< the queue's index in set
+  struct cqueue_spsc_set *set;  //!< the set the queue was added to, or NULL
+  uint32_t nt_threshold;  //!< see cqueue_spsc_set_copy()
+  uint8_t copy;       //!< cqueue_copy of cqueue_spsc_push()
+  uint8_t prefetch;   //!< nonzero to prefetch the next slot when popping
+  uint8_t avx2;       //!< nonzero when the cpu has AVX2, checked at creation
+  char pad1[LEVEL1_DCACHE_LINESIZE - 3 * sizeof(size_t)
+            - sizeof(cqueue_wait) - 3 * sizeof(unsigned) - 2 * sizeof(int)
+            - sizeof(struct cqueue_spsc_set *) - sizeof(uint32_t)
+            - 3 * sizeof(uint8_t)];
   // ensure that push_idx and pop_idx are on their own cachelines to
-  // prevent false sharing
-  size_t push_idx;
-  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(size_t)];
-  size_t pop_idx;
-  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(size_t)];
+  // prevent false sharing. Both are free-running counts of pushed (popped)
+  // elements, written only by their own side; the slot index is
+  // idx & (capacity-1). They are atomic only so that
+  // cqueue_spsc_get_no_used_slots() may read them from any thread.
+  _Atomic size_t push_idx;
+#ifdef CQUEUE_STATS
+  // counters are kept next to the index of the side that writes them
+  _Atomic uint64_t push_full;
+  _Atomic uint64_t push_spins;
+  _Atomic uint64_t high_water;
+#endif
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - CQUEUE_PUSH_STATS_SIZE];
+  _Atomic size_t pop_idx;
+#ifdef CQUEUE_STATS
+  _Atomic uint64_t pop_empty;
+  _Atomic uint64_t pop_spins;
+#endif
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - CQUEUE_POP_STATS_SIZE];
+  //! enqueue time samples, see cqueue_spsc_enable_latency(), or NULL
+  struct cqueue_spsc_latency *lat;
+  // nonzero while the pusher (popper) is parked. Written only around
+  // parking, so the other side can cheaply read it after every operation
+  // and skip the wake up syscall when nobody is parked
+  _Atomic uint32_t push_parked;
+  _Atomic uint32_t pop_parked;
+  // likewise, nonzero while the pusher (popper) waits on its eventfd
+  _Atomic uint32_t push_armed;
+  _Atomic uint32_t pop_armed;
+  // nonzero while the popper waits for the set's ready bit of the queue
+  _Atomic uint32_t set_armed;
+  char pad4[LEVEL1_DCACHE_LINESIZE - sizeof(struct cqueue_spsc_latency *)
+            - 5 * sizeof(_Atomic uint32_t)];
 } cqueue_spsc;
 
 /*! Allocates and initializes a queue capable of holding at least capacity
@@ -63,8 +216,76 @@ typedef struct cqueue_spsc {
 */
 cqueue_spsc* cqueue_spsc_new(size_t capacity, size_t elem_size);
 
+/*! Sets opts to the defaults: no NUMA binding, regular pages, no
+ prefaulting, and LEVEL1_DCACHE_LINESIZE padding
+*/
+void cqueue_spsc_opts_init(cqueue_spsc_opts *opts);
+
+/*! Allocates and initializes a queue like cqueue_spsc_new(), with control
+ over where and how its memory is allocated
+
+  The queue is allocated with mmap() rather than malloc(), so that it can be
+  bound to a NUMA node and backed by huge pages.
+  \param[in] opts the allocation options, or NULL for the defaults
+  \return the address of the newly allocated queue, or NULL on error,
+  including when the NUMA node cannot be bound to. Huge pages fall back to
+  regular ones when unavailable
+*/
+cqueue_spsc* cqueue_spsc_new_opts(size_t capacity, size_t elem_size,
+                                  const cqueue_spsc_opts *opts);
+
+/*! Faults in every page of the queue from the calling thread
+
+  With the default first-touch NUMA policy this places the pages on the
+  calling thread's node. Must be called before the first push.
+*/
+void cqueue_spsc_prefault(cqueue_spsc *q);
+
+/*! Allocates and initializes a queue like cqueue_spsc_new(), but places it
+ in a shared mapping of fd so that other processes can attach to it
+
+  The whole queue, including its slot array, lives in the mapping, and only
+  offsets are stored in it. fd is typically obtained from memfd_create() or
+  shm_open(), it is resized to fit the queue and remains owned by the caller.
+  Eventfd notification (cqueue_spsc_enable_fds()) is not available for shared
+  queues, since fds are per process; CQUEUE_WAIT_PARK works across processes.
+  \param[in] fd a file descriptor opened for reading and writing
+  \returns the address of the queue in this process, or NULL on error
+*/
+cqueue_spsc* cqueue_spsc_new_shm_fd(int fd, size_t capacity, size_t elem_size);
+
+/*! Like cqueue_spsc_new_shm_fd(), but creates the POSIX shared memory object
+ name with shm_open()
+
+  The object must not exist yet. It is not removed by cqueue_spsc_delete(),
+  call shm_unlink(name) once every process has attached.
+  \returns the address of the queue in this process, or NULL on error
+*/
+cqueue_spsc* cqueue_spsc_new_shm(const char *name, size_t capacity,
+                                 size_t elem_size);
+
+/*! Attach to a queue created by cqueue_spsc_new_shm_fd()
+
+  The mapping's header is checked for a matching magic number, layout
+  version, cacheline size and element size before the queue is used.
+  \param[in] fd a file descriptor for the same file as the creator's, eg
+  inherited across fork() or passed over a unix domain socket
+  \param[in] elem_size the element size the queue was created with
+  \returns the address of the queue in this process, or NULL on error
+*/
+cqueue_spsc* cqueue_spsc_attach_shm_fd(int fd, size_t elem_size);
+
+/*! Attach to a queue created by cqueue_spsc_new_shm()
+
+  \param[in] name the name of the POSIX shared memory object
+  \param[in] elem_size the element size the queue was created with
+  \returns the address of the queue in this process, or NULL on error
+*/
+cqueue_spsc* cqueue_spsc_attach_shm(const char *name, size_t elem_size);
+
 /*! Deallocates the queue
 
+  For shared queues, this only unmaps the queue from the calling process.
   \param[in,out] p a pointer to the pointer to the queue to be deallocated.
   On success, *p will be set to NULL.
 */
@@ -75,10 +296,71 @@ void cqueue_spsc_delete(cqueue_spsc **p);
   cqueue_spsc_push_slot_finish must be called after a successful call
 
   ex: cqueue_spsc_push_slot(), write data, cqueue_spsc_push_slot_finish()
-  \returns a pointer to the next available queue slot, or blocks (spins) when the queue is full
+  \returns a pointer to the next available queue slot, or blocks when the
+  queue is full, see cqueue_spsc_set_wait()
 */
 void* cqueue_spsc_push_slot(cqueue_spsc *q);
 
+/*! Set the strategy of the blocking calls on q
+
+  Must be called before the queue is shared between threads.
+  \param[in] wait the strategy, CQUEUE_WAIT_SPIN by default
+  \param[in] spin the number of spin iterations before CQUEUE_WAIT_YIELD and
+  CQUEUE_WAIT_PARK fall back to yielding (parking respectively)
+*/
+void cqueue_spsc_set_wait(cqueue_spsc *q, cqueue_wait wait, unsigned spin);
+
+/*! Create eventfds that signal q's pusher and popper, so that they can
+ wait for the queue in an epoll (or poll/select) event loop
+
+  The fds are only signalled while armed, so pushers and poppers that do not
+  use them never make a syscall. A popper waiting for data (pusher waiting
+  for space) calls cqueue_spsc_arm_pop_fd() (cqueue_spsc_arm_push_fd()), and
+  only waits for the fd to become readable when that returns 0. The next
+  cqueue_spsc_push_slot_finish() (cqueue_spsc_pop_slot_finish()) then makes
+  the fd readable and disarms it. The fds are closed by cqueue_spsc_delete().
+
+  Must be called before the queue is shared between threads. Only
+  available on Linux, and not for queues in shared memory.
+  \returns 0 on success, -1 on error
+*/
+int cqueue_spsc_enable_fds(cqueue_spsc *q);
+
+/*! Get the fd that becomes readable when an armed popper can pop
+  \returns the fd, or -1 unless cqueue_spsc_enable_fds() succeeded
+*/
+int cqueue_spsc_get_pop_fd(cqueue_spsc *q);
+
+/*! Get the fd that becomes readable when an armed pusher can push
+  \returns the fd, or -1 unless cqueue_spsc_enable_fds() succeeded
+*/
+int cqueue_spsc_get_push_fd(cqueue_spsc *q);
+
+/*! Arm the pop fd before waiting on it, only to be called by the popper
+
+  Clears any pending readiness of the fd, arms it, and rechecks the queue.
+  \returns 0 when the queue is empty and the popper should wait for the fd,
+  1 when there is data to pop (the fd is left disarmed)
+*/
+int cqueue_spsc_arm_pop_fd(cqueue_spsc *q);
+
+/*! Arm the push fd before waiting on it, only to be called by the pusher
+
+  Clears any pending readiness of the fd, arms it, and rechecks the queue.
+  \returns 0 when the queue is full and the pusher should wait for the fd,
+  1 when there is a slot to push to (the fd is left disarmed)
+*/
+int cqueue_spsc_arm_push_fd(cqueue_spsc *q);
+
+/*! Get a pointer to the next available queue slot for pushing, waiting at
+ most timeout_ns nanoseconds for one
+
+  cqueue_spsc_push_slot_finish must be called after a successful call
+  \returns a pointer to the next available queue slot, or NULL when the queue
+  stayed full for timeout_ns
+*/
+void* cqueue_spsc_push_slot_timeout(cqueue_spsc *q, uint64_t timeout_ns);
+
 /*! Get a pointer to the next available queue slot for pushing
 
   cqueue_spsc_push_slot_finish must be called after a successful call
@@ -102,10 +384,20 @@ void cqueue_spsc_push_slot_finish(cqueue_spsc *q);
   cqueue_spsc_pop_slot_finish must be called after a successful call
 
   ex: cqueue_spsc_pop_slot(), read data, cqueue_spsc_pop_slot_finish()
-  \returns a pointer to the next available queue slot, or blocks (spins) when the queue is empty
+  \returns a pointer to the next available queue slot, or blocks when the
+  queue is empty, see cqueue_spsc_set_wait()
 */
 void* cqueue_spsc_pop_slot(cqueue_spsc *q);
 
+/*! Get a pointer to the next available queue slot for popping, waiting at
+ most timeout_ns nanoseconds for one
+
+  cqueue_spsc_pop_slot_finish must be called after a successful call
+  \returns a pointer to the next available queue slot, or NULL when the queue
+  stayed empty for timeout_ns
+*/
+void* cqueue_spsc_pop_slot_timeout(cqueue_spsc *q, uint64_t timeout_ns);
+
 /*! Get a pointer to the next available queue slot for popping
 
   cqueue_spsc_pop_slot_finish must be called after a successful call
@@ -124,7 +416,136 @@ void* cqueue_spsc_trypop_slot(cqueue_spsc *q);
 */
 void cqueue_spsc_pop_slot_finish(cqueue_spsc *q);
 
+/*! Get pointers to a contiguous run of up to n queue slots for pushing
+
+  The run never wraps around the end of the slot array, so fewer than n
+  slots may be returned even when more are free. The i-th slot of the run
+  is at (unsigned char *)slot + i * q->elem_size.
+  cqueue_spsc_push_slots_finish must be called after a successful call
+
+  ex: cqueue_spsc_push_slots(), write data, cqueue_spsc_push_slots_finish()
+  \param[in] n the maximum number of slots to reserve
+  \param[out] got the number of slots reserved, 0 < *got <= n on success
+  \returns a pointer to the first slot of the run, or NULL when the queue is
+  full (or n is 0)
+*/
+void* cqueue_spsc_push_slots(cqueue_spsc *q, size_t n, size_t *got);
+
+/*! Publish the fact that the first n reserved push slots are now used
+
+  All n slots are published with a single release store.
+  Must be called after a successful cqueue_spsc_push_slots call
+  \param[in] n the number of slots to publish, at most the number reserved
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_spsc_push_slots_finish(cqueue_spsc *q, size_t n);
+
+/*! Get pointers to a contiguous run of up to n queue slots for popping
+
+  The run never wraps around the end of the slot array, so fewer than n
+  slots may be returned even when more are used. The i-th slot of the run
+  is at (unsigned char *)slot + i * q->elem_size.
+  cqueue_spsc_pop_slots_finish must be called after a successful call
+
+  ex: cqueue_spsc_pop_slots(), read data, cqueue_spsc_pop_slots_finish()
+  \param[in] n the maximum number of slots to reserve
+  \param[out] got the number of slots reserved, 0 < *got <= n on success
+  \returns a pointer to the first slot of the run, or NULL when the queue is
+  empty (or n is 0)
+*/
+void* cqueue_spsc_pop_slots(cqueue_spsc *q, size_t n, size_t *got);
+
+/*! Publish the fact that the first n reserved pop slots are now unused
+
+  All n slots are handed back with a single release store.
+  Must be called after a successful cqueue_spsc_pop_slots call
+  \param[in] n the number of slots to release, at most the number reserved
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_spsc_pop_slots_finish(cqueue_spsc *q, size_t n);
+
+/*! Count the elements ready to be popped, up to max
+
+  Unlike cqueue_spsc_pop_slots(), the count runs across the end of the slot
+  array. The elements stay in the queue; walk them with
+  cqueue_spsc_peek_slot() and release them with cqueue_spsc_pop_finish_n().
+  \param[in] max the maximum number of elements to count
+  \returns the number of ready elements, 0 when the queue is empty
+*/
+size_t cqueue_spsc_peek(cqueue_spsc *q, size_t max);
+
+/*! Get a pointer to the i-th ready element, counting from the head
+
+  ex: n = cqueue_spsc_peek(), read cqueue_spsc_peek_slot(q, 0) to
+  cqueue_spsc_peek_slot(q, n-1), cqueue_spsc_pop_finish_n(q, n)
+  \param[in] i the element to look at, less than the last cqueue_spsc_peek()
+  count minus the elements released since
+  \returns a pointer to the element's data
+*/
+void* cqueue_spsc_peek_slot(cqueue_spsc *q, size_t i);
+
+/*! Release the first n ready elements
+
+  All n slots are handed back with a single release store, also when they
+  run across the end of the slot array.
+  \param[in] n the number of elements to release, at most the last
+  cqueue_spsc_peek() count
+  \warning Releasing elements that were not counted ready may result in
+  queue inconsistency
+*/
+void cqueue_spsc_pop_finish_n(cqueue_spsc *q, size_t n);
+
+/*! Choose how cqueue_spsc_push() and cqueue_spsc_pop() copy elements
+
+  Non-temporal stores keep elements that only the consumer will read out
+  of the producer's cache, at the cost of a store fence per push and of
+  the consumer missing in cache when it shares the producer's.
+  Must be called before the producer and consumer start: the settings are
+  plain fields that both sides read on every push and pop.
+  \param[in] copy the copy kernel
+  \param[in] nt_threshold the element size from which CQUEUE_COPY_AUTO
+  uses non-temporal stores, 0 for never
+  \param[in] prefetch nonzero to have cqueue_spsc_pop() prefetch the next
+  slot while copying out the current one
+  \returns 0 on success, -1 when the cpu does not support copy
+*/
+int cqueue_spsc_set_copy(cqueue_spsc *q, cqueue_copy copy,
+                         uint32_t nt_threshold, int prefetch);
+
+/*! Copy len bytes from src into the next slot and publish it
+
+  Waits like cqueue_spsc_push_slot() while the queue is full.
+  \returns 0 on success, -1 when len is larger than a slot
+*/
+int cqueue_spsc_push(cqueue_spsc *q, const void *src, size_t len);
+
+/*! Copy len bytes from src into the next slot and publish it
+
+  \returns 0 on success, -1 when the queue is full or len is larger than
+  a slot
+*/
+int cqueue_spsc_trypush(cqueue_spsc *q, const void *src, size_t len);
+
+/*! Copy len bytes of the next element to dst and release its slot
+
+  Slots do not record the length pushed, so the caller passes it.
+  Waits like cqueue_spsc_pop_slot() while the queue is empty.
+  \returns 0 on success, -1 when len is larger than a slot
+*/
+int cqueue_spsc_pop(cqueue_spsc *q, void *dst, size_t len);
+
+/*! Copy len bytes of the next element to dst and release its slot
+
+  \returns 0 on success, -1 when the queue is empty or len is larger than
+  a slot
+*/
+int cqueue_spsc_trypop(cqueue_spsc *q, void *dst, size_t len);
+
 /*! Get number of used slots
+
+  Derived from push_idx and pop_idx, so it costs the push and pop operations
+  nothing. Callable from any thread; the result is a snapshot and may be
+  stale by the time it is returned, but is always within [0, capacity].
  \returns number of used slots
 */
 size_t cqueue_spsc_get_no_used_slots(cqueue_spsc *q);
@@ -134,6 +555,1179 @@ size_t cqueue_spsc_get_no_used_slots(cqueue_spsc *q);
 void cqueue_spsc_print(cqueue_spsc *q);
 #endif
 
+#ifdef CQUEUE_STATS
+/*! Take a snapshot of the queue's usage counters
+
+  Callable from any thread without stopping traffic. Each counter is read
+  atomically, but not all of them at the same instant.
+
+  Keeping the counters costs each operation a few stores to cachelines it
+  owns, except for high_water, which makes every push read pop_idx.
+  \param[out] stats the snapshot
+*/
+void cqueue_spsc_get_stats(cqueue_spsc *q, cqueue_spsc_stats *stats);
+#endif
+
+/*! Sample how long elements wait in the queue
+
+  Every period-th push stamps its slot with the time in
+  cqueue_spsc_push_slot_finish() (or the batch and copying variants), and
+  the pop of that slot records the time since in a log-linear histogram
+  that only the consumer writes. Unsampled pushes and pops cost a test of a
+  pointer the queue reads anyway.
+  Must be called before the producer and consumer start.
+  \param[in] period the sampling period, rounded up to a power of 2
+  \param[in] clock where the times come from
+  \returns 0 on success, -1 when the queue is in shared memory, latency
+  sampling is already enabled, the clock is not available or on allocation
+  failure
+*/
+int cqueue_spsc_enable_latency(cqueue_spsc *q, size_t period,
+                               cqueue_clock clock);
+
+/*! Take a snapshot of the queue's latency histogram, from any thread
+
+  The buckets are in the unit of the clock passed to
+  cqueue_spsc_enable_latency(). The counters are read one at a time, so a
+  snapshot taken while the consumer pops may be off by the pops in between.
+  \param[out] hist the snapshot, all zero when sampling is not enabled
+*/
+void cqueue_spsc_get_latency(cqueue_spsc *q, cqueue_hist *hist);
+
+/*! The smallest value counted in bucket i of a cqueue_hist
+*/
+uint64_t cqueue_hist_bucket_low(size_t i);
+
+/*! The value below which a fraction p of the histogram's values fall
+
+  \param[in] p the fraction, between 0 and 1
+  \returns the upper bound of the bucket holding that value, capped at the
+  maximum, or 0 for an empty histogram
+*/
+uint64_t cqueue_hist_percentile(const cqueue_hist *hist, double p);
+
+//! a queue of a cqueue_spsc_set and its share of the consumer
+typedef struct cqueue_spsc_set_member {
+  cqueue_spsc *q;
+  unsigned weight;    //!< elements popped in a row before moving on
+} cqueue_spsc_set_member;
+
+/*! The main struct for sets of spsc cqueues served by one consumer
+
+  Saves the consumer of many mostly idle queues from polling each of them.
+  Every queue has a bit in a ready bitmap. When the consumer finds a queue
+  empty it clears the bit and arms the queue; the producer's next push
+  sees the queue armed and sets the bit again. The consumer finds ready
+  queues by scanning the bitmap a word at a time, so an idle queue costs it
+  a bit rather than a cacheline, and producers of busy queues never touch
+  the bitmap.
+
+  Queues are visited in index order starting after the last one served.
+  A queue's weight is the number of elements popped from it in a row
+  before moving on: weight 1 everywhere is plain round-robin, larger
+  weights give a queue a larger share when several are ready.
+
+  These should only be allocated by cqueue_spsc_set_new(). The set is the
+  consumer's: all calls must come from the thread that pops the queues.
+*/
+typedef struct cqueue_spsc_set {
+  size_t max_queues;
+  size_t n_queues;
+  size_t n_words;           //!< number of words in ready
+  cqueue_spsc_set_member *members;
+  //! ready bitmap, set by producers and cleared by the consumer
+  _Atomic uint64_t *ready;
+  size_t cursor;            //!< index of the queue served last
+  unsigned credit;          //!< pops left on the cursor's queue
+} cqueue_spsc_set;
+
+/*! Allocates an empty set
+
+  \param[in] max_queues the most queues that can be added
+  \return the address of the newly allocated set, or NULL on error
+*/
+cqueue_spsc_set* cqueue_spsc_set_new(size_t max_queues);
+
+/*! Deallocates the set, removing its queues from it
+
+  \param[in,out] p a pointer to the pointer to the set to be deallocated.
+  On success, *p will be set to NULL.
+  \warning The queues' producers must not be pushing
+*/
+void cqueue_spsc_set_delete(cqueue_spsc_set **p);
+
+/*! Add a queue to the set
+
+  The queue must not be in shared memory, since its producer writes to the
+  set, nor in another set. Add queues before their producers start pushing.
+  \param[in] weight the number of elements popped from q in a row, at
+  least 1
+  \returns the queue's index in the set, or -1 on error
+*/
+int cqueue_spsc_set_add(cqueue_spsc_set *s, cqueue_spsc *q, unsigned weight);
+
+/*! Get a pointer to the next slot for popping from any queue of the set
+
+  cqueue_spsc_pop_slot_finish must be called on *q after a successful call
+  \param[out] q the queue the slot belongs to
+  \returns a pointer to the slot, or NULL when every queue is empty
+*/
+void* cqueue_spsc_set_trypop_slot(cqueue_spsc_set *s, cqueue_spsc **q);
+
+/*! Get number of queues marked ready
+
+  A ready queue is likely, but not certain, to hold data.
+ \returns number of ready queues
+*/
+size_t cqueue_spsc_set_get_no_ready(cqueue_spsc_set *s);
+
+/*! Get a pointer to the next slot for popping from the first ready queue
+
+  Like cqueue_spsc_set_trypop_slot(), but always serves the ready queue
+  with the lowest index, ignoring weights: strict priority by index.
+  cqueue_spsc_pop_slot_finish must be called on *q after a successful call
+  \param[out] q the queue the slot belongs to
+  \returns a pointer to the slot, or NULL when every queue is empty
+*/
+void* cqueue_spsc_set_trypop_slot_first(cqueue_spsc_set *s, cqueue_spsc **q);
+
+//! How cqueue_lanes_trypop_slot() picks a lane
+typedef enum cqueue_lanes_policy {
+  //! the first ready lane, so lane 0 is always served first. Busy lanes
+  //! starve the lanes after them.
+  CQUEUE_LANES_STRICT,
+  //! the ready lanes in turn, each for up to its weight in elements
+  CQUEUE_LANES_WRR
+} cqueue_lanes_policy;
+
+/*! The main struct for multi-lane spsc cqueues
+
+  Priority lanes between one producer and one consumer, eg control
+  messages that must not wait behind bulk data. Each lane is a cqueue_spsc
+  with its own capacity, and the lanes form a cqueue_spsc_set, so the
+  consumer finds the lanes holding data in the set's ready bitmap instead
+  of probing every lane.
+
+  These should only be allocated by cqueue_lanes_new().
+*/
+typedef struct cqueue_lanes {
+  // read-only elements
+  size_t n_lanes;
+  cqueue_spsc **lanes;
+  cqueue_spsc_set *set;
+  cqueue_lanes_policy policy;
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(size_t) - sizeof(cqueue_spsc **)
+            - sizeof(cqueue_spsc_set *) - sizeof(cqueue_lanes_policy)];
+  // consumer only
+  cqueue_spsc *popping;     //!< the lane of the last slot popped
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(cqueue_spsc *)];
+} cqueue_lanes;
+
+/*! Allocates and initializes a multi-lane queue
+
+  \param[in] n_lanes the number of lanes, at least 1
+  \param[in] capacities the minimum number of elements of each lane
+  \param[in] elem_size the maximum size of any element
+  \param[in] policy how the consumer picks a lane
+  \param[in] weights the elements popped from each lane in a row under
+  CQUEUE_LANES_WRR, at least 1, or NULL for 1 everywhere
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_lanes* cqueue_lanes_new(size_t n_lanes, const size_t *capacities,
+                               size_t elem_size, cqueue_lanes_policy policy,
+                               const unsigned *weights);
+
+/*! Deallocates the queue and its lanes
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_lanes_delete(cqueue_lanes **p);
+
+/*! Get a pointer to the next slot for pushing to a lane
+
+  ex: cqueue_lanes_trypush_slot(), write data,
+  cqueue_lanes_push_slot_finish()
+  \returns a pointer to the slot, or NULL when the lane is full
+*/
+void* cqueue_lanes_trypush_slot(cqueue_lanes *l, size_t lane);
+
+/*! Publish the slot got from cqueue_lanes_trypush_slot() on lane
+*/
+void cqueue_lanes_push_slot_finish(cqueue_lanes *l, size_t lane);
+
+/*! Get a pointer to the next slot for popping, from the lane the policy
+ picks
+
+  ex: cqueue_lanes_trypop_slot(), read data, cqueue_lanes_pop_slot_finish()
+  \param[out] lane the lane of the slot, may be NULL
+  \returns a pointer to the slot, or NULL when every lane is empty
+*/
+void* cqueue_lanes_trypop_slot(cqueue_lanes *l, size_t *lane);
+
+/*! Release the slot got from cqueue_lanes_trypop_slot()
+*/
+void cqueue_lanes_pop_slot_finish(cqueue_lanes *l);
+
+/*! Get number of used slots of a lane
+*/
+size_t cqueue_lanes_get_no_used_slots(cqueue_lanes *l, size_t lane);
+
+struct cqueue_spsc_segment;
+
+/*! The main struct for unbounded spsc cqueues
+
+  These should only be allocated by cqueue_spsc_unbounded_new() since there
+  are strict cacheline alignment and padding issues to enable lockless
+  operation.
+
+  Elements are stored in a linked chain of fixed size segments, each laid
+  out like a cqueue_spsc array. When the producer fills a segment it links
+  a new one instead of failing; the consumer hands drained segments back
+  through a small cqueue_spsc of segment pointers, so that a steady state
+  allocates nothing. Segments beyond what the cache holds are freed; with a
+  memory limit, the cache holds every segment and none is ever freed.
+
+  Push and pop operations are thread safe for at most one concurrent push and
+  pop operation (ie, a single reader and a single writer).
+*/
+typedef struct cqueue_spsc_unbounded {
+  // read-only elements, see cqueue_spsc
+  size_t seg_capacity;      //!< slots per segment, a power of 2
+  size_t elem_size;
+  size_t max_segments;      //!< soft limit on live segments, 0 for none
+  cqueue_spsc *cache;       //!< drained segments, from consumer to producer
+  char pad1[LEVEL1_DCACHE_LINESIZE - 3 * sizeof(size_t)
+            - sizeof(cqueue_spsc*)];
+  // producer state
+  _Atomic size_t push_idx;  //!< number of elements pushed so far
+  size_t push_seg_start;    //!< push_idx of push_seg's first slot
+  struct cqueue_spsc_segment *push_seg;
+  size_t n_allocated;       //!< segments allocated so far
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - 2 * sizeof(size_t) - sizeof(struct cqueue_spsc_segment*)];
+  // consumer state
+  _Atomic size_t pop_idx;   //!< number of elements popped so far
+  size_t pop_seg_start;     //!< pop_idx of pop_seg's first slot
+  struct cqueue_spsc_segment *pop_seg;
+  _Atomic size_t n_freed;   //!< segments freed so far
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - sizeof(size_t) - sizeof(struct cqueue_spsc_segment*)
+            - sizeof(_Atomic size_t)];
+} cqueue_spsc_unbounded;
+
+/*! Allocates and initializes an unbounded queue of elements of at most
+ elem_size size
+
+  \param[in] seg_capacity the minimum number of elements per segment
+  \param[in] elem_size the maximum size of any element which is stored in
+  the queue
+  \param[in] max_bytes soft limit on the memory taken by segments, including
+  cached ones, or 0 for no limit. At the limit, pushes behave as if the
+  queue were full until the consumer drains a segment. At least two
+  segments are always allowed
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_spsc_unbounded* cqueue_spsc_unbounded_new(size_t seg_capacity,
+                                                 size_t elem_size,
+                                                 size_t max_bytes);
+
+/*! Deallocates the queue and all of its segments
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_spsc_unbounded_delete(cqueue_spsc_unbounded **p);
+
+/*! Get a pointer to the next available queue slot for pushing
+
+  cqueue_spsc_unbounded_push_slot_finish must be called after a successful
+  call
+  \returns a pointer to the next available queue slot, or blocks (spins)
+  while the memory limit is reached or a segment cannot be allocated
+*/
+void* cqueue_spsc_unbounded_push_slot(cqueue_spsc_unbounded *q);
+
+/*! Get a pointer to the next available queue slot for pushing
+
+  cqueue_spsc_unbounded_push_slot_finish must be called after a successful
+  call
+  \returns a pointer to the next available queue slot, or NULL when the
+  memory limit is reached or a segment cannot be allocated
+*/
+void* cqueue_spsc_unbounded_trypush_slot(cqueue_spsc_unbounded *q);
+
+/*! Publish the fact that the push slot is now used
+
+  Must be called after a successful cqueue_spsc_unbounded_trypush_slot call
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_spsc_unbounded_push_slot_finish(cqueue_spsc_unbounded *q);
+
+/*! Get a pointer to the next available queue slot for popping
+
+  cqueue_spsc_unbounded_pop_slot_finish must be called after a successful
+  call
+  \returns a pointer to the next available queue slot, or blocks (spins)
+  when the queue is empty
+*/
+void* cqueue_spsc_unbounded_pop_slot(cqueue_spsc_unbounded *q);
+
+/*! Get a pointer to the next available queue slot for popping
+
+  cqueue_spsc_unbounded_pop_slot_finish must be called after a successful
+  call
+  \returns a pointer to the next available queue slot, or NULL when the
+  queue is empty
+*/
+void* cqueue_spsc_unbounded_trypop_slot(cqueue_spsc_unbounded *q);
+
+/*! Publish the fact that the pop slot is now unused
+
+  Must be called after a successful cqueue_spsc_unbounded_trypop_slot call
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_spsc_unbounded_pop_slot_finish(cqueue_spsc_unbounded *q);
+
+/*! Get number of used slots
+
+  Callable from any thread; the result is a snapshot and may be stale by
+  the time it is returned.
+ \returns number of used slots
+*/
+size_t cqueue_spsc_unbounded_get_no_used_slots(cqueue_spsc_unbounded *q);
+
+/*! The main struct for dense spsc cqueues
+
+  These should only be allocated by cqueue_spsc_dense_new() since there are
+  strict cacheline alignment and padding issues to enable lockless operation.
+
+  Unlike cqueue_spsc, elements are packed tightly with no per slot flag or
+  cacheline padding: fullness and emptiness are derived from push_idx and
+  pop_idx. Each side keeps a cached copy of the other side's index on its
+  own cacheline, and only reads the other side's cacheline when its cached
+  copy says the queue is full (empty respectively).
+
+  Push and pop operations are thread safe for at most one concurrent push and
+  pop operation (ie, a single reader and a single writer).
+*/
+typedef struct cqueue_spsc_dense {
+  // read-only elements, see cqueue_spsc
+  size_t capacity;
+  size_t elem_size;
+  unsigned char *array;
+  char pad1[LEVEL1_DCACHE_LINESIZE - 2 * sizeof(size_t)
+            - sizeof(unsigned char*)];
+  // producer state
+  _Atomic size_t push_idx;  //!< number of elements pushed so far
+  size_t pop_idx_cache;     //!< producer's last seen copy of pop_idx
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t) - sizeof(size_t)];
+  // consumer state
+  _Atomic size_t pop_idx;   //!< number of elements popped so far
+  size_t push_idx_cache;    //!< consumer's last seen copy of push_idx
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t) - sizeof(size_t)];
+} cqueue_spsc_dense;
+
+/*! Allocates and initializes a dense queue capable of holding at least
+ capacity number of elements of at most elem_size size
+  \param[in] capacity the minimum number of elements that the queue will hold
+  \param[in] elem_size the maximum size of any element which is stored in the
+  queue. It is rounded up to the next power of 2 below alignof(max_align_t),
+  and to a multiple of alignof(max_align_t) above it, so that every slot is
+  suitably aligned for its contents.
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_spsc_dense* cqueue_spsc_dense_new(size_t capacity, size_t elem_size);
+
+/*! Deallocates the queue
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_spsc_dense_delete(cqueue_spsc_dense **p);
+
+/*! Get a pointer to the next available queue slot for pushing
+
+  cqueue_spsc_dense_push_slot_finish must be called after a successful call
+  \returns a pointer to the next available queue slot, or blocks (spins) when the queue is full
+*/
+void* cqueue_spsc_dense_push_slot(cqueue_spsc_dense *q);
+
+/*! Get a pointer to the next available queue slot for pushing
+
+  cqueue_spsc_dense_push_slot_finish must be called after a successful call
+  \returns a pointer to the next available queue slot, or NULL when the queue is full
+*/
+void* cqueue_spsc_dense_trypush_slot(cqueue_spsc_dense *q);
+
+/*! Publish the fact that the push slot is now used
+
+  Must be called after a successful cqueue_spsc_dense_trypush_slot call
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_spsc_dense_push_slot_finish(cqueue_spsc_dense *q);
+
+/*! Get a pointer to the next available queue slot for popping
+
+  cqueue_spsc_dense_pop_slot_finish must be called after a successful call
+  \returns a pointer to the next available queue slot, or blocks (spins) when the queue is empty
+*/
+void* cqueue_spsc_dense_pop_slot(cqueue_spsc_dense *q);
+
+/*! Get a pointer to the next available queue slot for popping
+
+  cqueue_spsc_dense_pop_slot_finish must be called after a successful call
+  \returns a pointer to the next available queue slot, or NULL when the queue is empty
+*/
+void* cqueue_spsc_dense_trypop_slot(cqueue_spsc_dense *q);
+
+/*! Publish the fact that the pop slot is now unused
+
+  Must be called after a successful cqueue_spsc_dense_trypop_slot call
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_spsc_dense_pop_slot_finish(cqueue_spsc_dense *q);
+
+/*! Get number of used slots
+ \returns number of used slots
+*/
+size_t cqueue_spsc_dense_get_no_used_slots(cqueue_spsc_dense *q);
+
+/*! The main struct for mpmc cqueues
+
+  These should only be allocated by cqueue_mpmc_new() since there are strict
+  cacheline alignment and padding issues to enable lockless operation.
+
+  Push and pop operations are thread safe for any number of concurrent
+  pushers and poppers. Each slot carries a sequence number in place of the
+  spsc used flag, so pushers and poppers claim slots by advancing push_idx
+  and pop_idx, and hand them over by bumping the slot's sequence number.
+*/
+typedef struct cqueue_mpmc {
+  // read-only elements, see cqueue_spsc
+  size_t capacity;
+  size_t elem_size;
+  unsigned char *array;
+  char pad1[LEVEL1_DCACHE_LINESIZE - 2 * sizeof(size_t)
+            - sizeof(unsigned char*)];
+  // push_idx and pop_idx are shared by all pushers (poppers respectively),
+  // keep them on their own cachelines
+  _Atomic size_t push_idx;
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)];
+  _Atomic size_t pop_idx;
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)];
+} cqueue_mpmc;
+
+/*! Allocates and initializes a queue capable of holding at least capacity
+ number of elements of at most elem_size size
+  \param[in] capacity the minimum number of elements that the queue will hold.
+  It is rounded up to a power of 2 that is at least 2.
+  \param[in] elem_size the maximum size of any element which is stored in the queue
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_mpmc* cqueue_mpmc_new(size_t capacity, size_t elem_size);
+
+/*! Deallocates the queue
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_mpmc_delete(cqueue_mpmc **p);
+
+/*! Claim the next queue slot for pushing
+
+  cqueue_mpmc_push_slot_finish must be called with the returned slot
+
+  ex: cqueue_mpmc_push_slot(), write data, cqueue_mpmc_push_slot_finish()
+  \returns a pointer to the claimed queue slot, or blocks (spins) until the
+  claimed slot has been popped when the queue is full
+*/
+void* cqueue_mpmc_push_slot(cqueue_mpmc *q);
+
+/*! Claim the next queue slot for pushing
+
+  cqueue_mpmc_push_slot_finish must be called with the returned slot
+
+  ex: cqueue_mpmc_trypush_slot(), write data, cqueue_mpmc_push_slot_finish()
+  \returns a pointer to the claimed queue slot, or NULL when the queue is full
+*/
+void* cqueue_mpmc_trypush_slot(cqueue_mpmc *q);
+
+/*! Publish the fact that the claimed push slot is now used
+
+  \param[in] slot the pointer returned by cqueue_mpmc_push_slot() or
+  cqueue_mpmc_trypush_slot()
+  \warning Not calling this function will stall every popper once they
+  reach the slot
+*/
+void cqueue_mpmc_push_slot_finish(cqueue_mpmc *q, void *slot);
+
+/*! Claim the next queue slot for popping
+
+  cqueue_mpmc_pop_slot_finish must be called with the returned slot
+
+  ex: cqueue_mpmc_pop_slot(), read data, cqueue_mpmc_pop_slot_finish()
+  \returns a pointer to the claimed queue slot, or blocks (spins) until the
+  claimed slot has been pushed when the queue is empty
+*/
+void* cqueue_mpmc_pop_slot(cqueue_mpmc *q);
+
+/*! Claim the next queue slot for popping
+
+  cqueue_mpmc_pop_slot_finish must be called with the returned slot
+
+  ex: cqueue_mpmc_trypop_slot(), read data, cqueue_mpmc_pop_slot_finish()
+  \returns a pointer to the claimed queue slot, or NULL when the queue is empty
+*/
+void* cqueue_mpmc_trypop_slot(cqueue_mpmc *q);
+
+/*! Publish the fact that the claimed pop slot is now unused
+
+  \param[in] slot the pointer returned by cqueue_mpmc_pop_slot() or
+  cqueue_mpmc_trypop_slot()
+  \warning Not calling this function will stall every pusher once they
+  reach the slot
+*/
+void cqueue_mpmc_pop_slot_finish(cqueue_mpmc *q, void *slot);
+
+/*! Get number of used slots
+
+  Slots that have been claimed but not yet finished are counted as used.
+  The result is a snapshot and may be stale by the time it is returned.
+ \returns number of used slots
+*/
+size_t cqueue_mpmc_get_no_used_slots(cqueue_mpmc *q);
+
+#ifdef CQUEUE_DEBUG
+//! Print the queue contents to stdout
+void cqueue_mpmc_print(cqueue_mpmc *q);
+#endif
+
+/*! The main struct for mpsc cqueues
+
+  These should only be allocated by cqueue_mpsc_new() since there are strict
+  cacheline alignment and padding issues to enable lockless operation.
+
+  Push operations are thread safe for any number of concurrent pushers, who
+  claim slots with a single atomic fetch-add (or a CAS for the try variant)
+  on push_idx, like cqueue_mpmc. Pop operations are only thread safe for a
+  single popper, who owns pop_idx and pops without any atomic
+  read-modify-write, like cqueue_spsc.
+*/
+typedef struct cqueue_mpsc {
+  // read-only elements, see cqueue_spsc
+  size_t capacity;
+  size_t elem_size;
+  unsigned char *array;
+  char pad1[LEVEL1_DCACHE_LINESIZE - 2 * sizeof(size_t)
+            - sizeof(unsigned char*)];
+  _Atomic size_t push_idx;
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)];
+  size_t pop_idx;
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(size_t)];
+} cqueue_mpsc;
+
+/*! Allocates and initializes a queue capable of holding at least capacity
+ number of elements of at most elem_size size
+  \param[in] capacity the minimum number of elements that the queue will hold.
+  It is rounded up to a power of 2 that is at least 2.
+  \param[in] elem_size the maximum size of any element which is stored in the queue
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_mpsc* cqueue_mpsc_new(size_t capacity, size_t elem_size);
+
+/*! Deallocates the queue
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_mpsc_delete(cqueue_mpsc **p);
+
+/*! Claim the next queue slot for pushing
+
+  cqueue_mpsc_push_slot_finish must be called with the returned slot
+
+  ex: cqueue_mpsc_push_slot(), write data, cqueue_mpsc_push_slot_finish()
+  \returns a pointer to the claimed queue slot, or blocks (spins) until the
+  claimed slot has been popped when the queue is full
+*/
+void* cqueue_mpsc_push_slot(cqueue_mpsc *q);
+
+/*! Claim the next queue slot for pushing
+
+  cqueue_mpsc_push_slot_finish must be called with the returned slot
+
+  ex: cqueue_mpsc_trypush_slot(), write data, cqueue_mpsc_push_slot_finish()
+  \returns a pointer to the claimed queue slot, or NULL when the queue is full
+*/
+void* cqueue_mpsc_trypush_slot(cqueue_mpsc *q);
+
+/*! Publish the fact that the claimed push slot is now used
+
+  \param[in] slot the pointer returned by cqueue_mpsc_push_slot() or
+  cqueue_mpsc_trypush_slot()
+  \warning Not calling this function will stall the popper once it
+  reaches the slot
+*/
+void cqueue_mpsc_push_slot_finish(cqueue_mpsc *q, void *slot);
+
+/*! Get a pointer to the next available queue slot for popping
+
+  cqueue_mpsc_pop_slot_finish must be called after a successful call
+
+  ex: cqueue_mpsc_pop_slot(), read data, cqueue_mpsc_pop_slot_finish()
+  \returns a pointer to the next available queue slot, or blocks (spins) when the queue is empty
+*/
+void* cqueue_mpsc_pop_slot(cqueue_mpsc *q);
+
+/*! Get a pointer to the next available queue slot for popping
+
+  cqueue_mpsc_pop_slot_finish must be called after a successful call
+
+  ex: cqueue_mpsc_trypop_slot(), read data, cqueue_mpsc_pop_slot_finish()
+  \returns a pointer to the next available queue slot, or NULL when the queue is empty
+*/
+void* cqueue_mpsc_trypop_slot(cqueue_mpsc *q);
+
+/*! Publish the fact that the pop slot is now unused
+
+  Must be called after a successful cqueue_mpsc_trypop_slot call
+
+  ex: cqueue_mpsc_trypop_slot(), read data, cqueue_mpsc_pop_slot_finish()
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_mpsc_pop_slot_finish(cqueue_mpsc *q);
+
+/*! Per consumer state of a cqueue_bcast
+
+  Each consumer's cursor lives on its own cacheline, so consumers never
+  share a written cacheline with each other or with the producer.
+*/
+typedef struct cqueue_bcast_cursor {
+  _Atomic size_t pop_idx;   //!< next position this consumer reads
+  size_t push_idx_cache;    //!< consumer's last seen copy of push_idx
+  char pad[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t) - sizeof(size_t)];
+} cqueue_bcast_cursor;
+
+/*! The main struct for broadcast (spmc multicast) cqueues
+
+  These should only be allocated by cqueue_bcast_new() since there are strict
+  cacheline alignment and padding issues to enable lockless operation.
+
+  A single producer writes each element once, and every one of the
+  n_consumers consumers reads every element in place. The producer is only
+  gated by the slowest consumer: a slot is reused once all consumers have
+  moved past it.
+
+  Push operations are thread safe for a single pusher. Pop operations are
+  thread safe for a single popper per consumer index.
+*/
+typedef struct cqueue_bcast {
+  // read-only elements, see cqueue_spsc
+  size_t capacity;
+  size_t elem_size;
+  size_t n_consumers;
+  unsigned char *array;
+  char pad1[LEVEL1_DCACHE_LINESIZE - 3 * sizeof(size_t)
+            - sizeof(unsigned char*)];
+  // producer state
+  _Atomic size_t push_idx;  //!< next position the producer writes
+  size_t pop_idx_cache;     //!< producer's last seen slowest consumer position
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t) - sizeof(size_t)];
+  cqueue_bcast_cursor cursors[];  //!< n_consumers consumer cursors
+} cqueue_bcast;
+
+/*! Allocates and initializes a broadcast queue capable of holding at least
+ capacity number of elements of at most elem_size size for n_consumers
+ consumers
+  \param[in] capacity the minimum number of elements that the queue will hold
+  \param[in] elem_size the maximum size of any element which is stored in the queue
+  \param[in] n_consumers the number of consumers, identified by the indices
+  0 to n_consumers-1. Every consumer must keep up for the producer to make
+  progress.
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_bcast* cqueue_bcast_new(size_t capacity, size_t elem_size,
+                               size_t n_consumers);
+
+/*! Deallocates the queue
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_bcast_delete(cqueue_bcast **p);
+
+/*! Get a pointer to the next available queue slot for pushing
+
+  cqueue_bcast_push_slot_finish must be called after a successful call
+
+  ex: cqueue_bcast_push_slot(), write data, cqueue_bcast_push_slot_finish()
+  \returns a pointer to the next available queue slot, or blocks (spins)
+  while the slowest consumer has not read the slot yet
+*/
+void* cqueue_bcast_push_slot(cqueue_bcast *q);
+
+/*! Get a pointer to the next available queue slot for pushing
+
+  cqueue_bcast_push_slot_finish must be called after a successful call
+
+  ex: cqueue_bcast_trypush_slot(), write data, cqueue_bcast_push_slot_finish()
+  \returns a pointer to the next available queue slot, or NULL when the
+  slowest consumer has not read the slot yet
+*/
+void* cqueue_bcast_trypush_slot(cqueue_bcast *q);
+
+/*! Publish the push slot to every consumer
+
+  Must be called after a successful cqueue_bcast_trypush_slot call
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_bcast_push_slot_finish(cqueue_bcast *q);
+
+/*! Get a pointer to consumer's next slot for popping
+
+  cqueue_bcast_pop_slot_finish must be called after a successful call.
+  The slot is shared with the other consumers and must not be written to.
+
+  ex: cqueue_bcast_pop_slot(), read data, cqueue_bcast_pop_slot_finish()
+  \param[in] consumer the consumer index, 0 <= consumer < n_consumers
+  \returns a pointer to the slot, or blocks (spins) when consumer has read
+  everything that was pushed
+*/
+const void* cqueue_bcast_pop_slot(cqueue_bcast *q, size_t consumer);
+
+/*! Get a pointer to consumer's next slot for popping
+
+  cqueue_bcast_pop_slot_finish must be called after a successful call.
+  The slot is shared with the other consumers and must not be written to.
+
+  ex: cqueue_bcast_trypop_slot(), read data, cqueue_bcast_pop_slot_finish()
+  \param[in] consumer the consumer index, 0 <= consumer < n_consumers
+  \returns a pointer to the slot, or NULL when consumer has read everything
+  that was pushed
+*/
+const void* cqueue_bcast_trypop_slot(cqueue_bcast *q, size_t consumer);
+
+/*! Publish the fact that consumer is done with its pop slot
+
+  Must be called after a successful cqueue_bcast_trypop_slot call
+  \param[in] consumer the consumer index, 0 <= consumer < n_consumers
+  \warning Not calling this function stalls the producer once it laps
+  the consumer
+*/
+void cqueue_bcast_pop_slot_finish(cqueue_bcast *q, size_t consumer);
+
+/*! A spsc ring of variable length records
+
+  Records are stored back to back in a byte array, each preceded by a
+  size_t length header and padded to CQUEUE_BYTERING_ALIGN bytes. A record
+  that would straddle the end of the array is preceded by a skip record
+  filling the rest of the array, so every record is contiguous.
+
+  These should only be allocated by cqueue_bytering_new() since there are
+  strict cacheline alignment and padding issues to enable lockless operation.
+
+  Push and pop operations are thread safe for at most one concurrent push and
+  pop operation (ie, a single reader and a single writer).
+*/
+typedef struct cqueue_bytering {
+  // read-only elements, see cqueue_spsc
+  size_t capacity;        //!< size of the array in bytes, a power of 2
+  size_t max_len;         //!< largest record that can be pushed
+  unsigned char *array;
+  char pad1[LEVEL1_DCACHE_LINESIZE - 2 * sizeof(size_t)
+            - sizeof(unsigned char*)];
+  // producer state
+  _Atomic size_t push_idx;  //!< number of bytes pushed so far
+  size_t pop_idx_cache;     //!< producer's last seen copy of pop_idx
+  size_t push_skip;         //!< bytes skipped before the reserved record
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - 2 * sizeof(size_t)];
+  // consumer state
+  _Atomic size_t pop_idx;   //!< number of bytes popped so far
+  size_t push_idx_cache;    //!< consumer's last seen copy of push_idx
+  size_t pop_size;          //!< bytes taken by the record being popped
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - 2 * sizeof(size_t)];
+} cqueue_bytering;
+
+//! alignment of every record's data in a cqueue_bytering
+#define CQUEUE_BYTERING_ALIGN sizeof(size_t)
+
+/*! Allocates and initializes a byte ring of at least capacity bytes
+
+  Each record takes its length rounded up to CQUEUE_BYTERING_ALIGN plus a
+  size_t header. Records may be at most half the ring, less the header,
+  so that a record and the skip record in front of it always fit.
+  \param[in] capacity the minimum size of the ring in bytes
+  \return the address of the newly allocated ring, or NULL on error
+*/
+cqueue_bytering* cqueue_bytering_new(size_t capacity);
+
+/*! Deallocates the ring
+
+  \param[in,out] p a pointer to the pointer to the ring to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_bytering_delete(cqueue_bytering **p);
+
+/*! Reserve a contiguous region of len bytes for pushing
+
+  cqueue_bytering_push_slot_finish must be called after a successful call
+  \returns a pointer to the region, or blocks (spins) until there is room.
+  Returns NULL at once if len > q->max_len
+*/
+void* cqueue_bytering_push_slot(cqueue_bytering *q, size_t len);
+
+/*! Reserve a contiguous region of len bytes for pushing
+
+  cqueue_bytering_push_slot_finish must be called after a successful call
+  \returns a pointer to the region, or NULL when there is no room or
+  len > q->max_len
+*/
+void* cqueue_bytering_trypush_slot(cqueue_bytering *q, size_t len);
+
+/*! Publish the reserved region as a record of len bytes
+
+  Must be called after a successful cqueue_bytering_trypush_slot call.
+  \param[in] len the length of the record, at most the reserved length
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_bytering_push_slot_finish(cqueue_bytering *q, size_t len);
+
+/*! Get a pointer to the next record for popping
+
+  cqueue_bytering_pop_slot_finish must be called after a successful call
+  \param[out] len the length of the record
+  \returns a pointer to the record, or blocks (spins) when the ring is empty
+*/
+void* cqueue_bytering_pop_slot(cqueue_bytering *q, size_t *len);
+
+/*! Get a pointer to the next record for popping
+
+  cqueue_bytering_pop_slot_finish must be called after a successful call
+  \param[out] len the length of the record
+  \returns a pointer to the record, or NULL when the ring is empty
+*/
+void* cqueue_bytering_trypop_slot(cqueue_bytering *q, size_t *len);
+
+/*! Publish the fact that the popped record's space is now unused
+
+  Must be called after a successful cqueue_bytering_trypop_slot call
+  \warning Not calling this function may result in queue inconsistency
+*/
+void cqueue_bytering_pop_slot_finish(cqueue_bytering *q);
+
+/*! Get number of used bytes, including headers and padding
+ \returns number of used bytes
+*/
+size_t cqueue_bytering_get_no_used_bytes(cqueue_bytering *q);
+
+/*! The main struct for latest value mailboxes
+
+  A single slot holding the newest value written, guarded by a sequence
+  lock: the writer makes seq odd, stores the value and makes seq even
+  again, and never waits for readers. A reader copies the value out and
+  retries if seq changed meanwhile, ie if the copy may be torn. Readers
+  only read, so any number of them can share the mailbox.
+
+  The value is stored as relaxed atomic words, which compile to plain moves
+  but keep concurrent reads and writes well defined.
+
+  These should only be allocated by cqueue_mailbox_new() since there are
+  strict cacheline alignment and padding issues to enable lockless
+  operation.
+
+  Writes are thread safe for a single writer.
+*/
+typedef struct cqueue_mailbox {
+  // read-only elements, see cqueue_spsc
+  size_t elem_size;
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(size_t)];
+  // the sequence number and the value share cachelines, both are read and
+  // written together
+  _Atomic size_t seq;     //!< twice the number of writes, odd during one
+  _Atomic uint64_t data[];
+} cqueue_mailbox;
+
+/*! Allocates and initializes a mailbox
+
+  \param[in] elem_size the size of the value
+  \return the address of the newly allocated mailbox, or NULL on error
+*/
+cqueue_mailbox* cqueue_mailbox_new(size_t elem_size);
+
+/*! Deallocates the mailbox
+
+  \param[in,out] p a pointer to the pointer to the mailbox to be
+  deallocated. On success, *p will be set to NULL.
+*/
+void cqueue_mailbox_delete(cqueue_mailbox **p);
+
+/*! Replace the value with elem_size bytes from src, never blocks
+*/
+void cqueue_mailbox_write(cqueue_mailbox *m, const void *src);
+
+/*! Copy the current value to dst
+
+  \returns the version of the value copied, ie the number of writes
+  before it, or 0 when nothing was written yet (dst is then zeroed)
+*/
+uint64_t cqueue_mailbox_read(cqueue_mailbox *m, void *dst);
+
+/*! Copy the current value to dst if it is newer than *version
+
+  \param[in,out] version the version the caller has, updated on success
+  \returns 0 when a newer value was copied, -1 when there is none
+*/
+int cqueue_mailbox_tryread(cqueue_mailbox *m, void *dst, uint64_t *version);
+
+/*! The main struct for keyed conflating queues
+
+  A queue of updates to keys 0 to n_keys-1 where only the newest update of
+  each key matters. Pushing to a key whose previous update is still
+  pending overwrites that update in place, so the consumer handles at most
+  one update per key however fast the producer pushes, and the producer
+  never blocks.
+
+  Every key has an entry holding its value behind a sequence lock, as in
+  cqueue_mailbox. A key is queued on ready, a cqueue_spsc_dense of keys,
+  when an update makes it pending. Since a key is queued at most once,
+  ready never fills up.
+
+  These should only be allocated by cqueue_conflate_new().
+
+  Push and pop operations are thread safe for at most one concurrent push
+  and pop operation (ie, a single reader and a single writer).
+*/
+typedef struct cqueue_conflate {
+  // read-only elements, see cqueue_spsc
+  size_t n_keys;
+  size_t elem_size;
+  size_t entry_size;          //!< bytes per key entry, whole cachelines
+  unsigned char *entries;
+  cqueue_spsc_dense *ready;   //!< pending keys in the order they became so
+  char pad1[LEVEL1_DCACHE_LINESIZE - 3 * sizeof(size_t)
+            - sizeof(unsigned char *) - sizeof(cqueue_spsc_dense *)];
+} cqueue_conflate;
+
+/*! Allocates and initializes a conflating queue
+
+  \param[in] n_keys the number of keys
+  \param[in] elem_size the size of a value
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_conflate* cqueue_conflate_new(size_t n_keys, size_t elem_size);
+
+/*! Deallocates the queue
+
+  \param[in,out] p a pointer to the pointer to the queue to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_conflate_delete(cqueue_conflate **p);
+
+/*! Set the value of key to elem_size bytes from src, never blocks
+
+  Replaces the key's pending value if the consumer has not taken it yet.
+  \returns 0 on success, -1 when key >= n_keys
+*/
+int cqueue_conflate_push(cqueue_conflate *q, size_t key, const void *src);
+
+/*! Take the newest value of the key that has been pending the longest
+
+  \param[out] key the key
+  \param[out] dst where the key's value is copied to
+  \returns 0 on success, -1 when no key is pending
+*/
+int cqueue_conflate_trypop(cqueue_conflate *q, size_t *key, void *dst);
+
+/*! Get number of pending keys
+ \returns number of pending keys
+*/
+size_t cqueue_conflate_get_no_pending(cqueue_conflate *q);
+
+/*! The main struct for zero-copy buffer pools
+
+  Passes large payloads between one producer and one consumer without
+  copying them through a queue's slots. The buffers are carved out of a
+  single slab allocated up front, each padded to whole cachelines. Two
+  cqueue_spsc rings carry pointers to them: forward, from the producer to
+  the consumer, and recycle, which returns the buffers the consumer is done
+  with and starts out holding all of them. Every buffer is always in
+  exactly one ring or held by one side, so neither ring ever fills, and in
+  steady state nothing is allocated or copied.
+
+  These should only be allocated by cqueue_pool_new().
+
+  cqueue_pool_tryalloc() and cqueue_pool_send() must only be called by a
+  single producer, cqueue_pool_tryrecv() and cqueue_pool_free() by a single
+  consumer.
+*/
+typedef struct cqueue_pool {
+  // read-only elements
+  size_t n_buffers;
+  size_t buf_size;          //!< stride of the buffers in the slab
+  unsigned char *slab;
+  size_t slab_size;         //!< size of the slab's mapping
+  cqueue_spsc *forward;     //!< buffers sent, with their lengths
+  cqueue_spsc *recycle;     //!< buffers free for the producer
+  char pad1[LEVEL1_DCACHE_LINESIZE - 3 * sizeof(size_t)
+            - sizeof(unsigned char *) - 2 * sizeof(cqueue_spsc *)];
+} cqueue_pool;
+
+/*! Allocates a pool of n_buffers buffers of at least buf_size bytes
+
+  \param[in] opts where and how the slab is allocated, as for
+  cqueue_spsc_new_opts(): huge pages, NUMA node, prefaulting, and the
+  granularity the buffers are padded to. NULL for the defaults.
+  \return the address of the newly allocated pool, or NULL on error
+*/
+cqueue_pool* cqueue_pool_new(size_t n_buffers, size_t buf_size,
+                             const cqueue_spsc_opts *opts);
+
+/*! Deallocates the pool, its slab and its rings
+
+  \param[in,out] p a pointer to the pointer to the pool to be deallocated.
+  On success, *p will be set to NULL.
+*/
+void cqueue_pool_delete(cqueue_pool **p);
+
+/*! Take a free buffer, for the producer
+
+  ex: cqueue_pool_tryalloc(), write payload, cqueue_pool_send()
+  \returns the buffer, or NULL when all buffers are in use
+*/
+void* cqueue_pool_tryalloc(cqueue_pool *p);
+
+/*! Take a free buffer, waiting like cqueue_spsc_pop_slot() while all
+ buffers are in use
+*/
+void* cqueue_pool_alloc(cqueue_pool *p);
+
+/*! Hand a buffer from cqueue_pool_tryalloc() over to the consumer
+
+  \param[in] len the length of the payload, passed along to the consumer
+*/
+void cqueue_pool_send(cqueue_pool *p, void *buf, size_t len);
+
+/*! Take the next buffer sent, for the consumer
+
+  ex: cqueue_pool_tryrecv(), read payload, cqueue_pool_free()
+  \param[out] len the length passed to cqueue_pool_send()
+  \returns the buffer, or NULL when none was sent
+*/
+void* cqueue_pool_tryrecv(cqueue_pool *p, size_t *len);
+
+/*! Take the next buffer sent, waiting like cqueue_spsc_pop_slot() while
+ none was sent
+*/
+void* cqueue_pool_recv(cqueue_pool *p, size_t *len);
+
+/*! Return a buffer from cqueue_pool_tryrecv() to the producer
+*/
+void cqueue_pool_free(cqueue_pool *p, void *buf);
+
+/*! Get number of free buffers, a snapshot that may be stale when returned
+
+  Callable from any thread; the result is at most n_buffers.
+*/
+size_t cqueue_pool_get_no_free(cqueue_pool *p);
+
+//! a function run by a task popped or stolen from a cqueue_deque
+typedef void (*cqueue_task_fn)(void *arg);
+
+//! a task as returned by cqueue_deque_pop() and cqueue_deque_steal()
+typedef struct cqueue_task {
+  cqueue_task_fn fn;
+  void *arg;
+} cqueue_task;
+
+struct cqueue_deque_array;
+
+/*! The main struct for work-stealing deques
+
+  A Chase-Lev deque of tasks: a single owner pushes and pops tasks at the
+  bottom, any number of thieves steal from the top. The owner only contends
+  with thieves for the last task, so pushes and pops are a few plain loads
+  and stores (and a fence) in the common case.
+
+  The array starts at the requested capacity and doubles when the owner
+  pushes onto a full deque, up to max_capacity. Thieves may still be
+  reading an outgrown array, so those are kept until the deque is deleted,
+  which at most doubles the memory in use.
+
+  These should only be allocated by cqueue_deque_new() since there are
+  strict cacheline alignment and padding issues to enable lockless
+  operation.
+
+  cqueue_deque_push() and cqueue_deque_pop() must only be called by the
+  owner, cqueue_deque_steal() is safe from any thread.
+*/
+typedef struct cqueue_deque {
+  // read-only elements, see cqueue_spsc
+  size_t max_capacity;      //!< the array never grows beyond this
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(size_t)];
+  // thieves advance top with a CAS, keep it away from the owner's line
+  _Atomic size_t top;       //!< position of the oldest task
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)];
+  // owner state; the array pointer is also read by thieves but only
+  // changes when the deque grows
+  _Atomic size_t bottom;    //!< position one past the newest task
+  _Atomic(struct cqueue_deque_array *) array;
+  struct cqueue_deque_array *retired;  //!< outgrown arrays, owner only
+  char pad3[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)
+            - 2 * sizeof(struct cqueue_deque_array *)];
+} cqueue_deque;
+
+//! cqueue_deque_steal() lost a race for the top task, the deque may not be
+//! empty
+#define CQUEUE_DEQUE_RETRY 1
+
+/*! Allocates and initializes a work-stealing deque
+
+  \param[in] capacity the initial number of tasks, rounded up to a power of 2
+  \param[in] max_capacity the most tasks the deque will grow to hold,
+  rounded up to a power of 2 and at least capacity
+  \return the address of the newly allocated deque, or NULL on error
+*/
+cqueue_deque* cqueue_deque_new(size_t capacity, size_t max_capacity);
+
+/*! Deallocates the deque
+
+  \param[in,out] p a pointer to the pointer to the deque to be deallocated.
+  On success, *p will be set to NULL.
+  \warning No thief may be in cqueue_deque_steal() on the deque
+*/
+void cqueue_deque_delete(cqueue_deque **p);
+
+/*! Push a task at the bottom of the deque, owner only
+
+  Grows the array when it is full.
+  \returns 0 on success, -1 when the deque holds max_capacity tasks or
+  growing it failed
+*/
+int cqueue_deque_push(cqueue_deque *q, cqueue_task_fn fn, void *arg);
+
+/*! Pop the newest task from the bottom of the deque, owner only
+
+  \param[out] task the popped task
+  \returns 0 on success, -1 when the deque is empty
+*/
+int cqueue_deque_pop(cqueue_deque *q, cqueue_task *task);
+
+/*! Steal the oldest task from the top of the deque
+
+  \param[out] task the stolen task
+  \returns 0 on success, -1 when the deque is empty, CQUEUE_DEQUE_RETRY
+  when another thief or the owner took the task first
+*/
+int cqueue_deque_steal(cqueue_deque *q, cqueue_task *task);
+
+/*! Get number of tasks in the deque
+ \returns number of tasks, which may be stale by the time it is returned
+*/
+size_t cqueue_deque_get_no_used_slots(cqueue_deque *q);
+
 #endif  // _CQUEUE_
 // vim: et:ts=3:sw=3:sts=3
 
@@ -0,0 +1,448 @@
+/*!
+  \file
+  Benchmark harness for cqueue_spsc
+
+  Runs a grid of element sizes, capacities, batch sizes and core pinning
+  layouts, measuring throughput and ping-pong round trip latency for each,
+  and writes one CSV line or JSON object per case so that runs can be
+  compared across releases.
+
+  usage: cqueue_bench [-n msgs] [-l samples] [-f csv|json] [-q]
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>     // getopt, sysconf
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MAX_CPUS 4096
+
+typedef enum {
+  FORMAT_CSV,
+  FORMAT_JSON
+} format;
+
+/*! where the producer and consumer run, relative to each other */
+typedef struct layout {
+  const char *name;
+  int producer_cpu;     //!< -1 for unpinned
+  int consumer_cpu;     //!< -1 for unpinned
+} layout;
+
+/*! one point of the grid and its results */
+typedef struct bench_case {
+  const layout *layout;
+  size_t elem_size;
+  size_t capacity;
+  size_t batch;
+  uint64_t msgs;
+  double secs;
+  uint64_t lat_samples;
+  uint64_t p50, p99, p999, max;   //!< round trip latency in ns
+} bench_case;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;       //!< queue to push to (throughput) or ping queue
+  cqueue_spsc *q2;      //!< pong queue (latency)
+  const bench_case *c;
+  int cpu;
+  int yield;            //!< yield instead of spinning when blocked
+  uint64_t *lat;        //!< round trip samples (latency)
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static const size_t elem_sizes[] = { 8, 64, 256, 1024 };
+static const size_t capacities[] = { 64, 1024, 16384 };
+static const size_t batches[] = { 1, 16, 64 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static int detect_layouts(layout *layouts);
+static int read_int(int cpu, const char *file);
+static void run_throughput(bench_case *c);
+static void run_latency(bench_case *c);
+static void start(pthread_t *t, void *(*fn)(void *), struct thread_args *args);
+static void *tp_producer(void *targ);
+static void *tp_consumer(void *targ);
+static void *lat_ping(void *targ);
+static void *lat_pong(void *targ);
+static void wait_a_bit(int yield);
+static void print_case(FILE *out, format fmt, const bench_case *c, int first);
+
+int main(int argc, char** argv) {
+  layout layouts[4];
+  bench_case c;
+  format fmt = FORMAT_CSV;
+  uint64_t msgs = 1000000, samples = 10000;
+  int n_layouts, opt, quick = 0, first = 1;
+
+  while ((opt = getopt(argc, argv, "n:l:f:q")) != -1) {
+    switch (opt) {
+    case 'n':
+      msgs = strtoull(optarg, NULL, 10);
+      break;
+    case 'l':
+      samples = strtoull(optarg, NULL, 10);
+      break;
+    case 'f':
+      if (!strcmp(optarg, "json"))
+        fmt = FORMAT_JSON;
+      else if (strcmp(optarg, "csv"))
+        goto usage;
+      break;
+    case 'q':
+      quick = 1;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc || !msgs || !samples)
+    goto usage;
+
+  n_layouts = detect_layouts(layouts);
+
+  if (fmt == FORMAT_CSV)
+    printf("layout,producer_cpu,consumer_cpu,elem_size,capacity,batch,msgs,"
+           "seconds,msgs_per_s,bytes_per_s,lat_samples,lat_p50_ns,"
+           "lat_p99_ns,lat_p999_ns,lat_max_ns\n");
+  else
+    printf("[\n");
+
+  for (int l = 0; l < n_layouts; l++) {
+    for (size_t s = 0; s < COUNT(elem_sizes); s++) {
+      for (size_t k = 0; k < COUNT(capacities); k++) {
+        for (size_t b = 0; b < COUNT(batches); b++) {
+          // quick mode only runs the corners of the grid
+          if (quick && ((s && s != COUNT(elem_sizes) - 1) ||
+                        (k && k != COUNT(capacities) - 1)))
+            continue;
+          if (batches[b] > capacities[k])
+            continue;
+
+          memset(&c, 0, sizeof(c));
+          c.layout = &layouts[l];
+          c.elem_size = elem_sizes[s];
+          c.capacity = capacities[k];
+          c.batch = batches[b];
+          c.msgs = msgs;
+          run_throughput(&c);
+
+          // latency does not depend on the batch size
+          if (b == 0) {
+            c.lat_samples = samples;
+            run_latency(&c);
+          }
+
+          print_case(stdout, fmt, &c, first);
+          fflush(stdout);
+          first = 0;
+        }
+      }
+    }
+  }
+
+  if (fmt == FORMAT_JSON)
+    printf("\n]\n");
+  exit(EXIT_SUCCESS);
+
+usage:
+  fprintf(stderr, "usage: %s [-n msgs] [-l latency samples] [-f csv|json] "
+          "[-q]\n", argv[0]);
+  exit(EXIT_FAILURE);
+}
+
+/*! Pick cpus for each layout that exists on this machine, from sysfs
+
+  cpu 0 runs the producer in every pinned layout.
+  \returns the number of layouts
+*/
+static int detect_layouts(layout *layouts) {
+  long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int pkg0 = read_int(0, "physical_package_id");
+  int core0 = read_int(0, "core_id");
+  int sibling = -1, socket = -1, cross = -1;
+  int n = 0, pkg, core;
+
+  if (n_cpus > MAX_CPUS)
+    n_cpus = MAX_CPUS;
+
+  for (int cpu = 1; cpu < n_cpus; cpu++) {
+    pkg = read_int(cpu, "physical_package_id");
+    core = read_int(cpu, "core_id");
+    if (pkg < 0 || core < 0)
+      continue;
+    if (pkg == pkg0 && core == core0 && sibling < 0)
+      sibling = cpu;
+    else if (pkg == pkg0 && core != core0 && socket < 0)
+      socket = cpu;
+    else if (pkg != pkg0 && cross < 0)
+      cross = cpu;
+  }
+
+  layouts[n++] = (layout){ "same_core", 0, 0 };
+  if (sibling >= 0 && pkg0 >= 0)
+    layouts[n++] = (layout){ "smt_sibling", 0, sibling };
+  if (socket >= 0 && pkg0 >= 0)
+    layouts[n++] = (layout){ "same_socket", 0, socket };
+  if (cross >= 0 && pkg0 >= 0)
+    layouts[n++] = (layout){ "cross_socket", 0, cross };
+  return n;
+}
+
+/*! Read an int from cpu's sysfs topology directory
+  \returns the value, or -1 on error
+*/
+static int read_int(int cpu, const char *file) {
+  char path[128];
+  FILE *f;
+  int val;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+           cpu, file);
+  f = fopen(path, "r");
+  if (!f)
+    return -1;
+  if (fscanf(f, "%d", &val) != 1)
+    val = -1;
+  fclose(f);
+  return val;
+}
+
+/*! Push c->msgs elements from one thread to another in batches of c->batch
+*/
+static void run_throughput(bench_case *c) {
+  struct thread_args pargs, cargs;
+  pthread_t pt, ct;
+  double t0;
+  cqueue_spsc *q;
+
+  q = cqueue_spsc_new(c->capacity, c->elem_size);
+  if (!q)
+    bench_fail("cqueue_spsc_new failed");
+
+  memset(&pargs, 0, sizeof(pargs));
+  pargs.q = q;
+  pargs.c = c;
+  pargs.cpu = c->layout->producer_cpu;
+  pargs.yield = c->layout->producer_cpu == c->layout->consumer_cpu;
+  cargs = pargs;
+  cargs.cpu = c->layout->consumer_cpu;
+
+  t0 = bench_seconds();
+  start(&ct, &tp_consumer, &cargs);
+  start(&pt, &tp_producer, &pargs);
+  pthread_join(pt, NULL);
+  pthread_join(ct, NULL);
+  c->secs = bench_seconds() - t0;
+
+  bench_check_sum(cargs.sum, bench_sum_to(c->msgs));
+
+  cqueue_spsc_delete(&q);
+}
+
+/*! Bounce an element between two threads over a pair of queues
+*/
+static void run_latency(bench_case *c) {
+  struct thread_args pargs, cargs;
+  pthread_t pt, ct;
+  uint64_t *lat;
+
+  lat = malloc(c->lat_samples * sizeof(*lat));
+  memset(&pargs, 0, sizeof(pargs));
+  pargs.q = cqueue_spsc_new(c->capacity, c->elem_size);
+  pargs.q2 = cqueue_spsc_new(c->capacity, c->elem_size);
+  if (!lat || !pargs.q || !pargs.q2)
+    bench_fail("latency setup failed");
+  pargs.c = c;
+  pargs.cpu = c->layout->producer_cpu;
+  pargs.yield = c->layout->producer_cpu == c->layout->consumer_cpu;
+  pargs.lat = lat;
+  cargs = pargs;
+  cargs.cpu = c->layout->consumer_cpu;
+
+  start(&ct, &lat_pong, &cargs);
+  start(&pt, &lat_ping, &pargs);
+  pthread_join(pt, NULL);
+  pthread_join(ct, NULL);
+
+  qsort(lat, c->lat_samples, sizeof(*lat), &bench_cmp_u64);
+  c->p50 = lat[c->lat_samples / 2];
+  c->p99 = lat[c->lat_samples * 99 / 100];
+  c->p999 = lat[c->lat_samples * 999 / 1000];
+  c->max = lat[c->lat_samples - 1];
+
+  free(lat);
+  cqueue_spsc_delete(&pargs.q);
+  cqueue_spsc_delete(&pargs.q2);
+}
+
+/*! Start a thread, pinned to args->cpu unless it is -1
+
+  Exits when the thread can't be pinned rather than reporting results for
+  a layout that didn't run.
+*/
+static void start(pthread_t *t, void *(*fn)(void *), struct thread_args *args) {
+  pthread_attr_t attr;
+  cpu_set_t set;
+
+  pthread_attr_init(&attr);
+  if (args->cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(args->cpu, &set);
+    if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set))
+      bench_fail("pthread_attr_setaffinity_np failed");
+  }
+  if (pthread_create(t, &attr, fn, args))
+    bench_fail("pthread_create failed");
+  pthread_attr_destroy(&attr);
+}
+
+static void *tp_producer(void *targ) {
+  struct thread_args *args = targ;
+  const bench_case *c = args->c;
+  uint64_t data = 1;
+  unsigned char *p;
+  size_t got, i;
+
+  while (data <= c->msgs) {
+    if (c->batch == 1) {
+      while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+        wait_a_bit(args->yield);
+      // fill the whole element, as a real producer would
+      memset(p, 0, c->elem_size);
+      memcpy(p, &data, sizeof(data));
+      data++;
+      cqueue_spsc_push_slot_finish(args->q);
+      continue;
+    }
+
+    while ((p = cqueue_spsc_push_slots(args->q, c->batch, &got)) == NULL)
+      wait_a_bit(args->yield);
+    for (i=0; i < got && data <= c->msgs; i++, data++) {
+      memset(p + i * args->q->elem_size, 0, c->elem_size);
+      memcpy(p + i * args->q->elem_size, &data, sizeof(data));
+    }
+    cqueue_spsc_push_slots_finish(args->q, i);
+  }
+
+  return NULL;
+}
+
+static void *tp_consumer(void *targ) {
+  struct thread_args *args = targ;
+  const bench_case *c = args->c;
+  uint64_t remaining = c->msgs, data;
+  unsigned char *p;
+  size_t got, i;
+
+  while (remaining) {
+    if (c->batch == 1) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        wait_a_bit(args->yield);
+      memcpy(&data, p, sizeof(data));
+      args->sum += data;
+      cqueue_spsc_pop_slot_finish(args->q);
+      remaining--;
+      continue;
+    }
+
+    while ((p = cqueue_spsc_pop_slots(args->q, c->batch, &got)) == NULL)
+      wait_a_bit(args->yield);
+    for (i=0; i < got; i++) {
+      memcpy(&data, p + i * args->q->elem_size, sizeof(data));
+      args->sum += data;
+    }
+    cqueue_spsc_pop_slots_finish(args->q, got);
+    remaining -= got;
+  }
+
+  return NULL;
+}
+
+static void *lat_ping(void *targ) {
+  struct thread_args *args = targ;
+  const bench_case *c = args->c;
+  uint64_t t;
+  unsigned char *p;
+
+  for (uint64_t i=0; i < c->lat_samples; i++) {
+    while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+      wait_a_bit(args->yield);
+    t = bench_now_ns();
+    memcpy(p, &t, sizeof(t));
+    cqueue_spsc_push_slot_finish(args->q);
+
+    while ((p = cqueue_spsc_trypop_slot(args->q2)) == NULL)
+      wait_a_bit(args->yield);
+    memcpy(&t, p, sizeof(t));
+    cqueue_spsc_pop_slot_finish(args->q2);
+    args->lat[i] = bench_now_ns() - t;
+  }
+
+  return NULL;
+}
+
+static void *lat_pong(void *targ) {
+  struct thread_args *args = targ;
+  const bench_case *c = args->c;
+  unsigned char *p, *r;
+
+  for (uint64_t i=0; i < c->lat_samples; i++) {
+    while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+      wait_a_bit(args->yield);
+    while ((r = cqueue_spsc_trypush_slot(args->q2)) == NULL)
+      wait_a_bit(args->yield);
+    memcpy(r, p, c->elem_size);
+    cqueue_spsc_push_slot_finish(args->q2);
+    cqueue_spsc_pop_slot_finish(args->q);
+  }
+
+  return NULL;
+}
+
+/*! Back off after finding the queue full or empty
+
+  Threads sharing a cpu must yield for the other to make progress.
+*/
+static void wait_a_bit(int yield) {
+  if (yield)
+    bench_wait();
+#if defined(__x86_64__) || defined(__i386__)
+  else
+    __builtin_ia32_pause();
+#endif
+}
+
+static void print_case(FILE *out, format fmt, const bench_case *c, int first) {
+  double msgs_per_s = c->msgs / c->secs;
+
+  if (fmt == FORMAT_CSV) {
+    fprintf(out, "%s,%d,%d,%zu,%zu,%zu,%" PRIu64 ",%.6f,%.0f,%.0f,%" PRIu64
+            ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+            c->layout->name, c->layout->producer_cpu,
+            c->layout->consumer_cpu, c->elem_size, c->capacity, c->batch,
+            c->msgs, c->secs, msgs_per_s, msgs_per_s * c->elem_size,
+            c->lat_samples, c->p50, c->p99, c->p999, c->max);
+    return;
+  }
+
+  fprintf(out, "%s  {\"layout\": \"%s\", \"producer_cpu\": %d, "
+          "\"consumer_cpu\": %d, \"elem_size\": %zu, \"capacity\": %zu, "
+          "\"batch\": %zu, \"msgs\": %" PRIu64 ", \"seconds\": %.6f, "
+          "\"msgs_per_s\": %.0f, \"bytes_per_s\": %.0f",
+          first ? "" : ",\n", c->layout->name, c->layout->producer_cpu,
+          c->layout->consumer_cpu, c->elem_size, c->capacity, c->batch,
+          c->msgs, c->secs, msgs_per_s, msgs_per_s * c->elem_size);
+  if (c->lat_samples)
+    fprintf(out, ", \"lat_samples\": %" PRIu64 ", \"lat_p50_ns\": %" PRIu64
+            ", \"lat_p99_ns\": %" PRIu64 ", \"lat_p999_ns\": %" PRIu64
+            ", \"lat_max_ns\": %" PRIu64, c->lat_samples, c->p50, c->p99,
+            c->p999, c->max);
+  fprintf(out, "}");
+}
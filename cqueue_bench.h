@@ -0,0 +1,105 @@
+/*!
+  \file
+  Helpers shared by the benchmark harness and the standalone benchmarks
+
+  The harness, cqueue_bench, runs a grid of cqueue_spsc cases. The
+  standalone benchmarks, cqueue_bench_*, each compare the variants of one
+  feature and take the number of passes as their only argument.
+*/
+
+#ifndef _CQUEUE_BENCH_
+#define _CQUEUE_BENCH_
+
+#include <pthread.h>
+#include <sched.h>      // sched_yield
+#include <stdio.h>      // printf
+#include <stdlib.h>     // atol, exit
+#include <time.h>       // clock_gettime
+#include <stdint.h>     // uint64_t
+
+/*! Parse the number of passes, the only argument of a standalone benchmark
+
+  Exits with a usage message when it is missing or not positive.
+*/
+static inline long bench_passes(int argc, char **argv) {
+  long passes;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  return passes;
+}
+
+/*! Print an error and exit
+
+  The error goes to stderr so that it never mixes with results written to
+  stdout.
+*/
+static inline void bench_fail(const char *msg) {
+  fprintf(stderr, "Error: %s\n", msg);
+  exit(EXIT_FAILURE);
+}
+
+/*! Wait for the other side after finding a queue full or empty
+
+  The benchmarks yield rather than spin: the machines they run on may have
+  fewer cpus than benchmark threads, and a spinning thread would hold its
+  cpu until its time slice ends, measuring the scheduler instead of the
+  queue.
+*/
+static inline void bench_wait(void) {
+  sched_yield();
+}
+
+//! the current monotonic time in nanoseconds
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+//! the current monotonic time in seconds
+static inline double bench_seconds(void) {
+  return bench_now_ns() / 1e9;
+}
+
+//! qsort comparator for uint64_t latencies
+static inline int bench_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*! Run producer(pargs) and consumer(cargs) on threads of their own
+
+  \returns the seconds until both returned
+*/
+static inline double bench_run_pair(void *(*producer)(void *), void *pargs,
+                                    void *(*consumer)(void *), void *cargs) {
+  pthread_t pt, ct;
+  double start;
+
+  start = bench_seconds();
+  if (pthread_create(&ct, NULL, consumer, cargs) ||
+      pthread_create(&pt, NULL, producer, pargs))
+    bench_fail("pthread_create failed");
+  pthread_join(pt, NULL);
+  pthread_join(ct, NULL);
+  return bench_seconds() - start;
+}
+
+//! the sum of the sequence numbers 1..n, which producers push
+static inline uint64_t bench_sum_to(uint64_t n) {
+  return n * (n + 1) / 2;
+}
+
+/*! Exit unless the sum of what the consumers popped is expected
+*/
+static inline void bench_check_sum(uint64_t sum, uint64_t expected) {
+  if (sum != expected)
+    bench_fail("checksum mismatch");
+}
+
+#endif  // _CQUEUE_BENCH_
+// vim: et:ts=3:sw=3:sts=3
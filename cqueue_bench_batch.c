@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MAX_BATCH 256
+#define CAPACITY 1024
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t limit;
+  size_t batch;
+  int peek;             // consume with peek and pop_finish_n
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *q;
+  long passes;
+  double secs;
+  size_t batch;
+  int peek;
+
+  passes = bench_passes(argc, argv);
+
+  q = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+  if (!q)
+    bench_fail("cqueue_spsc_new failed");
+
+  // batch size 0 uses the single slot api as a baseline
+  printf("%-8s %-6s %14s %14s\n", "batch", "pop", "seconds", "ns/msg");
+  for (batch = 0; batch <= MAX_BATCH; batch = batch ? batch * 2 : 1) {
+    for (peek = 0; peek <= !!batch; peek++) {
+      pargs.q = cargs.q = q;
+      pargs.limit = cargs.limit = passes;
+      pargs.batch = cargs.batch = batch;
+      cargs.peek = peek;
+      cargs.sum = 0;
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+      if (batch)
+        printf("%-8zu %-6s %14.6f %14.3f\n", batch, peek ? "peek" : "slots",
+               secs, secs * 1e9 / passes);
+      else
+        printf("%-8s %-6s %14.6f %14.3f\n", "single", "slot", secs,
+               secs * 1e9 / passes);
+    }
+  }
+
+  cqueue_spsc_delete(&q);
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data = 1;
+  unsigned char *p;
+  size_t got, i;
+
+  while (data <= args->limit) {
+    if (!args->batch) {
+      while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+        bench_wait();
+      *(uint64_t *)p = data++;
+      cqueue_spsc_push_slot_finish(args->q);
+      continue;
+    }
+
+    while ((p = cqueue_spsc_push_slots(args->q, args->batch, &got)) == NULL)
+      bench_wait();
+    for (i=0; i < got && data <= args->limit; i++)
+      *(uint64_t *)(p + i * args->q->elem_size) = data++;
+    cqueue_spsc_push_slots_finish(args->q, i);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t remaining = args->limit;
+  unsigned char *p;
+  size_t got, i;
+
+  while (remaining) {
+    if (!args->batch) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      args->sum += *(uint64_t *)p;
+      cqueue_spsc_pop_slot_finish(args->q);
+      remaining--;
+      continue;
+    }
+
+    if (args->peek) {
+      // the run may wrap, so look at each element through peek_slot
+      while ((got = cqueue_spsc_peek(args->q, args->batch)) == 0)
+        bench_wait();
+      for (i=0; i < got; i++)
+        args->sum += *(uint64_t *)cqueue_spsc_peek_slot(args->q, i);
+      cqueue_spsc_pop_finish_n(args->q, got);
+      remaining -= got;
+      continue;
+    }
+
+    while ((p = cqueue_spsc_pop_slots(args->q, args->batch, &got)) == NULL)
+      bench_wait();
+    for (i=0; i < got; i++)
+      args->sum += *(uint64_t *)(p + i * args->q->elem_size);
+    cqueue_spsc_pop_slots_finish(args->q, got);
+    remaining -= got;
+  }
+
+  pthread_exit(NULL);
+}
@@ -0,0 +1,150 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MIN_LEN 16
+#define MAX_LEN 16384
+#define RING_BYTES (1024 * 1024)
+
+typedef enum {
+  SPSC,
+  BYTERING
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  void *q;
+  uint64_t limit;
+  uint64_t bytes;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+static size_t next_len(uint64_t *state);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *sq;
+  cqueue_bytering *bq;
+  size_t footprint;
+  long passes;
+  double secs;
+  queue_type type;
+
+  passes = bench_passes(argc, argv);
+
+  // messages of MIN_LEN to MAX_LEN bytes through the same amount of memory:
+  // fixed MAX_LEN slots, or a byte ring
+  printf("%-10s %14s %14s %14s %14s\n", "queue", "array bytes", "seconds",
+         "ns/msg", "MB/s");
+  for (type = SPSC; type <= BYTERING; type++) {
+    sq = NULL;
+    bq = NULL;
+    if (type == SPSC) {
+      sq = cqueue_spsc_new(RING_BYTES / MAX_LEN, MAX_LEN);
+      footprint = sq ? sq->capacity * sq->elem_size : 0;
+      pargs.q = cargs.q = sq;
+    } else {
+      bq = cqueue_bytering_new(RING_BYTES);
+      footprint = bq ? bq->capacity : 0;
+      pargs.q = cargs.q = bq;
+    }
+    if (!pargs.q)
+      bench_fail("queue allocation failed");
+
+    pargs.type = cargs.type = type;
+    pargs.limit = cargs.limit = passes;
+    pargs.bytes = cargs.bytes = 0;
+
+    secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+
+    if (cargs.bytes != pargs.bytes)
+      bench_fail("byte count mismatch");
+
+    printf("%-10s %14zu %14.6f %14.3f %14.3f\n",
+           type == SPSC ? "spsc" : "bytering", footprint, secs,
+           secs * 1e9 / passes, cargs.bytes / secs / 1e6);
+
+    cqueue_spsc_delete(&sq);
+    cqueue_bytering_delete(&bq);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+/*! xorshift, both sides draw the same sequence of lengths
+*/
+static size_t next_len(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return MIN_LEN + *state % (MAX_LEN - MIN_LEN + 1);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  static unsigned char buf[MAX_LEN];
+  uint64_t state = 88172645463325252ULL;
+  uint64_t i;
+  size_t len;
+  void *p;
+
+  memset(buf, 0x5a, sizeof(buf));
+  for (i=0; i < args->limit; i++) {
+    len = next_len(&state);
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+        bench_wait();
+      // the fixed slots carry their own length
+      memcpy(p, &len, sizeof(len));
+      memcpy((unsigned char *)p + sizeof(len), buf, len - sizeof(len));
+      cqueue_spsc_push_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_bytering_trypush_slot(args->q, len)) == NULL)
+        bench_wait();
+      memcpy(p, buf, len);
+      cqueue_bytering_push_slot_finish(args->q, len);
+    }
+    args->bytes += len;
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  static unsigned char buf[MAX_LEN];
+  uint64_t state = 88172645463325252ULL;
+  uint64_t i;
+  size_t len;
+  void *p;
+
+  for (i=0; i < args->limit; i++) {
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      memcpy(&len, p, sizeof(len));
+      memcpy(buf, p, len);
+      cqueue_spsc_pop_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_bytering_trypop_slot(args->q, &len)) == NULL)
+        bench_wait();
+      memcpy(buf, p, len);
+      cqueue_bytering_pop_slot_finish(args->q);
+    }
+    if (len != next_len(&state)) {
+      printf("Error: unexpected message length %zu\n", len);
+      exit(EXIT_FAILURE);
+    }
+    args->bytes += len;
+  }
+
+  pthread_exit(NULL);
+}
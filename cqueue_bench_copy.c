@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MIN_ELEM_SIZE 64
+#define MAX_ELEM_SIZE 16384
+#define CAPACITY 64
+
+// the copy strategies benchmarked, in output order
+struct strategy {
+  const char *name;
+  cqueue_copy copy;
+  uint32_t nt_threshold;
+  int prefetch;
+};
+
+static const struct strategy strategies[] = {
+  { "memcpy",   CQUEUE_COPY_MEMCPY, 0, 0 },
+  { "sse2",     CQUEUE_COPY_SSE2, 0, 0 },
+  { "avx2",     CQUEUE_COPY_AVX2, 0, 0 },
+  { "nt",       CQUEUE_COPY_NT, 0, 0 },
+  { "auto",     CQUEUE_COPY_AUTO, CQUEUE_NT_THRESHOLD, 0 },
+  { "auto+pf",  CQUEUE_COPY_AUTO, CQUEUE_NT_THRESHOLD, 1 },
+};
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t limit;
+  size_t elem_size;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *q;
+  size_t elem_size, s;
+  uint64_t limit;
+  long passes;
+  double secs;
+
+  passes = bench_passes(argc, argv);
+
+  printf("%-6s %-8s %14s %14s %14s\n", "size", "copy", "seconds", "ns/msg",
+         "GB/s");
+  for (elem_size = MIN_ELEM_SIZE; elem_size <= MAX_ELEM_SIZE; elem_size *= 4) {
+    // move the same number of bytes at every size
+    limit = passes * MIN_ELEM_SIZE / elem_size;
+    if (!limit)
+      limit = 1;
+
+    for (s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+      q = cqueue_spsc_new(CAPACITY, elem_size);
+      if (!q)
+        bench_fail("cqueue_spsc_new failed");
+      if (cqueue_spsc_set_copy(q, strategies[s].copy,
+                               strategies[s].nt_threshold,
+                               strategies[s].prefetch)) {
+        printf("%-6zu %-8s %14s\n", elem_size, strategies[s].name,
+               "unsupported");
+        cqueue_spsc_delete(&q);
+        continue;
+      }
+
+      pargs.q = cargs.q = q;
+      pargs.limit = cargs.limit = limit;
+      pargs.elem_size = cargs.elem_size = elem_size;
+      cargs.sum = 0;
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(limit));
+
+      printf("%-6zu %-8s %14.6f %14.3f %14.3f\n", elem_size,
+             strategies[s].name, secs, secs * 1e9 / limit,
+             limit * elem_size / secs / 1e9);
+
+      cqueue_spsc_delete(&q);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  unsigned char *buf;
+  uint64_t data;
+
+  buf = calloc(1, args->elem_size);
+  if (!buf)
+    bench_fail("calloc failed");
+
+  // the first 8 bytes of every element carry the sequence number
+  for (data=1; data <= args->limit; data++) {
+    memcpy(buf, &data, sizeof(data));
+    while (cqueue_spsc_trypush(args->q, buf, args->elem_size))
+      bench_wait();
+  }
+
+  free(buf);
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  unsigned char *buf;
+  uint64_t data;
+  uint64_t i;
+
+  buf = malloc(args->elem_size);
+  if (!buf)
+    bench_fail("malloc failed");
+
+  for (i=0; i < args->limit; i++) {
+    while (cqueue_spsc_trypop(args->q, buf, args->elem_size))
+      bench_wait();
+    memcpy(&data, buf, sizeof(data));
+    args->sum += data;
+  }
+
+  free(buf);
+  pthread_exit(NULL);
+}
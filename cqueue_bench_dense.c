@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MAX_ELEM_SIZE 256
+#define CAPACITY 4096
+
+typedef enum {
+  SPSC,
+  SPSC_DENSE
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  void *q;
+  uint64_t limit;
+  size_t elem_size;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *sq;
+  cqueue_spsc_dense *dq;
+  size_t elem_size, footprint;
+  long passes;
+  double secs;
+  queue_type type;
+
+  passes = bench_passes(argc, argv);
+
+  printf("%-6s %-8s %14s %14s %14s\n", "size", "queue", "array bytes",
+         "seconds", "ns/msg");
+  for (elem_size = 4; elem_size <= MAX_ELEM_SIZE; elem_size *= 2) {
+    for (type = SPSC; type <= SPSC_DENSE; type++) {
+      sq = NULL;
+      dq = NULL;
+      if (type == SPSC) {
+        sq = cqueue_spsc_new(CAPACITY, elem_size);
+        footprint = sq ? sq->capacity * sq->elem_size : 0;
+        pargs.q = cargs.q = sq;
+      } else {
+        dq = cqueue_spsc_dense_new(CAPACITY, elem_size);
+        footprint = dq ? dq->capacity * dq->elem_size : 0;
+        pargs.q = cargs.q = dq;
+      }
+      if (!pargs.q)
+        bench_fail("queue allocation failed");
+
+      pargs.type = cargs.type = type;
+      pargs.limit = cargs.limit = passes;
+      pargs.elem_size = cargs.elem_size = elem_size;
+      cargs.sum = 0;
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+      printf("%-6zu %-8s %14zu %14.6f %14.3f\n", elem_size,
+             type == SPSC ? "spsc" : "dense", footprint, secs,
+             secs * 1e9 / passes);
+
+      cqueue_spsc_delete(&sq);
+      cqueue_spsc_dense_delete(&dq);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  unsigned char buf[MAX_ELEM_SIZE] = { 0 };
+  uint32_t data;
+  void *p;
+
+  // the first 4 bytes of every element carry the sequence number
+  for (data=1; data <= args->limit; data++) {
+    memcpy(buf, &data, sizeof(data));
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+        bench_wait();
+      memcpy(p, buf, args->elem_size);
+      cqueue_spsc_push_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_spsc_dense_trypush_slot(args->q)) == NULL)
+        bench_wait();
+      memcpy(p, buf, args->elem_size);
+      cqueue_spsc_dense_push_slot_finish(args->q);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  unsigned char buf[MAX_ELEM_SIZE];
+  uint32_t data;
+  uint64_t i;
+  void *p;
+
+  for (i=0; i < args->limit; i++) {
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      memcpy(buf, p, args->elem_size);
+      cqueue_spsc_pop_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_spsc_dense_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      memcpy(buf, p, args->elem_size);
+      cqueue_spsc_dense_pop_slot_finish(args->q);
+    }
+    memcpy(&data, buf, sizeof(data));
+    args->sum += data;
+  }
+
+  pthread_exit(NULL);
+}
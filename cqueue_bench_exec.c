@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>     // sysconf
+#include <inttypes.h>   // PRIu64
+#include "cqueue_exec.h"
+#include "cqueue_bench.h"
+
+#define CAPACITY 4096
+#define FIB_N 30
+#define FIB_CUTOFF 12
+#define GRAIN 256       // elements per parallel-for leaf
+#define RUNS 3
+
+typedef enum {
+  FIB,
+  PFOR
+} workload;
+
+struct fib_args {
+  unsigned n;
+  uint64_t result;
+  _Atomic size_t *pending;
+};
+
+struct pfor_args {
+  size_t lo;
+  size_t hi;
+  _Atomic size_t *pending;
+};
+
+static cqueue_exec *exec;
+static uint64_t *out;
+
+static double run(workload w, size_t n);
+static void fib_task(void *arg);
+static uint64_t fib(unsigned n);
+static uint64_t fib_serial(unsigned n);
+static void pfor_task(void *arg);
+static void pfor(size_t lo, size_t hi);
+static uint64_t work(uint64_t i);
+
+int main(int argc, char** argv) {
+  static const char *workloads[] = { "fib", "pfor" };
+  size_t n_workers, max_workers;
+  double secs, best;
+  long passes;
+  workload w;
+  int mode, r;
+
+  passes = bench_passes(argc, argv);
+
+  // parallel-for writes one element per pass
+  out = malloc(passes * sizeof(uint64_t));
+  if (!out)
+    bench_fail("malloc failed");
+
+  max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_workers < 2)
+    max_workers = 2;
+
+  printf("%-6s %-8s %8s %14s\n", "work", "queue", "workers", "seconds");
+  for (w = FIB; w <= PFOR; w++) {
+    for (mode = CQUEUE_EXEC_STEAL; mode <= CQUEUE_EXEC_SHARED; mode++) {
+      for (n_workers = 1; n_workers <= max_workers; n_workers *= 2) {
+        exec = cqueue_exec_new(n_workers, CAPACITY, mode);
+        if (!exec)
+          bench_fail("cqueue_exec_new failed");
+
+        best = 0;
+        for (r = 0; r < RUNS; r++) {
+          secs = run(w, passes);
+          if (!r || secs < best)
+            best = secs;
+        }
+        printf("%-6s %-8s %8zu %14.6f\n", workloads[w],
+               mode == CQUEUE_EXEC_STEAL ? "steal" : "shared", n_workers, best);
+
+        cqueue_exec_delete(&exec);
+      }
+    }
+  }
+
+  free(out);
+  exit(EXIT_SUCCESS);
+}
+
+/*! Run a workload from outside the pool and check its result
+
+  \returns the elapsed seconds
+*/
+double run(workload w, size_t n) {
+  uint64_t sum = 0, expected = 0;
+  double start, secs;
+
+  start = bench_seconds();
+  if (w == FIB) {
+    sum = fib(FIB_N);
+  } else {
+    pfor(0, n);
+  }
+  secs = bench_seconds() - start;
+
+  if (w == FIB) {
+    expected = fib_serial(FIB_N);
+  } else {
+    for (size_t i=0; i < n; i++) {
+      sum += out[i];
+      expected += work(i);
+    }
+  }
+  bench_check_sum(sum, expected);
+
+  return secs;
+}
+
+void fib_task(void *arg) {
+  struct fib_args *a = arg;
+
+  a->result = fib(a->n);
+  atomic_fetch_sub_explicit(a->pending, 1, memory_order_release);
+}
+
+// fork fib(n-1), compute fib(n-2) here, then join
+uint64_t fib(unsigned n) {
+  _Atomic size_t pending;
+  struct fib_args child;
+  uint64_t result;
+
+  if (n < FIB_CUTOFF)
+    return fib_serial(n);
+
+  atomic_init(&pending, 1);
+  child.n = n - 1;
+  child.pending = &pending;
+  cqueue_exec_submit(exec, fib_task, &child);
+  result = fib(n - 2);
+  cqueue_exec_wait(exec, &pending);
+  return result + child.result;
+}
+
+uint64_t fib_serial(unsigned n) {
+  return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+void pfor_task(void *arg) {
+  struct pfor_args *a = arg;
+
+  pfor(a->lo, a->hi);
+  atomic_fetch_sub_explicit(a->pending, 1, memory_order_release);
+}
+
+// split the range in halves down to GRAIN, forking the upper half
+void pfor(size_t lo, size_t hi) {
+  _Atomic size_t pending;
+  struct pfor_args child;
+  size_t i;
+
+  if (hi - lo <= GRAIN) {
+    for (i=lo; i < hi; i++)
+      out[i] = work(i);
+    return;
+  }
+
+  atomic_init(&pending, 1);
+  child.lo = lo + (hi - lo) / 2;
+  child.hi = hi;
+  child.pending = &pending;
+  cqueue_exec_submit(exec, pfor_task, &child);
+  pfor(lo, child.lo);
+  cqueue_exec_wait(exec, &pending);
+}
+
+// a few dozen cycles of integer mixing per element
+uint64_t work(uint64_t i) {
+  for (int r=0; r < 8; r++) {
+    i ^= i >> 33;
+    i *= 0xff51afd7ed558ccdULL;
+  }
+  return i;
+}
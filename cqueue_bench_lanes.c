@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define BULK_CAPACITY 65536
+#define CONTROL_CAPACITY 64
+#define CONTROL_EVERY 1024  // one control message per this many messages
+#define WORK 64             // consumer spin iterations per bulk message
+
+typedef enum {
+  FIFO,           // one cqueue_spsc for both kinds of messages
+  STRICT,         // cqueue_lanes, control lane first
+  WRR             // cqueue_lanes, weighted round robin
+} queue_type;
+
+static const char *type_names[] = { "fifo", "strict", "wrr" };
+
+// stamp is the push time of a control message, 0 for bulk messages
+struct msg {
+  uint64_t stamp;
+  uint64_t data;
+};
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  uint64_t limit;
+  uint64_t sum;
+  uint64_t *lat;          // control message latencies
+  size_t n_lat;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+static cqueue_spsc *fifo;
+static cqueue_lanes *lanes;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  const size_t capacities[] = { CONTROL_CAPACITY, BULK_CAPACITY };
+  const unsigned weights[] = { 1, 16 };
+  queue_type type;
+  uint64_t *lat;
+  long passes;
+  size_t n;
+
+  passes = bench_passes(argc, argv);
+
+  lat = malloc((passes / CONTROL_EVERY + 1) * sizeof(uint64_t));
+  if (!lat)
+    bench_fail("malloc failed");
+
+  // the consumer is slower than the producer, so the bulk backlog grows
+  // until the producer waits on it
+  printf("%-6s %10s %14s %14s %14s\n", "queue", "controls", "p50 us",
+         "p99 us", "max us");
+  for (type = FIFO; type <= WRR; type++) {
+    fifo = NULL;
+    lanes = NULL;
+    if (type == FIFO)
+      fifo = cqueue_spsc_new(BULK_CAPACITY, sizeof(struct msg));
+    else
+      lanes = cqueue_lanes_new(2, capacities, sizeof(struct msg),
+                               type == STRICT ? CQUEUE_LANES_STRICT
+                                              : CQUEUE_LANES_WRR, weights);
+    if (!fifo && !lanes)
+      bench_fail("queue allocation failed");
+
+    pargs.type = cargs.type = type;
+    pargs.limit = cargs.limit = passes;
+    cargs.sum = 0;
+    cargs.lat = lat;
+    cargs.n_lat = 0;
+
+    bench_run_pair(&producer, &pargs, &consumer, &cargs);
+    bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+    n = cargs.n_lat;
+    qsort(lat, n, sizeof(*lat), &bench_cmp_u64);
+    if (n)
+      printf("%-6s %10zu %14.3f %14.3f %14.3f\n", type_names[type], n,
+             lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+
+    cqueue_spsc_delete(&fifo);
+    cqueue_lanes_delete(&lanes);
+  }
+
+  free(lat);
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  struct msg *p;
+  uint64_t data;
+  size_t lane;
+
+  for (data=1; data <= args->limit; data++) {
+    lane = data % CONTROL_EVERY == 0 ? 0 : 1;
+    if (args->type == FIFO) {
+      while ((p = cqueue_spsc_trypush_slot(fifo)) == NULL)
+        bench_wait();
+    } else {
+      while ((p = cqueue_lanes_trypush_slot(lanes, lane)) == NULL)
+        bench_wait();
+    }
+    p->stamp = lane ? 0 : bench_now_ns();
+    p->data = data;
+    if (args->type == FIFO)
+      cqueue_spsc_push_slot_finish(fifo);
+    else
+      cqueue_lanes_push_slot_finish(lanes, lane);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  volatile uint64_t spin;
+  struct msg *p;
+  uint64_t i;
+
+  for (i=0; i < args->limit; i++) {
+    if (args->type == FIFO) {
+      while ((p = cqueue_spsc_trypop_slot(fifo)) == NULL)
+        bench_wait();
+    } else {
+      while ((p = cqueue_lanes_trypop_slot(lanes, NULL)) == NULL)
+        bench_wait();
+    }
+
+    if (p->stamp)
+      args->lat[args->n_lat++] = bench_now_ns() - p->stamp;
+    else
+      for (spin=0; spin < WORK; spin++);
+    args->sum += p->data;
+
+    if (args->type == FIFO)
+      cqueue_spsc_pop_slot_finish(fifo);
+    else
+      cqueue_lanes_pop_slot_finish(lanes);
+  }
+
+  pthread_exit(NULL);
+}
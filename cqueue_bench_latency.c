@@ -0,0 +1,117 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define CAPACITY 1024
+#define RUNS 3
+
+// the sampling setups benchmarked, in output order
+struct setup {
+  const char *name;
+  size_t period;          // 0 for no sampling
+  cqueue_clock clock;
+};
+
+static const struct setup setups[] = {
+  { "off",       0, CQUEUE_CLOCK_MONOTONIC },
+  { "mono/1024", 1024, CQUEUE_CLOCK_MONOTONIC },
+  { "tsc/1024",  1024, CQUEUE_CLOCK_TSC },
+  { "mono/1",    1, CQUEUE_CLOCK_MONOTONIC },
+};
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t limit;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  cqueue_hist hist;
+  cqueue_spsc *q;
+  double secs, best;
+  long passes;
+  size_t s;
+  int run;
+
+  passes = bench_passes(argc, argv);
+
+  // the delays are in ns for mono and in cycles for tsc
+  printf("%-10s %14s %10s %12s %12s %12s\n", "sampling", "ns/msg", "samples",
+         "p50", "p99", "max");
+  for (s = 0; s < sizeof(setups) / sizeof(setups[0]); s++) {
+    best = 0;
+    for (run = 0; run < RUNS; run++) {
+      q = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+      if (!q)
+        bench_fail("cqueue_spsc_new failed");
+      if (setups[s].period &&
+          cqueue_spsc_enable_latency(q, setups[s].period, setups[s].clock)) {
+        printf("%-10s %14s\n", setups[s].name, "unsupported");
+        cqueue_spsc_delete(&q);
+        break;
+      }
+
+      pargs.q = cargs.q = q;
+      pargs.limit = cargs.limit = passes;
+      cargs.sum = 0;
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+      if (!run || secs < best) {
+        best = secs;
+        cqueue_spsc_get_latency(q, &hist);
+      }
+      cqueue_spsc_delete(&q);
+    }
+    if (run < RUNS)
+      continue;
+
+    printf("%-10s %14.3f %10" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+           "\n", setups[s].name, best * 1e9 / passes, hist.count,
+           cqueue_hist_percentile(&hist, 0.5),
+           cqueue_hist_percentile(&hist, 0.99), hist.max);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data;
+  uint64_t *p;
+
+  for (data=1; data <= args->limit; data++) {
+    while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+      bench_wait();
+    *p = data;
+    cqueue_spsc_push_slot_finish(args->q);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t i;
+  uint64_t *p;
+
+  for (i=0; i < args->limit; i++) {
+    while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+      bench_wait();
+    args->sum += *p;
+    cqueue_spsc_pop_slot_finish(args->q);
+  }
+
+  pthread_exit(NULL);
+}
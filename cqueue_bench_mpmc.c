@@ -0,0 +1,153 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MAX_THREADS 16
+#define CAPACITY 1024
+
+typedef enum {
+  MPMC,
+  SPSC_MUTEX
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  uint64_t limit;
+  uint64_t sum;
+  int id;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args targs[MAX_THREADS];
+static pthread_t threads[MAX_THREADS];
+
+// the queues under test: a lockless mpmc queue, and the spsc queue wrapped
+// in a mutex that it is meant to replace
+static cqueue_mpmc *mq;
+static cqueue_spsc *sq;
+static pthread_mutex_t sq_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+static double run(queue_type type, int n_threads, uint64_t limit);
+
+int main(int argc, char** argv) {
+  int n_threads;
+  long passes;
+  double secs;
+
+  passes = bench_passes(argc, argv);
+
+  mq = cqueue_mpmc_new(CAPACITY, sizeof(uint64_t));
+  sq = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+  if (!mq || !sq)
+    bench_fail("queue allocation failed");
+
+  printf("%-8s %-12s %14s %14s\n", "threads", "queue", "seconds", "Mmsgs/s");
+  for (n_threads = 2; n_threads <= MAX_THREADS; n_threads *= 2) {
+    uint64_t total = (uint64_t)passes * (n_threads/2);
+
+    secs = run(MPMC, n_threads, passes);
+    printf("%-8d %-12s %14.6f %14.3f\n", n_threads, "mpmc", secs,
+           total / secs / 1e6);
+
+    secs = run(SPSC_MUTEX, n_threads, passes);
+    printf("%-8d %-12s %14.6f %14.3f\n", n_threads, "spsc+mutex", secs,
+           total / secs / 1e6);
+  }
+
+  cqueue_mpmc_delete(&mq);
+  cqueue_spsc_delete(&sq);
+  exit(EXIT_SUCCESS);
+}
+
+/*! Run n_threads/2 producers and as many consumers, each of which pushes
+  (pops respectively) limit elements, and check that everything arrived
+*/
+static double run(queue_type type, int n_threads, uint64_t limit) {
+  uint64_t sum = 0;
+  double start, secs;
+  int i;
+
+  start = bench_seconds();
+  for (i=0; i < n_threads; i++) {
+    targs[i].id = i;
+    targs[i].type = type;
+    targs[i].limit = limit;
+    targs[i].sum = 0;
+    if (pthread_create(&threads[i], NULL, i % 2 ? &consumer : &producer,
+                       &targs[i]))
+      bench_fail("pthread_create failed");
+  }
+
+  for (i=0; i < n_threads; i++) {
+    pthread_join(threads[i], NULL);
+    if (i % 2)
+      sum += targs[i].sum;
+  }
+  secs = bench_seconds() - start;
+
+  // every producer pushes 1..limit
+  bench_check_sum(sum, (n_threads/2) * bench_sum_to(limit));
+  return secs;
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data;
+  uint64_t *p;
+
+  for (data=1; data <= args->limit; data++) {
+    if (args->type == MPMC) {
+      while ((p = cqueue_mpmc_trypush_slot(mq)) == NULL)
+        bench_wait();
+      *p = data;
+      cqueue_mpmc_push_slot_finish(mq, p);
+    } else {
+      while (1) {
+        pthread_mutex_lock(&sq_lock);
+        if ((p = cqueue_spsc_trypush_slot(sq)) != NULL)
+          break;
+        pthread_mutex_unlock(&sq_lock);
+        bench_wait();
+      }
+      *p = data;
+      cqueue_spsc_push_slot_finish(sq);
+      pthread_mutex_unlock(&sq_lock);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t i;
+  uint64_t *p;
+
+  for (i=0; i < args->limit; i++) {
+    if (args->type == MPMC) {
+      while ((p = cqueue_mpmc_trypop_slot(mq)) == NULL)
+        bench_wait();
+      args->sum += *p;
+      cqueue_mpmc_pop_slot_finish(mq, p);
+    } else {
+      while (1) {
+        pthread_mutex_lock(&sq_lock);
+        if ((p = cqueue_spsc_trypop_slot(sq)) != NULL)
+          break;
+        pthread_mutex_unlock(&sq_lock);
+        bench_wait();
+      }
+      args->sum += *p;
+      cqueue_spsc_pop_slot_finish(sq);
+      pthread_mutex_unlock(&sq_lock);
+    }
+  }
+
+  pthread_exit(NULL);
+}
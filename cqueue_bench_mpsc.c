@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MAX_PRODUCERS 16
+#define CAPACITY 1024
+
+typedef enum {
+  MPSC,
+  SPSC_PER_PRODUCER
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  uint64_t limit;
+  uint64_t sum;
+  int id;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args targs[MAX_PRODUCERS + 1];
+static pthread_t threads[MAX_PRODUCERS + 1];
+
+// the queues under test: one mpsc queue shared by every producer, or one
+// spsc queue per producer that the consumer polls round-robin
+static cqueue_mpsc *mq;
+static cqueue_spsc *sqs[MAX_PRODUCERS];
+static int n_producers;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+static double run(queue_type type, uint64_t limit);
+
+int main(int argc, char** argv) {
+  long passes;
+  double secs;
+  int i;
+
+  passes = bench_passes(argc, argv);
+
+  mq = cqueue_mpsc_new(CAPACITY, sizeof(uint64_t));
+  if (!mq)
+    bench_fail("cqueue_mpsc_new failed");
+  for (i=0; i < MAX_PRODUCERS; i++) {
+    // same total capacity as the mpsc queue
+    sqs[i] = cqueue_spsc_new(CAPACITY/MAX_PRODUCERS, sizeof(uint64_t));
+    if (!sqs[i])
+      bench_fail("cqueue_spsc_new failed");
+  }
+
+  printf("%-10s %-14s %14s %14s\n", "producers", "queue", "seconds", "Mmsgs/s");
+  for (n_producers = 1; n_producers <= MAX_PRODUCERS; n_producers *= 2) {
+    uint64_t total = (uint64_t)passes * n_producers;
+
+    secs = run(MPSC, passes);
+    printf("%-10d %-14s %14.6f %14.3f\n", n_producers, "mpsc", secs,
+           total / secs / 1e6);
+
+    secs = run(SPSC_PER_PRODUCER, passes);
+    printf("%-10d %-14s %14.6f %14.3f\n", n_producers, "spsc-per-prod", secs,
+           total / secs / 1e6);
+  }
+
+  cqueue_mpsc_delete(&mq);
+  for (i=0; i < MAX_PRODUCERS; i++)
+    cqueue_spsc_delete(&sqs[i]);
+  exit(EXIT_SUCCESS);
+}
+
+/*! Run n_producers producers, each of which pushes limit elements, and a
+  single consumer, and check that everything arrived
+*/
+static double run(queue_type type, uint64_t limit) {
+  double start, secs;
+  int i;
+
+  start = bench_seconds();
+  for (i=0; i <= n_producers; i++) {
+    targs[i].id = i;
+    targs[i].type = type;
+    targs[i].limit = limit;
+    targs[i].sum = 0;
+    if (pthread_create(&threads[i], NULL,
+                       i == n_producers ? &consumer : &producer, &targs[i]))
+      bench_fail("pthread_create failed");
+  }
+
+  for (i=0; i <= n_producers; i++)
+    pthread_join(threads[i], NULL);
+  secs = bench_seconds() - start;
+
+  // every producer pushes 1..limit
+  bench_check_sum(targs[n_producers].sum, n_producers * bench_sum_to(limit));
+  return secs;
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  cqueue_spsc *sq = sqs[args->id];
+  uint64_t data;
+  uint64_t *p;
+
+  for (data=1; data <= args->limit; data++) {
+    if (args->type == MPSC) {
+      while ((p = cqueue_mpsc_trypush_slot(mq)) == NULL)
+        bench_wait();
+      *p = data;
+      cqueue_mpsc_push_slot_finish(mq, p);
+    } else {
+      while ((p = cqueue_spsc_trypush_slot(sq)) == NULL)
+        bench_wait();
+      *p = data;
+      cqueue_spsc_push_slot_finish(sq);
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t remaining = args->limit * n_producers;
+  uint64_t *p;
+  int i = 0, misses = 0;
+
+  while (remaining) {
+    if (args->type == MPSC) {
+      p = cqueue_mpsc_trypop_slot(mq);
+      if (!p) {
+        bench_wait();
+        continue;
+      }
+      args->sum += *p;
+      cqueue_mpsc_pop_slot_finish(mq);
+      remaining--;
+    } else {
+      p = cqueue_spsc_trypop_slot(sqs[i]);
+      if (p) {
+        args->sum += *p;
+        cqueue_spsc_pop_slot_finish(sqs[i]);
+        remaining--;
+        misses = 0;
+      } else if (++misses == n_producers) {
+        // a full round found nothing
+        bench_wait();
+        misses = 0;
+      }
+      i = (i + 1) % n_producers;
+    }
+  }
+
+  pthread_exit(NULL);
+}
@@ -0,0 +1,164 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define MIN_PAYLOAD 4096
+#define MAX_PAYLOAD 262144
+#define CAPACITY 16
+
+typedef enum {
+  COPY,           // payloads copied into and out of cqueue_spsc slots
+  POOL            // payloads written in place, cqueue_pool
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  void *q;
+  uint64_t limit;
+  size_t payload;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+void fill(unsigned char *buf, size_t len, uint64_t data);
+uint64_t check(const unsigned char *buf, size_t len);
+
+int main(int argc, char** argv) {
+  queue_type type;
+  size_t payload;
+  uint64_t limit;
+  long passes;
+  double secs;
+  void *q;
+
+  passes = bench_passes(argc, argv);
+
+  printf("%-7s %-5s %14s %14s %14s\n", "payload", "queue", "seconds", "ns/msg",
+         "GB/s");
+  for (payload = MIN_PAYLOAD; payload <= MAX_PAYLOAD; payload *= 4) {
+    // move the same number of bytes at every size
+    limit = passes * 64 / payload;
+    if (!limit)
+      limit = 1;
+
+    for (type = COPY; type <= POOL; type++) {
+      if (type == COPY)
+        q = cqueue_spsc_new(CAPACITY, payload);
+      else
+        q = cqueue_pool_new(CAPACITY, payload, NULL);
+      if (!q)
+        bench_fail("queue allocation failed");
+
+      pargs.type = cargs.type = type;
+      pargs.q = cargs.q = q;
+      pargs.limit = cargs.limit = limit;
+      pargs.payload = cargs.payload = payload;
+      cargs.sum = 0;
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(limit));
+
+      printf("%-7zu %-5s %14.6f %14.3f %14.3f\n", payload,
+             type == COPY ? "copy" : "pool", secs, secs * 1e9 / limit,
+             limit * payload / secs / 1e9);
+
+      if (type == COPY)
+        cqueue_spsc_delete((cqueue_spsc **)&q);
+      else
+        cqueue_pool_delete((cqueue_pool **)&q);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+/*! Write a payload as an application would: the sequence number, then
+ every cacheline touched
+*/
+void fill(unsigned char *buf, size_t len, uint64_t data) {
+  memcpy(buf, &data, sizeof(data));
+  for (size_t off = LEVEL1_DCACHE_LINESIZE; off < len;
+       off += LEVEL1_DCACHE_LINESIZE)
+    buf[off] = (unsigned char)data;
+}
+
+/*! Read a payload back, returning its sequence number
+*/
+uint64_t check(const unsigned char *buf, size_t len) {
+  uint64_t data;
+
+  memcpy(&data, buf, sizeof(data));
+  for (size_t off = LEVEL1_DCACHE_LINESIZE; off < len;
+       off += LEVEL1_DCACHE_LINESIZE)
+    if (buf[off] != (unsigned char)data)
+      bench_fail("corrupt payload");
+  return data;
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  unsigned char *buf = NULL;
+  uint64_t data;
+
+  if (args->type == COPY) {
+    buf = malloc(args->payload);
+    if (!buf)
+      bench_fail("malloc failed");
+  }
+
+  for (data=1; data <= args->limit; data++) {
+    if (args->type == COPY) {
+      fill(buf, args->payload, data);
+      while (cqueue_spsc_trypush(args->q, buf, args->payload))
+        bench_wait();
+    } else {
+      while ((buf = cqueue_pool_tryalloc(args->q)) == NULL)
+        bench_wait();
+      fill(buf, args->payload, data);
+      cqueue_pool_send(args->q, buf, args->payload);
+    }
+  }
+
+  if (args->type == COPY)
+    free(buf);
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  unsigned char *buf = NULL;
+  size_t len;
+  uint64_t i;
+
+  if (args->type == COPY) {
+    buf = malloc(args->payload);
+    if (!buf)
+      bench_fail("malloc failed");
+  }
+
+  for (i=0; i < args->limit; i++) {
+    if (args->type == COPY) {
+      while (cqueue_spsc_trypop(args->q, buf, args->payload))
+        bench_wait();
+      args->sum += check(buf, args->payload);
+    } else {
+      while ((buf = cqueue_pool_tryrecv(args->q, &len)) == NULL)
+        bench_wait();
+      args->sum += check(buf, len);
+      cqueue_pool_free(args->q, buf);
+    }
+  }
+
+  if (args->type == COPY)
+    free(buf);
+  pthread_exit(NULL);
+}
@@ -0,0 +1,163 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define QUEUES 1024
+#define PRODUCERS 4     // each owns QUEUES/PRODUCERS queues
+#define CAPACITY 64
+
+typedef enum {
+  POLL,           // trypop every queue in turn
+  SET             // cqueue_spsc_set
+} consumer_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc **qs;     // the thread's queues
+  size_t n_queues;
+  size_t active;        // the producer pushes to its first active queues
+  uint64_t limit;
+  uint64_t sum;
+  uint64_t empty;       // consumer trypops that came back empty
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs[PRODUCERS], cargs;
+static cqueue_spsc *qs[QUEUES];
+static cqueue_spsc_set *set;
+
+void *producer(void *targ);
+void *poll_consumer(void *targ);
+void *set_consumer(void *targ);
+
+int main(int argc, char** argv) {
+  static const size_t actives[] = { 16, QUEUES };
+  pthread_t pt[PRODUCERS], ct;
+  consumer_type type;
+  uint64_t expected;
+  size_t a, i;
+  long passes;
+  double start, secs;
+
+  passes = bench_passes(argc, argv);
+  passes -= passes % PRODUCERS;
+  expected = (uint64_t)passes / PRODUCERS * (passes / PRODUCERS + 1) / 2
+             * PRODUCERS;
+
+  printf("%-6s %8s %14s %14s %14s\n", "pop", "active", "seconds", "Mmsgs/s",
+         "empty/msg");
+  for (type = POLL; type <= SET; type++) {
+    for (a = 0; a < sizeof(actives) / sizeof(actives[0]); a++) {
+      set = type == SET ? cqueue_spsc_set_new(QUEUES) : NULL;
+      for (i = 0; i < QUEUES; i++) {
+        qs[i] = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+        if (!qs[i] || (set && cqueue_spsc_set_add(set, qs[i], 1) < 0))
+          bench_fail("queue setup failed");
+      }
+
+      for (i = 0; i < PRODUCERS; i++) {
+        pargs[i].n_queues = QUEUES / PRODUCERS;
+        pargs[i].qs = &qs[i * pargs[i].n_queues];
+        pargs[i].active = actives[a] / PRODUCERS;
+        pargs[i].limit = passes / PRODUCERS;
+      }
+      cargs.qs = qs;
+      cargs.n_queues = QUEUES;
+      cargs.limit = passes;
+      cargs.sum = 0;
+      cargs.empty = 0;
+
+      start = bench_seconds();
+      if (pthread_create(&ct, NULL,
+                         type == SET ? &set_consumer : &poll_consumer, &cargs))
+        bench_fail("pthread_create failed");
+      for (i = 0; i < PRODUCERS; i++)
+        if (pthread_create(&pt[i], NULL, &producer, &pargs[i]))
+          bench_fail("pthread_create failed");
+      for (i = 0; i < PRODUCERS; i++)
+        pthread_join(pt[i], NULL);
+      pthread_join(ct, NULL);
+      secs = bench_seconds() - start;
+      bench_check_sum(cargs.sum, expected);
+
+      printf("%-6s %8zu %14.6f %14.3f %14.2f\n", type == SET ? "set" : "poll",
+             actives[a], secs, passes / secs / 1e6,
+             (double)cargs.empty / passes);
+
+      cqueue_spsc_set_delete(&set);
+      for (i = 0; i < QUEUES; i++)
+        cqueue_spsc_delete(&qs[i]);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data, rng = (uintptr_t)targ | 1;
+  uint64_t *p;
+  cqueue_spsc *q;
+
+  for (data=1; data <= args->limit; data++) {
+    // spread the messages over the active queues
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    q = args->qs[rng % args->active];
+    while ((p = cqueue_spsc_trypush_slot(q)) == NULL)
+      bench_wait();
+    *p = data;
+    cqueue_spsc_push_slot_finish(q);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *poll_consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t i = 0, found;
+  uint64_t *p;
+  size_t n;
+
+  while (i < args->limit) {
+    found = 0;
+    for (n=0; n < args->n_queues; n++) {
+      if ((p = cqueue_spsc_trypop_slot(args->qs[n])) == NULL) {
+        args->empty++;
+        continue;
+      }
+      args->sum += *p;
+      cqueue_spsc_pop_slot_finish(args->qs[n]);
+      found++;
+    }
+    i += found;
+    if (!found)
+      bench_wait();
+  }
+
+  pthread_exit(NULL);
+}
+
+void *set_consumer(void *targ) {
+  struct thread_args *args = targ;
+  cqueue_spsc *q;
+  uint64_t i = 0;
+  uint64_t *p;
+
+  while (i < args->limit) {
+    if ((p = cqueue_spsc_set_trypop_slot(set, &q)) == NULL) {
+      args->empty++;
+      bench_wait();
+      continue;
+    }
+    args->sum += *p;
+    cqueue_spsc_pop_slot_finish(q);
+    i++;
+  }
+
+  pthread_exit(NULL);
+}
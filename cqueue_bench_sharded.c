@@ -0,0 +1,107 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue_sharded.h"
+#include "cqueue_bench.h"
+
+#define MAX_CONSUMERS 32
+#define CAPACITY 256
+#define KEYS 1024
+
+static const char *policy_names[] = { "rr", "hash", "least" };
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t sum;
+  uint64_t count;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args cargs[MAX_CONSUMERS];
+
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  pthread_t ct[MAX_CONSUMERS];
+  cqueue_sharded_policy policy;
+  cqueue_sharded *s;
+  uint64_t data, sum, most;
+  uint64_t *p;
+  size_t n, i, shard;
+  long passes;
+  double start, secs;
+
+  passes = bench_passes(argc, argv);
+
+  // max/avg is the share of the busiest consumer relative to a fair one
+  printf("%-6s %10s %14s %14s %14s\n", "policy", "consumers", "seconds",
+         "Mmsgs/s", "max/avg");
+  for (policy = CQUEUE_SHARDED_ROUND_ROBIN;
+       policy <= CQUEUE_SHARDED_LEAST_LOADED; policy++) {
+    for (n = 1; n <= MAX_CONSUMERS; n *= 2) {
+      s = cqueue_sharded_new(n, CAPACITY, sizeof(uint64_t), policy,
+                             policy != CQUEUE_SHARDED_HASH);
+      if (!s)
+        bench_fail("cqueue_sharded_new failed");
+
+      start = bench_seconds();
+      for (i = 0; i < n; i++) {
+        cargs[i].q = cqueue_sharded_get_shard(s, i);
+        cargs[i].sum = cargs[i].count = 0;
+        if (pthread_create(&ct[i], NULL, &consumer, &cargs[i]))
+          bench_fail("pthread_create failed");
+      }
+      for (data=1; data <= (uint64_t)passes; data++) {
+        while ((p = cqueue_sharded_trypush_slot(s, data % KEYS, &shard))
+               == NULL)
+          bench_wait();
+        *p = data;
+        cqueue_sharded_push_slot_finish(s, shard);
+      }
+      // element 0 tells a consumer to stop
+      for (i = 0; i < n; i++) {
+        while ((p = cqueue_spsc_trypush_slot(cargs[i].q)) == NULL)
+          bench_wait();
+        *p = 0;
+        cqueue_spsc_push_slot_finish(cargs[i].q);
+      }
+      sum = most = 0;
+      for (i = 0; i < n; i++) {
+        pthread_join(ct[i], NULL);
+        sum += cargs[i].sum;
+        if (cargs[i].count > most)
+          most = cargs[i].count;
+      }
+      secs = bench_seconds() - start;
+      bench_check_sum(sum, bench_sum_to(passes));
+
+      printf("%-6s %10zu %14.6f %14.3f %14.2f\n", policy_names[policy], n,
+             secs, passes / secs / 1e6, (double)most * n / passes);
+
+      cqueue_sharded_delete(&s);
+    }
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data;
+  uint64_t *p;
+
+  while (1) {
+    while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+      bench_wait();
+    data = *p;
+    cqueue_spsc_pop_slot_finish(args->q);
+    if (!data)
+      break;
+    args->sum += data;
+    args->count++;
+  }
+
+  pthread_exit(NULL);
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>     // fork, close
+#include <sys/mman.h>   // memfd_create
+#include <sys/wait.h>   // waitpid
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+/*! Ping-pong between two processes over a pair of shared memory queues and
+  report the round trip latency percentiles
+*/
+int main(int argc, char** argv) {
+  cqueue_spsc *ping, *pong;
+  uint64_t *lat, *p, t;
+  long passes, i;
+  int fd_ping, fd_pong, status;
+  pid_t pid;
+
+  passes = bench_passes(argc, argv);
+
+  fd_ping = memfd_create("cqueue_bench_shm_ping", 0);
+  fd_pong = memfd_create("cqueue_bench_shm_pong", 0);
+  ping = cqueue_spsc_new_shm_fd(fd_ping, 2, sizeof(uint64_t));
+  pong = cqueue_spsc_new_shm_fd(fd_pong, 2, sizeof(uint64_t));
+  lat = malloc(passes * sizeof(*lat));
+  if (!ping || !pong || !lat)
+    bench_fail("queue setup failed");
+
+  // don't let the child flush a copy of our buffered output
+  fflush(stdout);
+  pid = fork();
+  if (!pid) {
+    // echo side, attached through the inherited fds
+    cqueue_spsc_delete(&ping);
+    cqueue_spsc_delete(&pong);
+    ping = cqueue_spsc_attach_shm_fd(fd_ping, sizeof(uint64_t));
+    pong = cqueue_spsc_attach_shm_fd(fd_pong, sizeof(uint64_t));
+    if (!ping || !pong)
+      exit(EXIT_FAILURE);
+
+    for (i=0; i < passes; i++) {
+      while ((p = cqueue_spsc_trypop_slot(ping)) == NULL)
+        bench_wait();
+      t = *p;
+      cqueue_spsc_pop_slot_finish(ping);
+
+      while ((p = cqueue_spsc_trypush_slot(pong)) == NULL)
+        bench_wait();
+      *p = t;
+      cqueue_spsc_push_slot_finish(pong);
+    }
+    exit(EXIT_SUCCESS);
+  }
+
+  for (i=0; i < passes; i++) {
+    while ((p = cqueue_spsc_trypush_slot(ping)) == NULL)
+      bench_wait();
+    *p = bench_now_ns();
+    cqueue_spsc_push_slot_finish(ping);
+
+    while ((p = cqueue_spsc_trypop_slot(pong)) == NULL)
+      bench_wait();
+    lat[i] = bench_now_ns() - *p;
+    cqueue_spsc_pop_slot_finish(pong);
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS)
+    bench_fail("echo process failed");
+
+  qsort(lat, passes, sizeof(*lat), &bench_cmp_u64);
+  printf("%-8s %14s\n", "pctl", "rtt ns");
+  printf("%-8s %14lu\n", "min", (unsigned long)lat[0]);
+  printf("%-8s %14lu\n", "p50", (unsigned long)lat[passes / 2]);
+  printf("%-8s %14lu\n", "p99", (unsigned long)lat[passes * 99 / 100]);
+  printf("%-8s %14lu\n", "max", (unsigned long)lat[passes - 1]);
+
+  free(lat);
+  cqueue_spsc_delete(&ping);
+  cqueue_spsc_delete(&pong);
+  close(fd_ping);
+  close(fd_pong);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define CAPACITY 1024
+#define RUNS 5
+
+typedef enum {
+  INDICES,        // occupancy derived from push_idx and pop_idx
+  SHARED_RMW      // plus the shared counter cqueue_spsc used to keep
+} bench_mode;
+
+/*! The n_used_slots counter cqueue_spsc kept before occupancy was derived
+ from the indices, which both sides updated with an atomic read-modify-write
+ on every push and pop. Updating it along with the queue reproduces the
+ baseline the change was measured against.
+*/
+struct shared_counter {
+  _Alignas(LEVEL1_DCACHE_LINESIZE) _Atomic size_t n_used_slots;
+};
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  bench_mode mode;
+  cqueue_spsc *q;
+  uint64_t limit;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+static struct shared_counter shared;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  static const char *names[] = { "indices", "rmw" };
+  cqueue_spsc *q;
+  bench_mode mode;
+  long passes;
+  double secs, best;
+  int run;
+
+  passes = bench_passes(argc, argv);
+
+  q = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+  if (!q)
+    bench_fail("cqueue_spsc_new failed");
+
+  printf("%-8s %-6s %14s %14s\n", "mode", "run", "seconds", "Mmsgs/s");
+  for (mode = INDICES; mode <= SHARED_RMW; mode++) {
+    best = 0;
+    for (run = 0; run < RUNS; run++) {
+      pargs.mode = cargs.mode = mode;
+      pargs.q = cargs.q = q;
+      pargs.limit = cargs.limit = passes;
+      cargs.sum = 0;
+      atomic_store(&shared.n_used_slots, 0);
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+      if (!run || secs < best)
+        best = secs;
+      printf("%-8s %-6d %14.6f %14.3f\n", names[mode], run, secs,
+             passes / secs / 1e6);
+    }
+    printf("%-8s %-6s %14.6f %14.3f\n", names[mode], "best", best,
+           passes / best / 1e6);
+  }
+
+#ifdef CQUEUE_STATS
+  // this binary is built against the library with CQUEUE_STATS, compare
+  // with cqueue_bench_spsc for the cost of keeping the counters
+  cqueue_spsc_stats stats;
+  cqueue_spsc_get_stats(q, &stats);
+  printf("pushes %" PRIu64 ", pops %" PRIu64 ", full %" PRIu64 ", empty %"
+         PRIu64 ", high water %" PRIu64 "\n", stats.pushes, stats.pops,
+         stats.push_full, stats.pop_empty, stats.high_water);
+#endif
+
+  cqueue_spsc_delete(&q);
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data;
+  uint64_t *p;
+
+  for (data=1; data <= args->limit; data++) {
+    while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+      bench_wait();
+    *p = data;
+    cqueue_spsc_push_slot_finish(args->q);
+    if (args->mode == SHARED_RMW)
+      atomic_fetch_add_explicit(&shared.n_used_slots, 1, memory_order_relaxed);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t i;
+  uint64_t *p;
+
+  for (i=0; i < args->limit; i++) {
+    while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+      bench_wait();
+    args->sum += *p;
+    cqueue_spsc_pop_slot_finish(args->q);
+    if (args->mode == SHARED_RMW)
+      atomic_fetch_sub_explicit(&shared.n_used_slots, 1, memory_order_relaxed);
+  }
+
+  pthread_exit(NULL);
+}
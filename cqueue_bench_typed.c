@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+#include "cqueue_typed.h"
+
+#define CAPACITY 1024
+#define RUNS 5
+
+CQUEUE_SPSC_DEFINE(u64_queue, uint64_t, CAPACITY)
+
+typedef enum {
+  SPSC,           // the out-of-line cqueue_spsc functions
+  TYPED           // CQUEUE_SPSC_DEFINE
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  void *q;
+  uint64_t limit;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *sq;
+  u64_queue *tq;
+  queue_type type;
+  long passes;
+  double secs, best;
+  int run;
+
+  passes = bench_passes(argc, argv);
+
+  sq = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+  tq = u64_queue_new();
+  if (!sq || !tq)
+    bench_fail("queue allocation failed");
+
+  printf("%-6s %14s %14s %14s\n", "queue", "seconds", "Mmsgs/s", "ns/msg");
+  for (type = SPSC; type <= TYPED; type++) {
+    best = 0;
+    for (run = 0; run < RUNS; run++) {
+      pargs.type = cargs.type = type;
+      pargs.q = cargs.q = type == SPSC ? (void *)sq : (void *)tq;
+      pargs.limit = cargs.limit = passes;
+      cargs.sum = 0;
+
+      secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+      bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+      if (!run || secs < best)
+        best = secs;
+    }
+    printf("%-6s %14.6f %14.3f %14.3f\n", type == SPSC ? "spsc" : "typed",
+           best, passes / best / 1e6, best * 1e9 / passes);
+  }
+
+  cqueue_spsc_delete(&sq);
+  u64_queue_delete(&tq);
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data;
+  uint64_t *p;
+
+  if (args->type == SPSC) {
+    for (data=1; data <= args->limit; data++) {
+      while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+        bench_wait();
+      *p = data;
+      cqueue_spsc_push_slot_finish(args->q);
+    }
+  } else {
+    for (data=1; data <= args->limit; data++)
+      while (u64_queue_trypush(args->q, data))
+        bench_wait();
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t i, data;
+  uint64_t *p;
+
+  if (args->type == SPSC) {
+    for (i=0; i < args->limit; i++) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      args->sum += *p;
+      cqueue_spsc_pop_slot_finish(args->q);
+    }
+  } else {
+    for (i=0; i < args->limit; i++) {
+      while (u64_queue_trypop(args->q, &data))
+        bench_wait();
+      args->sum += data;
+    }
+  }
+
+  pthread_exit(NULL);
+}
@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+#include "cqueue_bench.h"
+
+#define SEG_CAPACITY 1024
+#define BURST 100000      // elements pushed before the consumer starts
+
+typedef enum {
+  SPSC,
+  UNBOUNDED,
+  LIMITED           //!< unbounded, with a soft limit of LIMIT_SEGMENTS
+} queue_type;
+
+#define LIMIT_SEGMENTS 16
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  void *q;
+  uint64_t limit;
+  uint64_t sum;
+  double stall_secs;      //!< producer time spent on a full queue
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static struct thread_args pargs, cargs;
+static _Atomic int burst_done;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *sq;
+  cqueue_spsc_unbounded *uq;
+  long passes;
+  double secs;
+  queue_type type;
+
+  if (argc != 2 || (passes = atol(argv[1])) < BURST) {
+    printf("Error: %s requires an int parameter of at least %d that specifies the number of passes\n", argv[0], BURST);
+    exit(EXIT_FAILURE);
+  }
+
+  // a burst that overruns a bounded queue, then steady traffic
+  printf("%-10s %14s %14s %14s %14s\n", "queue", "seconds", "Mmsgs/s",
+         "stalled s", "allocated");
+  for (type = SPSC; type <= LIMITED; type++) {
+    sq = NULL;
+    uq = NULL;
+    if (type == SPSC)
+      pargs.q = cargs.q = sq = cqueue_spsc_new(SEG_CAPACITY, sizeof(uint64_t));
+    else
+      pargs.q = cargs.q = uq = cqueue_spsc_unbounded_new(SEG_CAPACITY,
+        sizeof(uint64_t), type == LIMITED ?
+        LIMIT_SEGMENTS * (SEG_CAPACITY + 1) * LEVEL1_DCACHE_LINESIZE : 0);
+    if (!pargs.q)
+      bench_fail("queue allocation failed");
+
+    pargs.type = cargs.type = type;
+    pargs.limit = cargs.limit = passes;
+    pargs.stall_secs = 0;
+    cargs.sum = 0;
+    atomic_store(&burst_done, 0);
+
+    secs = bench_run_pair(&producer, &pargs, &consumer, &cargs);
+    bench_check_sum(cargs.sum, bench_sum_to(passes));
+
+    printf("%-10s %14.6f %14.3f %14.6f %14zu\n",
+           type == SPSC ? "spsc" : type == UNBOUNDED ? "unbounded" : "limited",
+           secs, passes / secs / 1e6,
+           pargs.stall_secs, uq ? uq->n_allocated : 1);
+
+    cqueue_spsc_delete(&sq);
+    cqueue_spsc_unbounded_delete(&uq);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+static void *try_push(struct thread_args *args) {
+  if (args->type == SPSC)
+    return cqueue_spsc_trypush_slot(args->q);
+  return cqueue_spsc_unbounded_trypush_slot(args->q);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  double start;
+  uint64_t data;
+  uint64_t *p;
+
+  for (data=1; data <= args->limit; data++) {
+    if (data == BURST)
+      atomic_store(&burst_done, 1);
+
+    if ((p = try_push(args)) == NULL) {
+      // the bounded queue stalls the producer until the consumer catches up
+      atomic_store(&burst_done, 1);
+      start = bench_seconds();
+      while ((p = try_push(args)) == NULL)
+        bench_wait();
+      args->stall_secs += bench_seconds() - start;
+    }
+    *p = data;
+    if (args->type == SPSC)
+      cqueue_spsc_push_slot_finish(args->q);
+    else
+      cqueue_spsc_unbounded_push_slot_finish(args->q);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t i;
+  uint64_t *p;
+
+  while (!atomic_load(&burst_done))
+    bench_wait();
+
+  for (i=0; i < args->limit; i++) {
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      args->sum += *p;
+      cqueue_spsc_pop_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_spsc_unbounded_trypop_slot(args->q)) == NULL)
+        bench_wait();
+      args->sum += *p;
+      cqueue_spsc_unbounded_pop_slot_finish(args->q);
+    }
+  }
+
+  pthread_exit(NULL);
+}
@@ -0,0 +1,247 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+*/
+
+#include "cqueue_exec.h"
+#include "cqueue_internal.h"
+
+#include <sched.h>      // sched_yield
+
+//! failed rounds of looking for a task before an idle worker yields
+#define IDLE_SPINS 64
+
+//! the worker the calling thread runs, NULL outside any pool
+static _Thread_local cqueue_exec_worker *current;
+
+// private function declarations
+static void* worker_main(void *arg);
+static int run_one(cqueue_exec *e, cqueue_exec_worker *self);
+static int steal_one(cqueue_exec *e, cqueue_exec_worker *self,
+                     cqueue_task *task);
+static int inject(cqueue_exec *e, cqueue_task_fn fn, void *arg);
+static int inject_pop(cqueue_exec *e, cqueue_task *task);
+static inline uint64_t xorshift64(uint64_t *state);
+
+
+cqueue_exec* cqueue_exec_new(size_t n_workers, size_t capacity,
+                             cqueue_exec_mode mode) {
+  cqueue_exec_worker *w;
+  cqueue_exec *e;
+  size_t i;
+
+  if (!n_workers || n_workers > SIZE_MAX / sizeof(cqueue_exec_worker))
+    return NULL;
+
+  e = cacheline_alloc(sizeof(cqueue_exec));
+  if (!e)
+    return NULL;
+
+  e->n_workers = n_workers;
+  e->mode = mode;
+  atomic_init(&e->stop, 0);
+  e->inject = cqueue_mpmc_new(capacity, sizeof(cqueue_task));
+  e->workers = cacheline_alloc(n_workers * sizeof(cqueue_exec_worker));
+  if (e->workers)
+    for (i=0; i < n_workers; i++)
+      e->workers[i].deque = NULL;
+  if (!e->inject || !e->workers)
+    goto fail;
+
+  for (i=0; i < n_workers; i++) {
+    w = &e->workers[i];
+    w->exec = e;
+    w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+    if (mode == CQUEUE_EXEC_STEAL) {
+      w->deque = cqueue_deque_new(64 < capacity ? 64 : capacity, capacity);
+      if (!w->deque)
+        goto fail;
+    }
+  }
+
+  // all deques exist before any worker may try to steal from them
+  for (i=0; i < n_workers; i++) {
+    if (pthread_create(&e->workers[i].thread, NULL, worker_main,
+                       &e->workers[i])) {
+      atomic_store_explicit(&e->stop, 1, memory_order_relaxed);
+      while (i--)
+        pthread_join(e->workers[i].thread, NULL);
+      goto fail;
+    }
+  }
+  return e;
+
+fail:
+  if (e->workers) {
+    for (i=0; i < n_workers; i++)
+      cqueue_deque_delete(&e->workers[i].deque);
+    free(e->workers);
+  }
+  cqueue_mpmc_delete(&e->inject);
+  free(e);
+  return NULL;
+}
+
+void cqueue_exec_delete(cqueue_exec **p) {
+  cqueue_exec *e = *p;
+  size_t i;
+  if(!e)
+    return;
+
+  atomic_store_explicit(&e->stop, 1, memory_order_relaxed);
+  for (i=0; i < e->n_workers; i++)
+    pthread_join(e->workers[i].thread, NULL);
+
+  for (i=0; i < e->n_workers; i++)
+    cqueue_deque_delete(&e->workers[i].deque);
+  free(e->workers);
+  cqueue_mpmc_delete(&e->inject);
+  free(e);
+  *p = NULL;
+}
+
+void cqueue_exec_submit(cqueue_exec *e, cqueue_task_fn fn, void *arg) {
+  assert(e);
+  assert(fn);
+
+  cqueue_exec_worker *self = current;
+
+  if (!self || self->exec != e) {
+    while (inject(e, fn, arg))
+      sched_yield();
+    return;
+  }
+
+  if (self->deque ? cqueue_deque_push(self->deque, fn, arg)
+                  : inject(e, fn, arg))
+    fn(arg);
+}
+
+void cqueue_exec_wait(cqueue_exec *e, _Atomic size_t *pending) {
+  assert(e);
+  assert(pending);
+
+  cqueue_exec_worker *self = current;
+  unsigned idle = 0;
+
+  if (self && self->exec != e)
+    self = NULL;
+
+  while (atomic_load_explicit(pending, memory_order_acquire)) {
+    if (run_one(e, self))
+      idle = 0;
+    else if (++idle >= IDLE_SPINS) {
+      idle = 0;
+      sched_yield();
+    }
+  }
+}
+
+// private utility functions
+
+//! the loop of a worker thread
+void* worker_main(void *arg) {
+  cqueue_exec_worker *self = arg;
+  cqueue_exec *e = self->exec;
+  unsigned idle = 0;
+
+  current = self;
+  while (!atomic_load_explicit(&e->stop, memory_order_relaxed)) {
+    if (run_one(e, self))
+      idle = 0;
+    else if (++idle >= IDLE_SPINS) {
+      idle = 0;
+      sched_yield();
+    }
+  }
+  current = NULL;
+  return NULL;
+}
+
+/*! Find a task and run it
+
+  Looks at the worker's own deque first, then the shared queue, then the
+  other workers' deques.
+  \param[in] self the calling worker, or NULL for a thread outside e
+  \returns 1 if a task was run, 0 if none was found
+*/
+int run_one(cqueue_exec *e, cqueue_exec_worker *self) {
+  cqueue_task task;
+
+  if ((self && self->deque && !cqueue_deque_pop(self->deque, &task))
+      || !inject_pop(e, &task)
+      || (e->mode == CQUEUE_EXEC_STEAL && !steal_one(e, self, &task))) {
+    task.fn(task.arg);
+    return 1;
+  }
+  return 0;
+}
+
+/*! Steal a task from another worker
+
+  Visits every other worker once, starting from a random one so that
+  thieves spread out over the victims.
+  \returns 0 on success, -1 when no task was found
+*/
+int steal_one(cqueue_exec *e, cqueue_exec_worker *self, cqueue_task *task) {
+  static _Thread_local uint64_t outside_rng = 0x2545f4914f6cdd1dULL;
+  cqueue_exec_worker *victim;
+  size_t start, i;
+  int ret;
+
+  start = xorshift64(self ? &self->rng : &outside_rng) % e->n_workers;
+  for (i=0; i < e->n_workers; i++) {
+    victim = &e->workers[(start + i) % e->n_workers];
+    if (victim == self)
+      continue;
+    // a lost race means the victim had work, worth another look
+    while ((ret = cqueue_deque_steal(victim->deque, task))
+           == CQUEUE_DEQUE_RETRY);
+    if (!ret)
+      return 0;
+  }
+  return -1;
+}
+
+/*! Push a task onto the shared queue of e
+
+  \returns 0 on success, -1 when the queue is full
+*/
+int inject(cqueue_exec *e, cqueue_task_fn fn, void *arg) {
+  cqueue_task *slot;
+
+  slot = cqueue_mpmc_trypush_slot(e->inject);
+  if (!slot)
+    return -1;
+  slot->fn = fn;
+  slot->arg = arg;
+  cqueue_mpmc_push_slot_finish(e->inject, slot);
+  return 0;
+}
+
+/*! Pop a task from the shared queue of e
+
+  \returns 0 on success, -1 when the queue is empty
+*/
+int inject_pop(cqueue_exec *e, cqueue_task *task) {
+  cqueue_task *slot;
+
+  slot = cqueue_mpmc_trypop_slot(e->inject);
+  if (!slot)
+    return -1;
+  *task = *slot;
+  cqueue_mpmc_pop_slot_finish(e->inject, slot);
+  return 0;
+}
+
+//! a cheap pseudo-random number generator, state must not be 0
+uint64_t xorshift64(uint64_t *state) {
+  uint64_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
@@ -0,0 +1,98 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+
+  A minimal thread pool running cqueue_task tasks, built on cqueue_deque
+  and cqueue_mpmc.
+*/
+
+#ifndef _CQUEUE_EXEC_
+#define _CQUEUE_EXEC_
+
+#include <pthread.h>
+#include "cqueue.h"
+
+//! How the tasks of a cqueue_exec are queued
+typedef enum cqueue_exec_mode {
+  //! each worker pushes onto and pops from its own cqueue_deque, idle
+  //! workers steal; tasks submitted from other threads go through a shared
+  //! cqueue_mpmc
+  CQUEUE_EXEC_STEAL,
+  //! every task goes through the shared cqueue_mpmc, mostly as a baseline
+  //! for CQUEUE_EXEC_STEAL
+  CQUEUE_EXEC_SHARED
+} cqueue_exec_mode;
+
+/*! a worker thread of a cqueue_exec
+
+  Each worker takes a cacheline of its own; only its thread writes to it
+  once the pool is running.
+*/
+typedef struct cqueue_exec_worker {
+  struct cqueue_exec *exec;
+  cqueue_deque *deque;      //!< the worker's tasks, NULL in shared mode
+  pthread_t thread;
+  uint64_t rng;             //!< state for picking steal victims
+  char pad[LEVEL1_DCACHE_LINESIZE - sizeof(struct cqueue_exec *)
+           - sizeof(cqueue_deque *) - sizeof(pthread_t) - sizeof(uint64_t)];
+} cqueue_exec_worker;
+
+/*! The main struct for executors
+
+  These should only be allocated by cqueue_exec_new().
+
+  Idle workers keep polling for tasks, yielding the cpu between rounds, so
+  a pool should only be kept around while there is work for it.
+*/
+typedef struct cqueue_exec {
+  // read-only elements
+  size_t n_workers;
+  cqueue_mpmc *inject;          //!< tasks submitted from outside the pool
+  cqueue_exec_worker *workers;
+  cqueue_exec_mode mode;
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(size_t) - sizeof(cqueue_mpmc *)
+            - sizeof(cqueue_exec_worker *) - sizeof(cqueue_exec_mode)];
+  _Atomic int stop;             //!< set by cqueue_exec_delete()
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic int)];
+} cqueue_exec;
+
+/*! Allocates an executor and starts its worker threads
+
+  \param[in] n_workers the number of worker threads, at least 1
+  \param[in] capacity the number of tasks the shared queue holds, and the
+  most tasks each worker's deque grows to
+  \param[in] mode how tasks are queued
+  \return the address of the newly allocated executor, or NULL on error
+*/
+cqueue_exec* cqueue_exec_new(size_t n_workers, size_t capacity,
+                             cqueue_exec_mode mode);
+
+/*! Stops the worker threads and deallocates the executor
+
+  Tasks that are still queued are not run; use cqueue_exec_wait() first.
+  \param[in,out] p a pointer to the pointer to the executor to be
+  deallocated. On success, *p will be set to NULL.
+*/
+void cqueue_exec_delete(cqueue_exec **p);
+
+/*! Submit a task
+
+  From a worker of e the task is queued on the worker's own deque (or the
+  shared queue in shared mode) and run inline when that is full, so that a
+  task never blocks on a queue only its own pool can drain. From any other
+  thread it is queued on the shared queue, spinning while that is full.
+*/
+void cqueue_exec_submit(cqueue_exec *e, cqueue_task_fn fn, void *arg);
+
+/*! Run tasks of e until *pending drops to 0
+
+  The fork-join primitive: a task that submits children counting down
+  pending waits for them here, running its own and other workers' tasks
+  meanwhile instead of blocking a worker. Threads outside the pool may
+  wait too and help in the same way.
+*/
+void cqueue_exec_wait(cqueue_exec *e, _Atomic size_t *pending);
+
+#endif  // _CQUEUE_EXEC_
+// vim: et:ts=3:sw=3:sts=3
@@ -0,0 +1,24 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+
+  Helpers shared by the cqueue modules that are not part of the public API.
+*/
+
+#ifndef _CQUEUE_INTERNAL_
+#define _CQUEUE_INTERNAL_
+
+#include <stddef.h>     // size_t
+
+/*! Allocate a block of memory that starts on a cacheline boundary
+
+  Uses posix_memalign when built with SANITIZE, aligned_alloc otherwise.
+  \param[in] size the number of bytes to allocate, rounded up to a
+  multiple of the cacheline size
+  \returns the allocated block, to be released with free(), or NULL on error
+*/
+void* cacheline_alloc(size_t size);
+
+#endif  // _CQUEUE_INTERNAL_
+// vim: et:ts=3:sw=3:sts=3
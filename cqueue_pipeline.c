@@ -0,0 +1,276 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // pthread_attr_setaffinity_np
+#endif
+
+#include "cqueue_pipeline.h"
+#include "cqueue_internal.h"
+
+#include <sched.h>      // sched_yield, cpu_set_t
+
+//! failed polls of an empty input queue before an idle stage yields
+#define IDLE_SPINS 64
+
+// private function declarations
+static void* stage_main(void *arg);
+static int stage_start(cqueue_pipeline_stage *s);
+static void stage_join(cqueue_pipeline *p);
+static void counter_add(_Atomic uint64_t *c, uint64_t n);
+
+
+cqueue_pipeline* cqueue_pipeline_new(const cqueue_stage *stages,
+                                     size_t n_stages, size_t in_size,
+                                     size_t in_capacity) {
+  cqueue_pipeline_stage *s;
+  cqueue_pipeline *p;
+  size_t i, elem_size;
+
+  if (!stages || !n_stages || !in_size ||
+      n_stages > SIZE_MAX / sizeof(cqueue_pipeline_stage) - 1)
+    return NULL;
+  for (i=0; i < n_stages; i++)
+    if (!stages[i].fn || !stages[i].batch ||
+        (!stages[i].out_size && i < n_stages - 1))
+      return NULL;
+
+  p = malloc(sizeof(cqueue_pipeline));
+  if (!p)
+    return NULL;
+
+  p->n_stages = n_stages;
+  atomic_init(&p->stop, 0);
+  p->finished = 0;
+  p->queues = calloc(n_stages + 1, sizeof(cqueue_spsc *));
+  p->stages = cacheline_alloc(n_stages * sizeof(cqueue_pipeline_stage));
+  if (!p->queues || !p->stages)
+    goto fail;
+
+  // the queue in front of each stage, sized for its elements
+  elem_size = in_size;
+  for (i=0; i <= n_stages; i++) {
+    if (!elem_size)
+      break;
+    p->queues[i] = cqueue_spsc_new(i ? stages[i-1].capacity : in_capacity,
+                                   elem_size);
+    if (!p->queues[i])
+      goto fail;
+    elem_size = i < n_stages ? stages[i].out_size : 0;
+  }
+
+  for (i=0; i < n_stages; i++) {
+    s = &p->stages[i];
+    s->pipeline = p;
+    s->desc = stages[i];
+    s->in = p->queues[i];
+    s->out = p->queues[i+1];
+    s->upstream_done = i ? &p->stages[i-1].done : &p->stop;
+    s->started = 0;
+    atomic_init(&s->done, 0);
+    atomic_init(&s->processed, 0);
+    atomic_init(&s->emitted, 0);
+    atomic_init(&s->idle, 0);
+    atomic_init(&s->stalls, 0);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &p->start);
+  for (i=0; i < n_stages; i++) {
+    if (stage_start(&p->stages[i])) {
+      // the started stages drain the empty queues and stop
+      atomic_store_explicit(&p->stop, 1, memory_order_release);
+      stage_join(p);
+      goto fail;
+    }
+  }
+  return p;
+
+fail:
+  if (p->queues)
+    for (i=0; i <= n_stages; i++)
+      cqueue_spsc_delete(&p->queues[i]);
+  free(p->queues);
+  free(p->stages);
+  free(p);
+  return NULL;
+}
+
+void cqueue_pipeline_delete(cqueue_pipeline **p) {
+  cqueue_pipeline *pl = *p;
+  if(!pl)
+    return;
+
+  cqueue_pipeline_finish(pl);
+  for (size_t i=0; i <= pl->n_stages; i++)
+    cqueue_spsc_delete(&pl->queues[i]);
+  free(pl->queues);
+  free(pl->stages);
+  free(pl);
+  *p = NULL;
+}
+
+cqueue_spsc* cqueue_pipeline_get_input(cqueue_pipeline *p) {
+  assert(p);
+
+  return p->queues[0];
+}
+
+cqueue_spsc* cqueue_pipeline_get_output(cqueue_pipeline *p) {
+  assert(p);
+
+  return p->queues[p->n_stages];
+}
+
+void cqueue_pipeline_finish(cqueue_pipeline *p) {
+  assert(p);
+
+  if (p->finished)
+    return;
+
+  // each stage stops once the stage before it has and its input is empty
+  atomic_store_explicit(&p->stop, 1, memory_order_release);
+  stage_join(p);
+  clock_gettime(CLOCK_MONOTONIC, &p->end);
+  p->finished = 1;
+}
+
+int cqueue_pipeline_get_stats(cqueue_pipeline *p, size_t stage,
+                              cqueue_pipeline_stats *stats) {
+  assert(p);
+  assert(stats);
+
+  cqueue_pipeline_stage *s;
+  struct timespec now;
+  double secs;
+
+  if (stage >= p->n_stages)
+    return -1;
+
+  s = &p->stages[stage];
+  stats->processed = atomic_load_explicit(&s->processed, memory_order_relaxed);
+  stats->emitted = atomic_load_explicit(&s->emitted, memory_order_relaxed);
+  stats->idle = atomic_load_explicit(&s->idle, memory_order_relaxed);
+  stats->stalls = atomic_load_explicit(&s->stalls, memory_order_relaxed);
+  // within [0, capacity] also when read from a thread that is neither side
+  stats->occupancy = cqueue_spsc_get_no_used_slots(s->in);
+  stats->capacity = s->in->capacity;
+
+  if (p->finished)
+    now = p->end;
+  else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  secs = (now.tv_sec - p->start.tv_sec)
+         + (now.tv_nsec - p->start.tv_nsec) / 1e9;
+  stats->rate = secs > 0 ? stats->processed / secs : 0;
+  return 0;
+}
+
+// private utility functions
+
+/*! The loop of a stage's thread
+
+  Takes a batch from the input queue, reserves as many slots in the output
+  queue, and publishes what the stage function passed on with one store
+  per batch on either side.
+*/
+void* stage_main(void *arg) {
+  cqueue_pipeline_stage *s = arg;
+  unsigned char *in, *out = NULL;
+  size_t got, room, n, emitted, i;
+  unsigned idle = 0;
+  int done;
+
+  while (1) {
+    // seen before the poll, so that an empty poll after it is final
+    done = atomic_load_explicit(s->upstream_done, memory_order_acquire);
+    in = cqueue_spsc_pop_slots(s->in, s->desc.batch, &got);
+    if (!in) {
+      if (done)
+        break;
+      counter_add(&s->idle, 1);
+      if (++idle >= IDLE_SPINS) {
+        idle = 0;
+        sched_yield();
+      }
+      continue;
+    }
+    idle = 0;
+
+    n = got;
+    if (s->out) {
+      while ((out = cqueue_spsc_push_slots(s->out, got, &room)) == NULL) {
+        counter_add(&s->stalls, 1);
+        sched_yield();
+      }
+      if (room < n)
+        n = room;
+    }
+
+    emitted = 0;
+    for (i=0; i < n; i++) {
+      if (s->desc.fn(s->desc.arg, in + i * s->in->elem_size,
+                     out ? out + emitted * s->out->elem_size : NULL))
+        emitted++;
+    }
+
+    if (s->out)
+      cqueue_spsc_push_slots_finish(s->out, emitted);
+    cqueue_spsc_pop_slots_finish(s->in, n);
+    counter_add(&s->processed, n);
+    counter_add(&s->emitted, s->out ? emitted : 0);
+  }
+
+  atomic_store_explicit(&s->done, 1, memory_order_release);
+  return NULL;
+}
+
+/*! Create the thread of a stage, pinned to its cpu unless that is -1
+
+  \returns 0 on success, -1 on error
+*/
+int stage_start(cqueue_pipeline_stage *s) {
+  pthread_attr_t attr;
+  cpu_set_t set;
+  int ret = -1;
+
+  if (pthread_attr_init(&attr))
+    return -1;
+
+  if (s->desc.cpu >= 0) {
+    if (s->desc.cpu >= CPU_SETSIZE)
+      goto out;
+    CPU_ZERO(&set);
+    CPU_SET(s->desc.cpu, &set);
+    if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set))
+      goto out;
+  }
+  if (!pthread_create(&s->thread, &attr, stage_main, s)) {
+    s->started = 1;
+    ret = 0;
+  }
+
+out:
+  pthread_attr_destroy(&attr);
+  return ret;
+}
+
+/*! Join the threads of the started stages, in order
+*/
+void stage_join(cqueue_pipeline *p) {
+  for (size_t i=0; i < p->n_stages; i++) {
+    if (p->stages[i].started) {
+      pthread_join(p->stages[i].thread, NULL);
+      p->stages[i].started = 0;
+    }
+  }
+}
+
+/*! Add n to a counter only the calling thread writes
+*/
+void counter_add(_Atomic uint64_t *c, uint64_t n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                        memory_order_relaxed);
+}
@@ -0,0 +1,145 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+
+  A runtime for pipelines of threads chained by cqueue_spsc queues, as in
+  cqueue_test_passing, built from a description of the stages.
+*/
+
+#ifndef _CQUEUE_PIPELINE_
+#define _CQUEUE_PIPELINE_
+
+#include <pthread.h>
+#include <time.h>
+#include "cqueue.h"
+
+/*! A stage's work on one element
+
+  \param arg the stage's cqueue_stage.arg
+  \param in the element taken from the stage's input queue
+  \param out the slot for the element passed on, NULL for a last stage
+  without an output queue
+  \returns nonzero when out was filled and is to be passed on, 0 to drop
+  the element
+*/
+typedef int (*cqueue_stage_fn)(void *arg, const void *in, void *out);
+
+//! The description of a pipeline stage, see cqueue_pipeline_new()
+typedef struct cqueue_stage {
+  cqueue_stage_fn fn;
+  void *arg;
+  //! the size of the elements the stage passes on, 0 for a last stage that
+  //! passes nothing on
+  size_t out_size;
+  //! the minimum capacity of the queue to the next stage
+  size_t capacity;
+  //! the most elements taken from the input queue at a time, at least 1
+  size_t batch;
+  //! the cpu the stage's thread is pinned to, or -1
+  int cpu;
+} cqueue_stage;
+
+/*! The counters of a pipeline stage, see cqueue_pipeline_get_stats()
+
+  The bottleneck is the stage that is never found idle, whose input queue
+  stays full while its output queue stays empty.
+*/
+typedef struct cqueue_pipeline_stats {
+  uint64_t processed;   //!< elements taken from the input queue
+  uint64_t emitted;     //!< elements passed on
+  uint64_t idle;        //!< polls that found the input queue empty
+  uint64_t stalls;      //!< pushes that found the output queue full
+  double rate;          //!< elements processed per second
+  size_t occupancy;     //!< elements in the input queue now, <= capacity
+  size_t capacity;      //!< slots of the input queue
+} cqueue_pipeline_stats;
+
+/*! The runtime state of a stage
+
+  Each stage takes cachelines of its own; only its thread writes to it
+  once the pipeline is running.
+*/
+typedef struct cqueue_pipeline_stage {
+  struct cqueue_pipeline *pipeline;
+  cqueue_stage desc;
+  cqueue_spsc *in;
+  cqueue_spsc *out;             //!< NULL for a last stage without output
+  _Atomic int *upstream_done;   //!< the previous stage's done flag
+  pthread_t thread;
+  int started;                  //!< nonzero once thread was created
+  _Alignas(LEVEL1_DCACHE_LINESIZE) _Atomic int done;
+  // relaxed atomics, only so that cqueue_pipeline_get_stats() may read
+  // them from any thread
+  _Atomic uint64_t processed;
+  _Atomic uint64_t emitted;
+  _Atomic uint64_t idle;
+  _Atomic uint64_t stalls;
+} cqueue_pipeline_stage;
+
+/*! The main struct for pipelines
+
+  These should only be allocated by cqueue_pipeline_new().
+*/
+typedef struct cqueue_pipeline {
+  size_t n_stages;
+  cqueue_pipeline_stage *stages;
+  //! n_stages + 1 queues: the input of every stage, then the output of the
+  //! last stage or NULL
+  cqueue_spsc **queues;
+  struct timespec start;
+  struct timespec end;          //!< when cqueue_pipeline_finish() returned
+  _Atomic int stop;             //!< set by cqueue_pipeline_finish()
+  int finished;
+} cqueue_pipeline;
+
+/*! Allocates a pipeline and starts a thread per stage
+
+  Elements pushed to cqueue_pipeline_get_input() go through the stages in
+  order. Each stage waits for input by polling, yielding the cpu when idle.
+  \param[in] stages the descriptions of the stages, copied
+  \param[in] n_stages the number of stages, at least 1
+  \param[in] in_size the size of the elements pushed to the first stage,
+  at least 1
+  \param[in] in_capacity the minimum capacity of the first stage's queue
+  \return the address of the newly allocated pipeline, or NULL on error,
+  including when a thread cannot be pinned to its cpu
+*/
+cqueue_pipeline* cqueue_pipeline_new(const cqueue_stage *stages,
+                                     size_t n_stages, size_t in_size,
+                                     size_t in_capacity);
+
+/*! Finishes the pipeline if needed and deallocates it
+
+  \param[in,out] p a pointer to the pointer to the pipeline to be
+  deallocated. On success, *p will be set to NULL.
+*/
+void cqueue_pipeline_delete(cqueue_pipeline **p);
+
+/*! The queue to push the pipeline's input to, from a single producer
+*/
+cqueue_spsc* cqueue_pipeline_get_input(cqueue_pipeline *p);
+
+/*! The queue to pop the last stage's output from, from a single consumer
+
+  \returns the queue, or NULL when the last stage's out_size is 0
+*/
+cqueue_spsc* cqueue_pipeline_get_output(cqueue_pipeline *p);
+
+/*! Wait for the stages to process all input and stop them
+
+  No more input may be pushed. The output queue, if any, must have room for
+  the remaining output or be popped from meanwhile.
+*/
+void cqueue_pipeline_finish(cqueue_pipeline *p);
+
+/*! Take a snapshot of the counters of a stage, from any thread
+
+  The rate is measured until cqueue_pipeline_finish(), or until now.
+  \returns 0 on success, -1 when stage is out of range
+*/
+int cqueue_pipeline_get_stats(cqueue_pipeline *p, size_t stage,
+                              cqueue_pipeline_stats *stats);
+
+#endif  // _CQUEUE_PIPELINE_
+// vim: et:ts=3:sw=3:sts=3
@@ -0,0 +1,186 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+*/
+
+#include "cqueue_sharded.h"
+#include "cqueue_internal.h"
+
+// private function declarations
+static size_t pick(cqueue_sharded *s, uint64_t key);
+static void* try_from(cqueue_sharded *s, size_t first, size_t *shard);
+static void pushed(cqueue_sharded *s, size_t shard);
+static inline uint64_t mix64(uint64_t x);
+
+
+cqueue_sharded* cqueue_sharded_new(size_t n_shards, size_t capacity,
+                                   size_t elem_size,
+                                   cqueue_sharded_policy policy, int spill) {
+  cqueue_sharded *s;
+  size_t i;
+
+  if (!n_shards || n_shards > SIZE_MAX / sizeof(cqueue_spsc *))
+    return NULL;
+
+  s = cacheline_alloc(sizeof(cqueue_sharded));
+  if (!s)
+    return NULL;
+
+  s->n_shards = n_shards;
+  s->policy = policy;
+  s->spill = !!spill;
+  s->cursor = 0;
+  s->refresh = 0;
+  s->shards = calloc(n_shards, sizeof(cqueue_spsc *));
+  s->used = calloc(n_shards, sizeof(size_t));
+  if (!s->shards || !s->used)
+    goto fail;
+
+  for (i=0; i < n_shards; i++) {
+    s->shards[i] = cqueue_spsc_new(capacity, elem_size);
+    if (!s->shards[i])
+      goto fail;
+  }
+  return s;
+
+fail:
+  if (s->shards)
+    for (i=0; i < n_shards; i++)
+      cqueue_spsc_delete(&s->shards[i]);
+  free(s->shards);
+  free(s->used);
+  free(s);
+  return NULL;
+}
+
+void cqueue_sharded_delete(cqueue_sharded **p) {
+  cqueue_sharded *s = *p;
+  if(!s)
+    return;
+
+  for (size_t i=0; i < s->n_shards; i++)
+    cqueue_spsc_delete(&s->shards[i]);
+  free(s->shards);
+  free(s->used);
+  free(s);
+  *p = NULL;
+}
+
+cqueue_spsc* cqueue_sharded_get_shard(cqueue_sharded *s, size_t i) {
+  assert(s);
+  assert(i < s->n_shards);
+
+  return s->shards[i];
+}
+
+void* cqueue_sharded_trypush_slot(cqueue_sharded *s, uint64_t key,
+                                  size_t *shard) {
+  assert(s);
+  assert(shard);
+
+  return try_from(s, pick(s, key), shard);
+}
+
+void* cqueue_sharded_push_slot(cqueue_sharded *s, uint64_t key,
+                               size_t *shard) {
+  assert(s);
+  assert(shard);
+
+  size_t first = pick(s, key);
+  void *p;
+
+  p = try_from(s, first, shard);
+  if (p)
+    return p;
+
+  p = cqueue_spsc_push_slot(s->shards[first]);
+  pushed(s, first);
+  *shard = first;
+  return p;
+}
+
+void cqueue_sharded_push_slot_finish(cqueue_sharded *s, size_t shard) {
+  assert(s);
+  assert(shard < s->n_shards);
+
+  cqueue_spsc_push_slot_finish(s->shards[shard]);
+}
+
+// private utility functions
+
+/*! The shard the policy of s picks for an element of key
+*/
+size_t pick(cqueue_sharded *s, uint64_t key) {
+  size_t best, i, j;
+
+  switch (s->policy) {
+  case CQUEUE_SHARDED_HASH:
+    return mix64(key) % s->n_shards;
+
+  case CQUEUE_SHARDED_LEAST_LOADED:
+    // the estimates only grow with our own pushes; correct one of them per
+    // push, so that each is at most n_shards pushes stale
+    s->used[s->refresh] = cqueue_spsc_get_no_used_slots(s->shards[s->refresh]);
+    if (++s->refresh == s->n_shards)
+      s->refresh = 0;
+
+    // start at the cursor so that ties go round robin
+    best = s->cursor;
+    for (i=1; i < s->n_shards; i++) {
+      j = s->cursor + i;
+      if (j >= s->n_shards)
+        j -= s->n_shards;
+      if (s->used[j] < s->used[best])
+        best = j;
+    }
+    return best;
+
+  case CQUEUE_SHARDED_ROUND_ROBIN:
+  default:
+    return s->cursor;
+  }
+}
+
+/*! Get a slot from shard first, or with spill from the shards after it
+
+  \returns the slot, or NULL when every shard tried is full
+*/
+void* try_from(cqueue_sharded *s, size_t first, size_t *shard) {
+  size_t i, tries = s->spill ? s->n_shards : 1;
+  void *p;
+
+  for (i=first; tries--; ) {
+    p = cqueue_spsc_trypush_slot(s->shards[i]);
+    if (p) {
+      pushed(s, i);
+      *shard = i;
+      return p;
+    }
+    // full: the estimate is exact
+    if (s->policy == CQUEUE_SHARDED_LEAST_LOADED)
+      s->used[i] = s->shards[i]->capacity;
+    if (++i == s->n_shards)
+      i = 0;
+  }
+
+  return NULL;
+}
+
+/*! Account for a push to shard
+*/
+void pushed(cqueue_sharded *s, size_t shard) {
+  s->used[shard]++;
+  s->cursor = shard + 1 < s->n_shards ? shard + 1 : 0;
+}
+
+/*! The splitmix64 finalizer, so that keys differing in a few bits spread
+ over the shards
+*/
+uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
@@ -0,0 +1,98 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+
+  A single producer dispatching elements over several cqueue_spsc queues,
+  one per consumer, so that a stage scales across cores without the
+  contention of a cqueue_mpmc.
+*/
+
+#ifndef _CQUEUE_SHARDED_
+#define _CQUEUE_SHARDED_
+
+#include "cqueue.h"
+
+//! How a cqueue_sharded picks the shard of an element
+typedef enum cqueue_sharded_policy {
+  //! the shards in turn
+  CQUEUE_SHARDED_ROUND_ROBIN,
+  //! a hash of the element's key, so that the elements of a key stay in
+  //! order on one shard
+  CQUEUE_SHARDED_HASH,
+  //! the shard with the fewest elements, from occupancy estimates the
+  //! producer keeps itself and corrects from one shard per push
+  CQUEUE_SHARDED_LEAST_LOADED
+} cqueue_sharded_policy;
+
+/*! The main struct for sharded queues
+
+  These should only be allocated by cqueue_sharded_new().
+
+  Pushes are thread safe for a single producer. The consumer of shard i
+  pops from cqueue_sharded_get_shard(s, i) with the cqueue_spsc functions.
+*/
+typedef struct cqueue_sharded {
+  // read-only elements
+  size_t n_shards;
+  cqueue_spsc **shards;
+  cqueue_sharded_policy policy;
+  int spill;                //!< nonzero to try the next shard when full
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(size_t) - sizeof(cqueue_spsc **)
+            - sizeof(cqueue_sharded_policy) - sizeof(int)];
+  // producer only
+  size_t cursor;            //!< next shard of CQUEUE_SHARDED_ROUND_ROBIN
+  size_t refresh;           //!< next shard whose estimate is corrected
+  size_t *used;             //!< estimated used slots of each shard
+  char pad2[LEVEL1_DCACHE_LINESIZE - 2 * sizeof(size_t) - sizeof(size_t *)];
+} cqueue_sharded;
+
+/*! Allocates a sharded queue and its shards
+
+  \param[in] n_shards the number of shards, ie consumers, at least 1
+  \param[in] capacity the minimum number of elements each shard holds
+  \param[in] elem_size the maximum size of any element
+  \param[in] policy how the shard of an element is picked
+  \param[in] spill nonzero to push to the following shards when the picked
+  one is full. This breaks the per-key order of CQUEUE_SHARDED_HASH.
+  \return the address of the newly allocated queue, or NULL on error
+*/
+cqueue_sharded* cqueue_sharded_new(size_t n_shards, size_t capacity,
+                                   size_t elem_size,
+                                   cqueue_sharded_policy policy, int spill);
+
+/*! Deallocates the queue and its shards
+
+  \param[in,out] p a pointer to the pointer to the queue to be
+  deallocated. On success, *p will be set to NULL.
+*/
+void cqueue_sharded_delete(cqueue_sharded **p);
+
+/*! The queue of shard i, for its consumer
+*/
+cqueue_spsc* cqueue_sharded_get_shard(cqueue_sharded *s, size_t i);
+
+/*! Get a pointer to the next slot of the shard picked for an element
+
+  ex: cqueue_sharded_trypush_slot(), write data,
+  cqueue_sharded_push_slot_finish()
+  \param[in] key the element's key, only used by CQUEUE_SHARDED_HASH
+  \param[out] shard the shard of the slot
+  \returns a pointer to the slot, or NULL when the picked shard is full
+  (and, with spill, all the others too)
+*/
+void* cqueue_sharded_trypush_slot(cqueue_sharded *s, uint64_t key,
+                                  size_t *shard);
+
+/*! Like cqueue_sharded_trypush_slot(), but waits for space on the picked
+ shard, with its wait strategy, when every shard tried is full
+*/
+void* cqueue_sharded_push_slot(cqueue_sharded *s, uint64_t key,
+                               size_t *shard);
+
+/*! Publish the slot got from a push to shard
+*/
+void cqueue_sharded_push_slot_finish(cqueue_sharded *s, size_t shard);
+
+#endif  // _CQUEUE_SHARDED_
+// vim: et:ts=3:sw=3:sts=3
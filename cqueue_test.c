@@ -3,9 +3,12 @@
 #endif
 
 #include "cqueue.h"
+#include "cqueue_typed.h"
 #include <stdio.h>  // printf
+#include <time.h>   // timespec_get
 #include <assert.h>
 #include <stddef.h> // ptrdiff_t
+#include <string.h> // memset
 #include <stdio.h>  // printf
 
 #define PASSFAIL(fn) \
@@ -14,11 +17,39 @@
   else \
     printf("FAIL: %s\n", #fn);
 
+// the slot array of a cqueue_spsc
+#define SPSC_ARRAY(q) ((unsigned char *)(q) + (q)->array_offset)
+
+CQUEUE_SPSC_DEFINE(test_typed, short, 4)
+
 // function declarations
 int spsc_new_pass();
 int spsc_new_fail();
 int spsc_trypush_slot_pass();
 int spsc_trypop_slot_pass();
+int spsc_batch_pass();
+int spsc_new_opts_pass();
+int spsc_wait_timeout_pass();
+int spsc_dense_pass();
+int spsc_unbounded_pass();
+int mpmc_new_pass();
+int mpmc_trypush_trypop_pass();
+int mpsc_trypush_trypop_pass();
+int bcast_pass();
+int bytering_pass();
+int deque_pass();
+int spsc_set_pass();
+int spsc_typed_pass();
+int spsc_copy_pass();
+int mailbox_pass();
+int conflate_pass();
+int spsc_peek_pass();
+int lanes_pass();
+int spsc_latency_pass();
+int pool_pass();
+#ifdef CQUEUE_STATS
+int spsc_stats_pass();
+#endif
 
 
 int main() {
@@ -26,6 +57,29 @@ int main() {
   PASSFAIL(spsc_new_fail());
   PASSFAIL(spsc_trypush_slot_pass());
   PASSFAIL(spsc_trypop_slot_pass());
+  PASSFAIL(spsc_batch_pass());
+  PASSFAIL(spsc_new_opts_pass());
+  PASSFAIL(spsc_wait_timeout_pass());
+  PASSFAIL(spsc_dense_pass());
+  PASSFAIL(spsc_unbounded_pass());
+  PASSFAIL(mpmc_new_pass());
+  PASSFAIL(mpmc_trypush_trypop_pass());
+  PASSFAIL(mpsc_trypush_trypop_pass());
+  PASSFAIL(bcast_pass());
+  PASSFAIL(bytering_pass());
+  PASSFAIL(deque_pass());
+  PASSFAIL(spsc_set_pass());
+  PASSFAIL(spsc_typed_pass());
+  PASSFAIL(spsc_copy_pass());
+  PASSFAIL(mailbox_pass());
+  PASSFAIL(conflate_pass());
+  PASSFAIL(spsc_peek_pass());
+  PASSFAIL(lanes_pass());
+  PASSFAIL(spsc_latency_pass());
+  PASSFAIL(pool_pass());
+#ifdef CQUEUE_STATS
+  PASSFAIL(spsc_stats_pass());
+#endif
 
   return 0;
 }
@@ -45,7 +99,7 @@ int spsc_new_pass() {
   assert(q->push_idx == 0);
   assert(q->pop_idx == 0);
   for(size_t i=0; i < q->capacity; i++) {
-    size_t used = *(size_t *)(q->array + i*q->elem_size);
+    size_t used = *(size_t *)(SPSC_ARRAY(q) + i*q->elem_size);
     assert(used == 0);
   }
 
@@ -113,7 +167,7 @@ int spsc_trypush_slot_pass() {
 
   // check index, used flag, and data
   assert(q->push_idx == 26);
-  void *offset = (char *)(q->array + 12*q->elem_size);
+  void *offset = (char *)(SPSC_ARRAY(q) + 12*q->elem_size);
   size_t used = *(size_t *)offset;
   assert(used == 1);
   char *c = (char *)offset + sizeof(size_t);
@@ -152,10 +206,1167 @@ int spsc_trypop_slot_pass() {
 
   // check index, used flag, and data
   assert(q->pop_idx == 13);
-  void *offset = (char *)(q->array + 12*q->elem_size);
+  void *offset = (char *)(SPSC_ARRAY(q) + 12*q->elem_size);
   size_t used = *(size_t *)offset;
   assert(used == 0);
   assert(*p == 'M');
 
   return 1;
 }
+
+
+int spsc_batch_pass() {
+  cqueue_spsc *q;
+  size_t got, i;
+  char *p;
+
+  q = cqueue_spsc_new(8, sizeof(char));
+  assert(q);
+
+  // nothing to pop, and asking for nothing gets nothing
+  assert(!cqueue_spsc_pop_slots(q, 4, &got));
+  assert(got == 0);
+  assert(!cqueue_spsc_push_slots(q, 0, &got));
+
+  // reserve more than we publish
+  p = cqueue_spsc_push_slots(q, 6, &got);
+  assert(p);
+  assert(got == 6);
+  for (i=0; i < 5; i++)
+    *(p + i * q->elem_size) = 'A' + i;
+  cqueue_spsc_push_slots_finish(q, 5);
+  assert(q->push_idx == 5);
+  assert(cqueue_spsc_get_no_used_slots(q) == 5);
+
+  // the run stops at the end of the array
+  p = cqueue_spsc_push_slots(q, 8, &got);
+  assert(p);
+  assert(got == 3);
+  for (i=0; i < 3; i++)
+    *(p + i * q->elem_size) = 'F' + i;
+  cqueue_spsc_push_slots_finish(q, 3);
+  assert(q->push_idx == 8);
+  assert(!cqueue_spsc_push_slots(q, 1, &got));
+
+  // batch and single slot pops mix
+  p = cqueue_spsc_trypop_slot(q);
+  assert(*p == 'A');
+  cqueue_spsc_pop_slot_finish(q);
+  p = cqueue_spsc_pop_slots(q, 2, &got);
+  assert(got == 2);
+  assert(*p == 'B' && *(p + q->elem_size) == 'C');
+  cqueue_spsc_pop_slots_finish(q, 2);
+  assert(cqueue_spsc_get_no_used_slots(q) == 5);
+
+  // the push run stops at the first used slot
+  p = cqueue_spsc_push_slots(q, 8, &got);
+  assert(p);
+  assert(got == 3);
+  for (i=0; i < 3; i++)
+    *(p + i * q->elem_size) = 'I' + i;
+  cqueue_spsc_push_slots_finish(q, 3);
+
+  // the pop run stops at the end of the array, then continues from the start
+  p = cqueue_spsc_pop_slots(q, 8, &got);
+  assert(got == 5);
+  for (i=0; i < 5; i++)
+    assert(*(p + i * q->elem_size) == 'D' + (char)i);
+  cqueue_spsc_pop_slots_finish(q, 5);
+  p = cqueue_spsc_pop_slots(q, 8, &got);
+  assert(got == 3);
+  for (i=0; i < 3; i++)
+    assert(*(p + i * q->elem_size) == 'I' + (char)i);
+  cqueue_spsc_pop_slots_finish(q, 3);
+  assert(cqueue_spsc_get_no_used_slots(q) == 0);
+  assert(!cqueue_spsc_trypop_slot(q));
+
+  cqueue_spsc_delete(&q);
+  return 1;
+}
+
+int spsc_new_opts_pass() {
+  cqueue_spsc_opts opts;
+  cqueue_spsc *q;
+  char *p;
+
+  // bad padding granularities
+  cqueue_spsc_opts_init(&opts);
+  opts.line_size = 96;
+  assert(!cqueue_spsc_new_opts(8, sizeof(char), &opts));
+  opts.line_size = LEVEL1_DCACHE_LINESIZE / 2;
+  assert(!cqueue_spsc_new_opts(8, sizeof(char), &opts));
+  opts.line_size = 8192;
+  assert(!cqueue_spsc_new_opts(8, sizeof(char), &opts));
+
+  // huge pages fall back to regular ones when none are reserved
+  opts.line_size = 2 * LEVEL1_DCACHE_LINESIZE;
+  opts.huge_pages = 1;
+  opts.prefault = 1;
+  q = cqueue_spsc_new_opts(1000, sizeof(char), &opts);
+  assert(q);
+  assert(q->capacity == 1024);
+  assert(q->elem_size == 2 * LEVEL1_DCACHE_LINESIZE);
+  assert((size_t)SPSC_ARRAY(q) % (2 * LEVEL1_DCACHE_LINESIZE) == 0);
+
+  for (size_t i=0; i < q->capacity; i++) {
+    p = cqueue_spsc_trypush_slot(q);
+    assert(p);
+    *p = (char)i;
+    cqueue_spsc_push_slot_finish(q);
+  }
+  assert(!cqueue_spsc_trypush_slot(q));
+  for (size_t i=0; i < q->capacity; i++) {
+    p = cqueue_spsc_trypop_slot(q);
+    assert(p && *p == (char)i);
+    cqueue_spsc_pop_slot_finish(q);
+  }
+  cqueue_spsc_delete(&q);
+  assert(!q);
+
+  // defaults, with the consumer placing the pages
+  q = cqueue_spsc_new_opts(16, sizeof(char), NULL);
+  assert(q);
+  assert(q->elem_size == LEVEL1_DCACHE_LINESIZE);
+  cqueue_spsc_prefault(q);
+  assert(cqueue_spsc_get_no_used_slots(q) == 0);
+  cqueue_spsc_delete(&q);
+
+  // lines wider than the struct align the array too, not just the stride
+  cqueue_spsc_opts_init(&opts);
+  opts.line_size = 4096;
+  q = cqueue_spsc_new_opts(4, sizeof(char), &opts);
+  assert(q);
+  assert(q->elem_size == 4096);
+  assert((size_t)SPSC_ARRAY(q) % 4096 == 0);
+  p = cqueue_spsc_trypush_slot(q);
+  assert(p);
+  cqueue_spsc_push_slot_finish(q);
+  assert(cqueue_spsc_get_no_used_slots(q) == 1);
+  cqueue_spsc_delete(&q);
+
+  return 1;
+}
+
+int spsc_wait_timeout_pass() {
+  cqueue_spsc *q;
+  struct timespec start, end;
+  double elapsed;
+  char *p;
+
+  q = cqueue_spsc_new(2, sizeof(char));
+  assert(q);
+  assert(q->wait == CQUEUE_WAIT_SPIN);
+  assert(q->push_parked == 0 && q->pop_parked == 0);
+
+  for (int w = CQUEUE_WAIT_SPIN; w <= CQUEUE_WAIT_PARK; w++) {
+    cqueue_spsc_set_wait(q, w, 100);
+
+    // an empty queue times out, after roughly the timeout
+    timespec_get(&start, TIME_UTC);
+    assert(!cqueue_spsc_pop_slot_timeout(q, 2000000));
+    timespec_get(&end, TIME_UTC);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    assert(elapsed >= 0.001);
+    assert(q->pop_parked == 0);
+
+    // a full queue times out
+    for (int i=0; i < 2; i++) {
+      p = cqueue_spsc_push_slot_timeout(q, 1000);
+      assert(p);
+      *p = 'a' + i;
+      cqueue_spsc_push_slot_finish(q);
+    }
+    assert(!cqueue_spsc_push_slot_timeout(q, 1000000));
+    assert(q->push_parked == 0);
+
+    // available slots are returned without waiting
+    for (int i=0; i < 2; i++) {
+      p = cqueue_spsc_pop_slot_timeout(q, 0);
+      assert(p && *p == 'a' + i);
+      cqueue_spsc_pop_slot_finish(q);
+    }
+  }
+
+  cqueue_spsc_delete(&q);
+  return 1;
+}
+
+int spsc_dense_pass() {
+  cqueue_spsc_dense *q;
+  ptrdiff_t d;
+  uint32_t *p;
+  int i;
+
+  q = cqueue_spsc_dense_new(6, sizeof(uint32_t));
+  assert(q);
+  assert(q->capacity == 8);
+  assert(q->elem_size == sizeof(uint32_t));  // packed, no padding
+
+  // check struct layout
+  d = (char *)(void *)&q->push_idx - (char*)(void *)&q->capacity;
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+  d = (char *)(void *)&q->pop_idx - (char *)(void *)&q->push_idx;
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+
+  assert(!cqueue_spsc_dense_trypop_slot(q));
+  for(i=0; i < 8; i++) {
+    p = cqueue_spsc_dense_trypush_slot(q);
+    assert(p);
+    *p = i;
+    cqueue_spsc_dense_push_slot_finish(q);
+  }
+  assert(!cqueue_spsc_dense_trypush_slot(q));
+  assert(cqueue_spsc_dense_get_no_used_slots(q) == 8);
+
+  // elements are adjacent in memory
+  assert((uint32_t *)(void *)q->array + 3 == (uint32_t *)(void *)(q->array + 3 * sizeof(uint32_t)));
+  assert(*((uint32_t *)(void *)q->array + 3) == 3);
+
+  // wrap around a few times
+  for(i=0; i < 20; i++) {
+    p = cqueue_spsc_dense_trypop_slot(q);
+    assert(p && *p == (uint32_t)i);
+    cqueue_spsc_dense_pop_slot_finish(q);
+    p = cqueue_spsc_dense_push_slot(q);
+    *p = i + 8;
+    cqueue_spsc_dense_push_slot_finish(q);
+  }
+  for(i=20; i < 28; i++) {
+    p = cqueue_spsc_dense_pop_slot(q);
+    assert(*p == (uint32_t)i);
+    cqueue_spsc_dense_pop_slot_finish(q);
+  }
+  assert(cqueue_spsc_dense_get_no_used_slots(q) == 0);
+  assert(!cqueue_spsc_dense_trypop_slot(q));
+  cqueue_spsc_dense_delete(&q);
+  assert(!q);
+
+  // elem_size rounding keeps slots aligned
+  q = cqueue_spsc_dense_new(4, 3);
+  assert(q && q->elem_size == 4);
+  cqueue_spsc_dense_delete(&q);
+  q = cqueue_spsc_dense_new(4, _Alignof(max_align_t) + 1);
+  assert(q && q->elem_size == 2 * _Alignof(max_align_t));
+  cqueue_spsc_dense_delete(&q);
+
+  // fail on elem_size
+  q = cqueue_spsc_dense_new(4, 0);
+  assert(!q);
+
+  return 1;
+}
+
+int spsc_unbounded_pass() {
+  cqueue_spsc_unbounded *q;
+  size_t seg_size;
+  int *p;
+
+  q = cqueue_spsc_unbounded_new(3, sizeof(int), 0);
+  assert(q);
+  assert(q->seg_capacity == 4);  // round up to power of 2
+  assert(q->elem_size == LEVEL1_DCACHE_LINESIZE);  // round up to cacheline
+  assert(!cqueue_spsc_unbounded_trypop_slot(q));
+
+  // grows instead of filling up
+  for (int i=0; i < 10; i++) {
+    p = cqueue_spsc_unbounded_trypush_slot(q);
+    assert(p);
+    *p = i;
+    cqueue_spsc_unbounded_push_slot_finish(q);
+  }
+  assert(q->n_allocated == 3);
+  assert(cqueue_spsc_unbounded_get_no_used_slots(q) == 10);
+
+  for (int i=0; i < 10; i++) {
+    p = cqueue_spsc_unbounded_trypop_slot(q);
+    assert(p && *p == i);
+    cqueue_spsc_unbounded_pop_slot_finish(q);
+  }
+  assert(!cqueue_spsc_unbounded_trypop_slot(q));
+  assert(cqueue_spsc_unbounded_get_no_used_slots(q) == 0);
+
+  // drained segments are reused rather than allocated
+  for (int i=0; i < 8; i++) {
+    p = cqueue_spsc_unbounded_trypush_slot(q);
+    assert(p);
+    cqueue_spsc_unbounded_push_slot_finish(q);
+  }
+  assert(q->n_allocated == 3);
+  cqueue_spsc_unbounded_delete(&q);
+  assert(!q);
+
+  // a memory limit of two segments
+  seg_size = LEVEL1_DCACHE_LINESIZE + 4 * LEVEL1_DCACHE_LINESIZE;
+  q = cqueue_spsc_unbounded_new(4, sizeof(int), 2 * seg_size);
+  assert(q);
+  assert(q->max_segments == 2);
+  for (int i=0; i < 8; i++) {
+    p = cqueue_spsc_unbounded_trypush_slot(q);
+    assert(p);
+    *p = i;
+    cqueue_spsc_unbounded_push_slot_finish(q);
+  }
+  assert(!cqueue_spsc_unbounded_trypush_slot(q));
+
+  // the first segment is handed back once the consumer moves past it
+  for (int i=0; i < 5; i++) {
+    p = cqueue_spsc_unbounded_trypop_slot(q);
+    assert(p && *p == i);
+    cqueue_spsc_unbounded_pop_slot_finish(q);
+  }
+  p = cqueue_spsc_unbounded_trypush_slot(q);
+  assert(p);
+  *p = 8;
+  cqueue_spsc_unbounded_push_slot_finish(q);
+  for (int i=5; i < 9; i++) {
+    p = cqueue_spsc_unbounded_trypop_slot(q);
+    assert(p && *p == i);
+    cqueue_spsc_unbounded_pop_slot_finish(q);
+  }
+  cqueue_spsc_unbounded_delete(&q);
+
+  // fail on elem_size
+  assert(!cqueue_spsc_unbounded_new(4, 0, 0));
+
+  return 1;
+}
+
+int mpmc_new_pass() {
+  cqueue_mpmc *q;
+  ptrdiff_t d;
+
+  q = cqueue_mpmc_new(26, LEVEL1_DCACHE_LINESIZE-sizeof(size_t));
+  assert(q);
+  assert(q->capacity == 32);  // round up to power of 2
+  assert(q->elem_size == LEVEL1_DCACHE_LINESIZE);  // round up to cacheline
+
+  // check initialization, each slot's seq starts at its index
+  assert(q->push_idx == 0);
+  assert(q->pop_idx == 0);
+  for(size_t i=0; i < q->capacity; i++) {
+    size_t seq = *(size_t *)(q->array + i*q->elem_size);
+    assert(seq == i);
+  }
+
+  // check struct layout
+  d = (char *)(void *)&q->push_idx - (char*)(void *)&q->capacity;
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+  d = (char *)(void *)&q->pop_idx - (char *)(void *)&q->push_idx;
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+
+  cqueue_mpmc_delete(&q);
+  assert(!q);
+
+  // capacity of 1 is bumped to 2
+  q = cqueue_mpmc_new(1, sizeof(int));
+  assert(q);
+  assert(q->capacity == 2);
+  cqueue_mpmc_delete(&q);
+
+  // fail on elem_size
+  q = cqueue_mpmc_new(32, 0);
+  assert(!q);
+
+  return 1;
+}
+
+int mpmc_trypush_trypop_pass() {
+  cqueue_mpmc *q;
+  int i;
+  char *p, *p2;
+
+  q = cqueue_mpmc_new(4, sizeof(char));
+  assert(q);
+
+  // fill the queue, claiming two slots before finishing either
+  p = cqueue_mpmc_trypush_slot(q);
+  p2 = cqueue_mpmc_trypush_slot(q);
+  assert(p && p2 && p != p2);
+  *p = 'A';
+  *p2 = 'B';
+  // an unfinished slot blocks poppers
+  cqueue_mpmc_push_slot_finish(q, p2);
+  assert(!cqueue_mpmc_trypop_slot(q));
+  cqueue_mpmc_push_slot_finish(q, p);
+  for(i=0; i < 2; i++) {
+    p = cqueue_mpmc_push_slot(q);
+    *p = 'C' + i;
+    cqueue_mpmc_push_slot_finish(q, p);
+  }
+  assert(cqueue_mpmc_get_no_used_slots(q) == 4);
+  assert(!cqueue_mpmc_trypush_slot(q));
+
+  // drain in fifo order and wrap around a couple of times
+  for(i=0; i < 10; i++) {
+    p = cqueue_mpmc_trypop_slot(q);
+    assert(p);
+    assert(*p == 'A' + i);
+    cqueue_mpmc_pop_slot_finish(q, p);
+
+    p = cqueue_mpmc_trypush_slot(q);
+    assert(p);
+    *p = 'E' + i;
+    cqueue_mpmc_push_slot_finish(q, p);
+  }
+
+  for(i=0; i < 4; i++) {
+    p = cqueue_mpmc_pop_slot(q);
+    assert(*p == 'K' + i);
+    cqueue_mpmc_pop_slot_finish(q, p);
+  }
+  assert(cqueue_mpmc_get_no_used_slots(q) == 0);
+  assert(!cqueue_mpmc_trypop_slot(q));
+
+  cqueue_mpmc_delete(&q);
+  return 1;
+}
+
+int mpsc_trypush_trypop_pass() {
+  cqueue_mpsc *q;
+  int i;
+  char *p, *p2;
+
+  q = cqueue_mpsc_new(4, sizeof(char));
+  assert(q);
+  assert(q->capacity == 4);
+  assert(q->elem_size == LEVEL1_DCACHE_LINESIZE);
+
+  // two pushers with outstanding slots, finished out of order
+  p = cqueue_mpsc_trypush_slot(q);
+  p2 = cqueue_mpsc_push_slot(q);
+  assert(p && p2 && p != p2);
+  *p = 'A';
+  *p2 = 'B';
+  cqueue_mpsc_push_slot_finish(q, p2);
+  assert(!cqueue_mpsc_trypop_slot(q));
+  cqueue_mpsc_push_slot_finish(q, p);
+
+  for(i=0; i < 2; i++) {
+    p = cqueue_mpsc_trypush_slot(q);
+    assert(p);
+    *p = 'C' + i;
+    cqueue_mpsc_push_slot_finish(q, p);
+  }
+  assert(!cqueue_mpsc_trypush_slot(q));
+
+  // drain in fifo order and wrap around a couple of times
+  for(i=0; i < 10; i++) {
+    p = cqueue_mpsc_trypop_slot(q);
+    assert(p);
+    assert(*p == 'A' + i);
+    cqueue_mpsc_pop_slot_finish(q);
+
+    p = cqueue_mpsc_trypush_slot(q);
+    assert(p);
+    *p = 'E' + i;
+    cqueue_mpsc_push_slot_finish(q, p);
+  }
+  assert(q->pop_idx == 10);
+
+  for(i=0; i < 4; i++) {
+    p = cqueue_mpsc_pop_slot(q);
+    assert(*p == 'K' + i);
+    cqueue_mpsc_pop_slot_finish(q);
+  }
+  assert(!cqueue_mpsc_trypop_slot(q));
+
+  cqueue_mpsc_delete(&q);
+  assert(!q);
+  return 1;
+}
+
+int bcast_pass() {
+  cqueue_bcast *q;
+  ptrdiff_t d;
+  int i;
+  char *p;
+  const char *c;
+
+  q = cqueue_bcast_new(3, sizeof(char), 3);
+  assert(q);
+  assert(q->capacity == 4);
+  assert(q->elem_size == LEVEL1_DCACHE_LINESIZE);
+  assert(q->n_consumers == 3);
+
+  // check struct layout, every cursor on its own cacheline
+  d = (char *)(void *)&q->push_idx - (char*)(void *)&q->capacity;
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+  d = (char *)(void *)&q->cursors[0] - (char*)(void *)&q->push_idx;
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+  d = (char *)(void *)&q->cursors[2] - (char*)(void *)&q->cursors[1];
+  assert(d == LEVEL1_DCACHE_LINESIZE);
+
+  // nothing to read yet
+  for(i=0; i < 3; i++)
+    assert(!cqueue_bcast_trypop_slot(q, i));
+
+  for(i=0; i < 4; i++) {
+    p = cqueue_bcast_trypush_slot(q);
+    assert(p);
+    *p = 'A' + i;
+    cqueue_bcast_push_slot_finish(q);
+  }
+  assert(!cqueue_bcast_trypush_slot(q));
+
+  // consumers 0 and 1 read everything, consumer 2 reads one element
+  for(i=0; i < 4; i++) {
+    c = cqueue_bcast_trypop_slot(q, 0);
+    assert(c && *c == 'A' + i);
+    cqueue_bcast_pop_slot_finish(q, 0);
+    c = cqueue_bcast_pop_slot(q, 1);
+    assert(*c == 'A' + i);
+    cqueue_bcast_pop_slot_finish(q, 1);
+  }
+  assert(!cqueue_bcast_trypop_slot(q, 0));
+  c = cqueue_bcast_trypop_slot(q, 2);
+  assert(c && *c == 'A');
+  // consumer 2 still has its pop slot, the producer is gated by it
+  assert(!cqueue_bcast_trypush_slot(q));
+  cqueue_bcast_pop_slot_finish(q, 2);
+
+  // exactly one slot was freed by the slowest consumer
+  p = cqueue_bcast_push_slot(q);
+  *p = 'E';
+  cqueue_bcast_push_slot_finish(q);
+  assert(!cqueue_bcast_trypush_slot(q));
+
+  for(i=1; i < 5; i++) {
+    c = cqueue_bcast_trypop_slot(q, 2);
+    assert(c && *c == 'A' + i);
+    cqueue_bcast_pop_slot_finish(q, 2);
+  }
+  c = cqueue_bcast_trypop_slot(q, 0);
+  assert(c && *c == 'E');
+
+  cqueue_bcast_delete(&q);
+  assert(!q);
+
+  // fail on n_consumers
+  q = cqueue_bcast_new(4, sizeof(char), 0);
+  assert(!q);
+
+  return 1;
+}
+
+int bytering_pass() {
+  cqueue_bytering *q;
+  size_t len;
+  char *p;
+
+  q = cqueue_bytering_new(100);
+  assert(q);
+  assert(q->capacity == 128);  // round up to power of 2
+  assert(q->max_len == 64 - sizeof(size_t));
+  assert(!cqueue_bytering_trypop_slot(q, &len));
+  assert(!cqueue_bytering_trypush_slot(q, q->max_len + 1));
+
+  // reserve more than we publish; the record is padded to the alignment
+  p = cqueue_bytering_trypush_slot(q, 40);
+  assert(p);
+  assert((size_t)p % CQUEUE_BYTERING_ALIGN == 0);
+  memset(p, 'A', 5);
+  cqueue_bytering_push_slot_finish(q, 5);
+  assert(cqueue_bytering_get_no_used_bytes(q) == 16);
+
+  // 16 + 48 + 56 bytes leaves 8 at the end
+  p = cqueue_bytering_trypush_slot(q, 33);
+  memset(p, 'B', 33);
+  cqueue_bytering_push_slot_finish(q, 33);
+  p = cqueue_bytering_trypush_slot(q, 48);
+  memset(p, 'C', 48);
+  cqueue_bytering_push_slot_finish(q, 48);
+  assert(cqueue_bytering_get_no_used_bytes(q) == 120);
+
+  // a record that does not fit at the end needs the start to be free too
+  assert(!cqueue_bytering_trypush_slot(q, 8));
+
+  p = cqueue_bytering_trypop_slot(q, &len);
+  assert(p && len == 5 && p[0] == 'A' && p[4] == 'A');
+  cqueue_bytering_pop_slot_finish(q);
+
+  // skip the last 8 bytes and wrap to the start
+  p = cqueue_bytering_trypush_slot(q, 8);
+  assert(p == (char *)q->array + sizeof(size_t));
+  memset(p, 'D', 8);
+  cqueue_bytering_push_slot_finish(q, 8);
+  assert(cqueue_bytering_get_no_used_bytes(q) == 128);
+  assert(!cqueue_bytering_trypush_slot(q, 0));
+
+  p = cqueue_bytering_trypop_slot(q, &len);
+  assert(p && len == 33 && p[32] == 'B');
+  cqueue_bytering_pop_slot_finish(q);
+  p = cqueue_bytering_trypop_slot(q, &len);
+  assert(p && len == 48 && p[47] == 'C');
+  cqueue_bytering_pop_slot_finish(q);
+
+  // the consumer skips the padding record
+  p = cqueue_bytering_trypop_slot(q, &len);
+  assert(p && len == 8 && p[0] == 'D' && p[7] == 'D');
+  cqueue_bytering_pop_slot_finish(q);
+  assert(cqueue_bytering_get_no_used_bytes(q) == 0);
+  assert(!cqueue_bytering_trypop_slot(q, &len));
+
+  // empty records are fine
+  assert(cqueue_bytering_trypush_slot(q, 0));
+  cqueue_bytering_push_slot_finish(q, 0);
+  assert(cqueue_bytering_trypop_slot(q, &len));
+  assert(len == 0);
+  cqueue_bytering_pop_slot_finish(q);
+
+  cqueue_bytering_delete(&q);
+  assert(!q);
+  return 1;
+}
+
+static void deque_task(void *arg) {
+  (void)arg;
+}
+
+int deque_pass() {
+  cqueue_deque *q;
+  cqueue_task task;
+  size_t i;
+
+  q = cqueue_deque_new(3, 8);
+  assert(q);
+  assert(q->max_capacity == 8);
+  assert(cqueue_deque_pop(q, &task) == -1);
+  assert(cqueue_deque_steal(q, &task) == -1);
+  assert(cqueue_deque_get_no_used_slots(q) == 0);
+
+  // the owner pops the newest task, thieves steal the oldest
+  for (i=0; i < 3; i++)
+    assert(!cqueue_deque_push(q, deque_task, (void *)(i + 1)));
+  assert(!cqueue_deque_pop(q, &task));
+  assert(task.fn == deque_task && task.arg == (void *)3);
+  assert(!cqueue_deque_steal(q, &task));
+  assert(task.fn == deque_task && task.arg == (void *)1);
+  assert(!cqueue_deque_pop(q, &task));
+  assert(task.arg == (void *)2);
+  assert(cqueue_deque_pop(q, &task) == -1);
+  assert(cqueue_deque_steal(q, &task) == -1);
+
+  // grow from 4 to 8 slots with the tasks wrapped around the old array,
+  // then stop at max_capacity
+  for (i=0; i < 8; i++)
+    assert(!cqueue_deque_push(q, deque_task, (void *)(i + 1)));
+  assert(q->retired);
+  assert(cqueue_deque_get_no_used_slots(q) == 8);
+  assert(cqueue_deque_push(q, deque_task, NULL) == -1);
+
+  for (i=0; i < 4; i++) {
+    assert(!cqueue_deque_steal(q, &task));
+    assert(task.arg == (void *)(i + 1));
+  }
+  for (i=8; i > 4; i--) {
+    assert(!cqueue_deque_pop(q, &task));
+    assert(task.arg == (void *)i);
+  }
+  assert(cqueue_deque_get_no_used_slots(q) == 0);
+
+  cqueue_deque_delete(&q);
+  assert(!q);
+  return 1;
+}
+
+static void set_push(cqueue_spsc *q, char c) {
+  char *p = cqueue_spsc_trypush_slot(q);
+  assert(p);
+  *p = c;
+  cqueue_spsc_push_slot_finish(q);
+}
+
+int spsc_set_pass() {
+  cqueue_spsc *qs[66], *q;
+  cqueue_spsc_set *s;
+  size_t i;
+  char *p;
+
+  s = cqueue_spsc_set_new(100);
+  assert(s);
+  assert(s->n_words == 2);
+
+  // the last queue is in the second bitmap word and served twice in a row
+  for (i=0; i < 66; i++) {
+    qs[i] = cqueue_spsc_new(4, sizeof(char));
+    assert(qs[i]);
+    assert(cqueue_spsc_set_add(s, qs[i], i == 65 ? 2 : 1) == (int)i);
+  }
+  assert(cqueue_spsc_set_add(s, qs[0], 1) == -1);
+  q = cqueue_spsc_new(4, sizeof(char));
+  assert(cqueue_spsc_set_add(s, q, 0) == -1);
+  cqueue_spsc_delete(&q);
+
+  // queues start out ready, finding them empty arms them
+  assert(cqueue_spsc_set_get_no_ready(s) == 66);
+  assert(!cqueue_spsc_set_trypop_slot(s, &q));
+  assert(cqueue_spsc_set_get_no_ready(s) == 0);
+
+  // pushing to an armed queue marks it ready, once
+  set_push(qs[0], 'a');
+  set_push(qs[3], 'b');
+  set_push(qs[65], 'c');
+  set_push(qs[65], 'd');
+  set_push(qs[65], 'e');
+  assert(cqueue_spsc_set_get_no_ready(s) == 3);
+
+  // the last full scan ended on queue 0, so service resumes after it
+  p = cqueue_spsc_set_trypop_slot(s, &q);
+  assert(p && *p == 'b' && q == qs[3]);
+  cqueue_spsc_pop_slot_finish(q);
+  p = cqueue_spsc_set_trypop_slot(s, &q);
+  assert(p && *p == 'c' && q == qs[65]);
+  cqueue_spsc_pop_slot_finish(q);
+  p = cqueue_spsc_set_trypop_slot(s, &q);
+  assert(p && *p == 'd' && q == qs[65]);
+  cqueue_spsc_pop_slot_finish(q);
+  p = cqueue_spsc_set_trypop_slot(s, &q);
+  assert(p && *p == 'a' && q == qs[0]);
+  cqueue_spsc_pop_slot_finish(q);
+  p = cqueue_spsc_set_trypop_slot(s, &q);
+  assert(p && *p == 'e' && q == qs[65]);
+  cqueue_spsc_pop_slot_finish(q);
+  assert(!cqueue_spsc_set_trypop_slot(s, &q));
+  assert(cqueue_spsc_set_get_no_ready(s) == 0);
+
+  cqueue_spsc_set_delete(&s);
+  assert(!s);
+  for (i=0; i < 66; i++) {
+    assert(!qs[i]->set);
+    cqueue_spsc_delete(&qs[i]);
+  }
+  return 1;
+}
+
+int spsc_typed_pass() {
+  test_typed *q;
+  short v, *p;
+
+  q = test_typed_new();
+  assert(q);
+  assert((size_t)q % LEVEL1_DCACHE_LINESIZE == 0);
+  assert(sizeof(q->slots[0]) == LEVEL1_DCACHE_LINESIZE);
+  assert(test_typed_trypop(q, &v) == -1);
+
+  // fill, wrap around and drain
+  for (short i=0; i < 4; i++)
+    assert(!test_typed_trypush(q, i));
+  assert(test_typed_trypush(q, 4) == -1);
+  assert(test_typed_get_no_used_slots(q) == 4);
+  assert(!test_typed_trypop(q, &v) && v == 0);
+
+  p = test_typed_trypush_slot(q);
+  assert(p);
+  *p = 4;
+  test_typed_push_slot_finish(q);
+  for (short i=1; i <= 4; i++) {
+    p = test_typed_trypop_slot(q);
+    assert(p && *p == i);
+    test_typed_pop_slot_finish(q);
+  }
+  assert(!test_typed_trypop_slot(q));
+  assert(test_typed_get_no_used_slots(q) == 0);
+
+  test_typed_delete(&q);
+  assert(!q);
+  return 1;
+}
+
+int spsc_copy_pass() {
+  static unsigned char src[5000], dst[5000];
+  const size_t lens[] = { 0, 7, 64, 65, 1000, 4999 };
+  cqueue_spsc *q;
+  int copy;
+
+  for (size_t i=0; i < sizeof(src); i++)
+    src[i] = (unsigned char)(i * 7 + 1);
+
+  q = cqueue_spsc_new(2, 4999);
+  assert(q);
+  assert(q->copy == CQUEUE_COPY_AUTO);
+  assert(cqueue_spsc_trypop(q, dst, 1) == -1);
+  assert(cqueue_spsc_trypush(q, src, q->elem_size) == -1);
+
+  // every kernel the cpu has, from an unaligned source to an unaligned
+  // destination, with prefetching on
+  for (copy = CQUEUE_COPY_AUTO; copy <= CQUEUE_COPY_NT; copy++) {
+    if (cqueue_spsc_set_copy(q, copy, 1000, 1))
+      continue;
+    for (size_t l=0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+      memset(dst, 0, sizeof(dst));
+      assert(!cqueue_spsc_trypush(q, src + 1, lens[l]));
+      assert(!cqueue_spsc_push(q, src, lens[l]));
+      assert(cqueue_spsc_trypush(q, src, lens[l]) == -1);
+      assert(!cqueue_spsc_trypop(q, dst + 1, lens[l]));
+      assert(!memcmp(dst + 1, src + 1, lens[l]));
+      assert(!cqueue_spsc_pop(q, dst, lens[l]));
+      assert(!memcmp(dst, src, lens[l]));
+      assert(cqueue_spsc_trypop(q, dst, lens[l]) == -1);
+    }
+  }
+
+  cqueue_spsc_delete(&q);
+  return 1;
+}
+
+int mailbox_pass() {
+  char src[13] = "hello world!", dst[13];
+  uint64_t version = 0;
+  cqueue_mailbox *m;
+
+  assert(!cqueue_mailbox_new(0));
+  m = cqueue_mailbox_new(sizeof(src));
+  assert(m);
+
+  // never written: version 0 and zeroes
+  memset(dst, 1, sizeof(dst));
+  assert(cqueue_mailbox_read(m, dst) == 0);
+  for (size_t i=0; i < sizeof(dst); i++)
+    assert(dst[i] == 0);
+  assert(cqueue_mailbox_tryread(m, dst, &version) == -1);
+
+  cqueue_mailbox_write(m, src);
+  assert(!cqueue_mailbox_tryread(m, dst, &version));
+  assert(version == 1);
+  assert(!memcmp(dst, src, sizeof(src)));
+  assert(cqueue_mailbox_tryread(m, dst, &version) == -1);
+
+  // only the latest write is seen
+  src[0] = 'j';
+  cqueue_mailbox_write(m, src);
+  src[0] = 'c';
+  cqueue_mailbox_write(m, src);
+  assert(!cqueue_mailbox_tryread(m, dst, &version));
+  assert(version == 3);
+  assert(!memcmp(dst, "cello world!", sizeof(dst)));
+  assert(cqueue_mailbox_read(m, dst) == 3);
+
+  cqueue_mailbox_delete(&m);
+  assert(!m);
+  cqueue_mailbox_delete(&m);
+  return 1;
+}
+
+int conflate_pass() {
+  cqueue_conflate *q;
+  size_t key;
+  int v;
+
+  assert(!cqueue_conflate_new(0, sizeof(int)));
+  assert(!cqueue_conflate_new(4, 0));
+  q = cqueue_conflate_new(4, sizeof(int));
+  assert(q);
+  assert(cqueue_conflate_trypop(q, &key, &v) == -1);
+  v = 1;
+  assert(cqueue_conflate_push(q, 4, &v) == -1);
+
+  // updates to a pending key replace its value and keep its place
+  for (v=1; v <= 3; v++)
+    assert(!cqueue_conflate_push(q, 2, &v));
+  v = 10;
+  assert(!cqueue_conflate_push(q, 0, &v));
+  v = 4;
+  assert(!cqueue_conflate_push(q, 2, &v));
+  assert(cqueue_conflate_get_no_pending(q) == 2);
+
+  assert(!cqueue_conflate_trypop(q, &key, &v));
+  assert(key == 2 && v == 4);
+  assert(!cqueue_conflate_trypop(q, &key, &v));
+  assert(key == 0 && v == 10);
+  assert(cqueue_conflate_trypop(q, &key, &v) == -1);
+
+  // a popped key is queued again by its next update
+  v = 5;
+  assert(!cqueue_conflate_push(q, 2, &v));
+  assert(!cqueue_conflate_trypop(q, &key, &v));
+  assert(key == 2 && v == 5);
+  assert(cqueue_conflate_get_no_pending(q) == 0);
+
+  cqueue_conflate_delete(&q);
+  assert(!q);
+  return 1;
+}
+
+int spsc_peek_pass() {
+  cqueue_spsc *q;
+  size_t got, n;
+  int *p;
+
+  q = cqueue_spsc_new(4, sizeof(int));
+  assert(q);
+  assert(cqueue_spsc_peek(q, 4) == 0);
+
+  // move the head next to the end of the array so the run wraps
+  for (int i=0; i < 3; i++) {
+    p = cqueue_spsc_trypush_slot(q);
+    *p = -1;
+    cqueue_spsc_push_slot_finish(q);
+  }
+  assert(cqueue_spsc_peek(q, 4) == 3);
+  cqueue_spsc_pop_finish_n(q, 3);
+  assert(cqueue_spsc_get_no_used_slots(q) == 0);
+
+  p = cqueue_spsc_push_slots(q, 4, &got);
+  assert(p && got == 1);
+  *p = 0;
+  cqueue_spsc_push_slots_finish(q, 1);
+  p = cqueue_spsc_push_slots(q, 4, &got);
+  assert(p && got == 3);
+  for (int i=0; i < 3; i++)
+    *(int *)((unsigned char *)p + i * q->elem_size) = i + 1;
+  cqueue_spsc_push_slots_finish(q, 3);
+
+  // pop_slots stops at the end of the array, peek does not
+  assert(cqueue_spsc_pop_slots(q, 4, &got) && got == 1);
+  assert(cqueue_spsc_peek(q, 2) == 2);
+  n = cqueue_spsc_peek(q, 8);
+  assert(n == 4);
+  for (size_t i=0; i < n; i++)
+    assert(*(int *)cqueue_spsc_peek_slot(q, i) == (int)i);
+
+  // release part of the run, then the rest
+  cqueue_spsc_pop_finish_n(q, 2);
+  assert(cqueue_spsc_get_no_used_slots(q) == 2);
+  assert(*(int *)cqueue_spsc_peek_slot(q, 0) == 2);
+  assert(cqueue_spsc_trypush_slot(q));
+  p = cqueue_spsc_trypush_slot(q);
+  *p = 4;
+  cqueue_spsc_push_slot_finish(q);
+  assert(cqueue_spsc_peek(q, 4) == 3);
+  cqueue_spsc_pop_finish_n(q, 3);
+  assert(cqueue_spsc_peek(q, 4) == 0);
+  assert(cqueue_spsc_get_no_used_slots(q) == 0);
+  cqueue_spsc_pop_finish_n(q, 0);
+
+  cqueue_spsc_delete(&q);
+  return 1;
+}
+
+int lanes_pass() {
+  const size_t capacities[] = { 4, 16 };
+  const unsigned weights[] = { 1, 3 };
+  size_t lane, counts[2];
+  cqueue_lanes *l;
+  int *p;
+
+  assert(!cqueue_lanes_new(0, capacities, sizeof(int), CQUEUE_LANES_STRICT,
+                           NULL));
+
+  // strict: a control element overtakes the bulk elements queued before it
+  l = cqueue_lanes_new(2, capacities, sizeof(int), CQUEUE_LANES_STRICT, NULL);
+  assert(l);
+  assert(l->lanes[0]->capacity == 4 && l->lanes[1]->capacity == 16);
+  assert(!cqueue_lanes_trypop_slot(l, &lane));
+  for (int i=0; i < 16; i++) {
+    p = cqueue_lanes_trypush_slot(l, 1);
+    assert(p);
+    *p = i;
+    cqueue_lanes_push_slot_finish(l, 1);
+  }
+  assert(!cqueue_lanes_trypush_slot(l, 1));
+  p = cqueue_lanes_trypop_slot(l, &lane);
+  assert(p && lane == 1 && *p == 0);
+  cqueue_lanes_pop_slot_finish(l);
+
+  p = cqueue_lanes_trypush_slot(l, 0);
+  *p = 100;
+  cqueue_lanes_push_slot_finish(l, 0);
+  p = cqueue_lanes_trypop_slot(l, &lane);
+  assert(p && lane == 0 && *p == 100);
+  cqueue_lanes_pop_slot_finish(l);
+  for (int i=1; i < 16; i++) {
+    p = cqueue_lanes_trypop_slot(l, NULL);
+    assert(p && *p == i);
+    cqueue_lanes_pop_slot_finish(l);
+  }
+  assert(!cqueue_lanes_trypop_slot(l, &lane));
+  assert(cqueue_lanes_get_no_used_slots(l, 1) == 0);
+  cqueue_lanes_delete(&l);
+  assert(!l);
+
+  // weighted round robin: both lanes get their share
+  l = cqueue_lanes_new(2, capacities, sizeof(int), CQUEUE_LANES_WRR, weights);
+  assert(l);
+  for (size_t n=0; n < 2; n++) {
+    while ((p = cqueue_lanes_trypush_slot(l, n)) != NULL) {
+      *p = (int)n;
+      cqueue_lanes_push_slot_finish(l, n);
+    }
+  }
+  counts[0] = counts[1] = 0;
+  for (int i=0; i < 16; i++) {
+    p = cqueue_lanes_trypop_slot(l, &lane);
+    assert(p && *p == (int)lane);
+    counts[lane]++;
+    cqueue_lanes_pop_slot_finish(l);
+  }
+  assert(counts[0] == 4 && counts[1] == 12);
+  cqueue_lanes_delete(&l);
+  return 1;
+}
+
+int spsc_latency_pass() {
+  cqueue_hist hist;
+  cqueue_spsc *q;
+  size_t got;
+  void *p;
+
+  // bucket bounds: one per value up to 8, then 8 per power of 2
+  assert(cqueue_hist_bucket_low(0) == 0);
+  assert(cqueue_hist_bucket_low(7) == 7);
+  assert(cqueue_hist_bucket_low(8) == 8);
+  assert(cqueue_hist_bucket_low(15) == 15);
+  assert(cqueue_hist_bucket_low(16) == 16);
+  assert(cqueue_hist_bucket_low(17) == 18);
+  assert(cqueue_hist_bucket_low(CQUEUE_HIST_BUCKETS - 1) ==
+         UINT64_C(15) << 60);
+
+  memset(&hist, 0, sizeof(hist));
+  assert(cqueue_hist_percentile(&hist, 0.5) == 0);
+  hist.count = 4;
+  hist.max = 20;
+  hist.buckets[3] = 2;    // 3
+  hist.buckets[17] = 2;   // 18 and 19
+  assert(cqueue_hist_percentile(&hist, 0.5) == 3);
+  assert(cqueue_hist_percentile(&hist, 0.99) == 19);
+  assert(cqueue_hist_percentile(&hist, 1) == 19);
+
+  q = cqueue_spsc_new(8, sizeof(int));
+  assert(q);
+  cqueue_spsc_get_latency(q, &hist);
+  assert(hist.count == 0);
+  assert(cqueue_spsc_enable_latency(q, 0, CQUEUE_CLOCK_MONOTONIC) == -1);
+  assert(!cqueue_spsc_enable_latency(q, 3, CQUEUE_CLOCK_MONOTONIC));
+  assert(cqueue_spsc_enable_latency(q, 4, CQUEUE_CLOCK_MONOTONIC) == -1);
+
+  // period 3 is rounded to 4: elements 0, 4, 8 and 12 are sampled, across
+  // single, batch and wrapping pops
+  for (int round=0; round < 2; round++) {
+    for (int i=0; i < 2; i++) {
+      assert(cqueue_spsc_trypush_slot(q));
+      cqueue_spsc_push_slot_finish(q);
+    }
+    assert(cqueue_spsc_push_slots(q, 8, &got) && got == 6);
+    cqueue_spsc_push_slots_finish(q, 6);
+    if (!round) {
+      assert(cqueue_spsc_pop_slots(q, 8, &got) && got == 8);
+      cqueue_spsc_pop_slots_finish(q, 8);
+    } else {
+      p = cqueue_spsc_trypop_slot(q);
+      assert(p);
+      cqueue_spsc_pop_slot_finish(q);
+      assert(cqueue_spsc_peek(q, 8) == 7);
+      cqueue_spsc_pop_finish_n(q, 7);
+    }
+  }
+  cqueue_spsc_get_latency(q, &hist);
+  assert(hist.count == 4);
+  assert(cqueue_hist_percentile(&hist, 1) == hist.max);
+
+  cqueue_spsc_delete(&q);
+  return 1;
+}
+
+int pool_pass() {
+  cqueue_spsc_opts opts;
+  cqueue_pool *p;
+  void *bufs[4];
+  size_t len;
+
+  assert(!cqueue_pool_new(0, 100, NULL));
+  assert(!cqueue_pool_new(4, 0, NULL));
+
+  p = cqueue_pool_new(4, 100, NULL);
+  assert(p);
+  assert(p->buf_size == 128);
+  assert(cqueue_pool_get_no_free(p) == 4);
+  assert(!cqueue_pool_tryrecv(p, &len));
+
+  // distinct, cacheline aligned buffers until the pool runs out
+  for (int i=0; i < 4; i++) {
+    bufs[i] = cqueue_pool_tryalloc(p);
+    assert(bufs[i]);
+    assert((uintptr_t)bufs[i] % LEVEL1_DCACHE_LINESIZE == 0);
+    for (int j=0; j < i; j++)
+      assert(bufs[i] != bufs[j]);
+    memset(bufs[i], i, 100);
+  }
+  assert(!cqueue_pool_tryalloc(p));
+  assert(cqueue_pool_get_no_free(p) == 0);
+
+  // the consumer sees the producer's buffers, in order, in place
+  for (int i=0; i < 4; i++)
+    cqueue_pool_send(p, bufs[i], 10 + i);
+  for (int i=0; i < 4; i++) {
+    assert(cqueue_pool_recv(p, &len) == bufs[i]);
+    assert(len == (size_t)(10 + i));
+    assert(((unsigned char *)bufs[i])[99] == i);
+  }
+  assert(!cqueue_pool_tryrecv(p, &len));
+
+  // freed buffers come back to the producer in the order they were freed
+  cqueue_pool_free(p, bufs[2]);
+  cqueue_pool_free(p, bufs[0]);
+  assert(cqueue_pool_get_no_free(p) == 2);
+  assert(cqueue_pool_alloc(p) == bufs[2]);
+  assert(cqueue_pool_tryalloc(p) == bufs[0]);
+  cqueue_pool_delete(&p);
+  assert(!p);
+
+  cqueue_spsc_opts_init(&opts);
+  opts.line_size = 256;
+  opts.prefault = 1;
+  p = cqueue_pool_new(3, 300, &opts);
+  assert(p);
+  assert(p->buf_size == 512);
+  assert(cqueue_pool_get_no_free(p) == 3);
+  cqueue_pool_delete(&p);
+  return 1;
+}
+
+#ifdef CQUEUE_STATS
+int spsc_stats_pass() {
+  cqueue_spsc_stats stats;
+  cqueue_spsc *q;
+  size_t got;
+
+  q = cqueue_spsc_new(4, sizeof(char));
+  assert(q);
+
+  // the counters share their side's cacheline
+  assert((char *)(void *)&q->high_water - (char *)(void *)&q->push_idx
+         < LEVEL1_DCACHE_LINESIZE);
+  assert((char *)(void *)&q->pop_spins - (char *)(void *)&q->pop_idx
+         < LEVEL1_DCACHE_LINESIZE);
+
+  assert(!cqueue_spsc_trypop_slot(q));
+  for (int i=0; i < 3; i++) {
+    assert(cqueue_spsc_trypush_slot(q));
+    cqueue_spsc_push_slot_finish(q);
+  }
+  assert(cqueue_spsc_trypop_slot(q));
+  cqueue_spsc_pop_slot_finish(q);
+  assert(cqueue_spsc_push_slots(q, 4, &got));
+  assert(got == 1);  // stops at the end of the array
+  cqueue_spsc_push_slots_finish(q, got);
+  assert(cqueue_spsc_trypush_slot(q));
+  cqueue_spsc_push_slot_finish(q);
+  assert(!cqueue_spsc_trypush_slot(q));
+  assert(!cqueue_spsc_push_slots(q, 1, &got));
+
+  // a timed out blocking push waits at least once
+  assert(!cqueue_spsc_push_slot_timeout(q, 1000));
+
+  cqueue_spsc_get_stats(q, &stats);
+  assert(stats.pushes == 5);
+  assert(stats.pops == 1);
+  assert(stats.push_full == 2);
+  assert(stats.pop_empty == 1);
+  assert(stats.push_spins > 0);
+  assert(stats.pop_spins == 0);
+  assert(stats.high_water == 4);
+
+  cqueue_spsc_delete(&q);
+  return 1;
+}
+#endif
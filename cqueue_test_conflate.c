@@ -0,0 +1,177 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+
+#define READERS 2
+#define WORDS 8         // every word of a value holds the same number
+#define KEYS 16
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  uint64_t limit;
+  uint64_t reads;         // number of values read or popped
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static cqueue_mailbox *m;
+static cqueue_conflate *q;
+static _Atomic int writer_done;
+
+void *mailbox_writer(void *targ);
+void *mailbox_reader(void *targ);
+void *conflate_producer(void *targ);
+static void check_value(const uint64_t *v);
+
+int main(int argc, char** argv) {
+  struct thread_args wargs, rargs[READERS];
+  uint64_t v[WORDS], last[KEYS] = { 0 }, expected, pops = 0;
+  pthread_t wt, rt[READERS];
+  long passes, d;
+  size_t key;
+  int i, done;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // readers never see a torn value or go back in time
+  m = cqueue_mailbox_new(sizeof(v));
+  if (!m) {
+    printf("Error: cqueue_mailbox_new failed\n");
+    exit(EXIT_FAILURE);
+  }
+  atomic_init(&writer_done, 0);
+  wargs.limit = passes;
+  for (i=0; i < READERS; i++) {
+    rargs[i].limit = passes;
+    rargs[i].reads = 0;
+    pthread_create(&rt[i], NULL, &mailbox_reader, &rargs[i]);
+  }
+  pthread_create(&wt, NULL, &mailbox_writer, &wargs);
+  pthread_join(wt, NULL);
+  for (i=0; i < READERS; i++) {
+    pthread_join(rt[i], NULL);
+    printf("mailbox reader %d: %" PRIu64 " reads of %ld writes\n", i,
+           rargs[i].reads, passes);
+  }
+  cqueue_mailbox_delete(&m);
+
+  // the consumer sees the updates of each key in order, and the last one
+  q = cqueue_conflate_new(KEYS, sizeof(v));
+  if (!q) {
+    printf("Error: cqueue_conflate_new failed\n");
+    exit(EXIT_FAILURE);
+  }
+  atomic_store(&writer_done, 0);
+  pthread_create(&wt, NULL, &conflate_producer, &wargs);
+  do {
+    done = atomic_load_explicit(&writer_done, memory_order_acquire);
+    while (!cqueue_conflate_trypop(q, &key, v)) {
+      check_value(v);
+      if (v[0] <= last[key] || v[0] % KEYS != key) {
+        printf("Error: key %zu went from %" PRIu64 " to %" PRIu64 "\n", key,
+               last[key], v[0]);
+        exit(EXIT_FAILURE);
+      }
+      last[key] = v[0];
+      pops++;
+    }
+    sched_yield();
+  } while (!done);
+  pthread_join(wt, NULL);
+
+  for (key=0; key < KEYS; key++) {
+    // the largest data up to passes pushed to key, if any
+    d = passes - ((passes - (long)key) % KEYS + KEYS) % KEYS;
+    expected = d > 0 ? (uint64_t)d : 0;
+    if (last[key] != expected) {
+      printf("Error: key %zu ended at %" PRIu64 ", expected %" PRIu64 "\n",
+             key, last[key], expected);
+      exit(EXIT_FAILURE);
+    }
+  }
+  printf("conflate: %" PRIu64 " pops of %ld pushes\n", pops, passes);
+  cqueue_conflate_delete(&q);
+
+  exit(EXIT_SUCCESS);
+}
+
+void *mailbox_writer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t v[WORDS];
+
+  for (uint64_t data=1; data <= args->limit; data++) {
+    for (int i=0; i < WORDS; i++)
+      v[i] = data;
+    cqueue_mailbox_write(m, v);
+    // let the readers in when the threads share a cpu
+    if (data % 64 == 0)
+      sched_yield();
+  }
+
+  atomic_store_explicit(&writer_done, 1, memory_order_release);
+  pthread_exit(NULL);
+}
+
+void *mailbox_reader(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t v[WORDS], version = 0, prev = 0;
+  int done;
+
+  do {
+    done = atomic_load_explicit(&writer_done, memory_order_acquire);
+    if (cqueue_mailbox_tryread(m, v, &version)) {
+      sched_yield();
+      continue;
+    }
+    check_value(v);
+    // the version counts the writes, and the writer writes its count
+    if (v[0] != version || version <= prev) {
+      printf("Error: read %" PRIu64 " as version %" PRIu64 " after %" PRIu64
+             "\n", v[0], version, prev);
+      exit(EXIT_FAILURE);
+    }
+    prev = version;
+    args->reads++;
+  } while (!done);
+
+  // the last write is never lost
+  if (version != args->limit) {
+    printf("Error: last read version %" PRIu64 ", expected %" PRIu64 "\n",
+           version, args->limit);
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *conflate_producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t v[WORDS];
+
+  // data is pushed to key data % KEYS
+  for (uint64_t data=1; data <= args->limit; data++) {
+    for (int i=0; i < WORDS; i++)
+      v[i] = data;
+    cqueue_conflate_push(q, data % KEYS, v);
+    if (data % 64 == 0)
+      sched_yield();
+  }
+
+  atomic_store_explicit(&writer_done, 1, memory_order_release);
+  pthread_exit(NULL);
+}
+
+void check_value(const uint64_t *v) {
+  for (int i=1; i < WORDS; i++) {
+    if (v[i] != v[0]) {
+      printf("Error: torn value, word %d is %" PRIu64 " not %" PRIu64 "\n", i,
+             v[i], v[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
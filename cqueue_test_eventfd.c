@@ -0,0 +1,128 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>   // PRIu64
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "cqueue.h"
+
+#define BURST 1000        // elements pushed between idle periods
+#define IDLE_NS 100000    // how long the producer leaves the consumer idle
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t limit;
+  uint64_t waits;         // number of times the thread waited in epoll
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+void *producer(void *targ);
+void *consumer(void *targ);
+static int epoll_for(int fd);
+static void wait_for(int epfd);
+
+int main(int argc, char** argv) {
+  struct thread_args pargs, cargs;
+  pthread_t pt, ct;
+  cqueue_spsc *q;
+  long passes;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  q = cqueue_spsc_new(64, sizeof(uint64_t));
+  if (!q || cqueue_spsc_enable_fds(q)) {
+    printf("Error: queue setup failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pargs.q = cargs.q = q;
+  pargs.limit = cargs.limit = passes;
+  pargs.waits = cargs.waits = 0;
+  pthread_create(&ct, NULL, &consumer, &cargs);
+  pthread_create(&pt, NULL, &producer, &pargs);
+  pthread_join(pt, NULL);
+  pthread_join(ct, NULL);
+
+  printf("elements: %ld\n", passes);
+  printf("producer epoll waits: %" PRIu64 "\n", pargs.waits);
+  printf("consumer epoll waits: %" PRIu64 "\n", cargs.waits);
+
+  cqueue_spsc_delete(&q);
+  exit(EXIT_SUCCESS);
+}
+
+static int epoll_for(int fd) {
+  struct epoll_event ev = { .events = EPOLLIN };
+  int epfd = epoll_create1(0);
+
+  if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+    printf("Error: epoll setup failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return epfd;
+}
+
+static void wait_for(int epfd) {
+  struct epoll_event ev;
+
+  while (epoll_wait(epfd, &ev, 1, -1) != 1);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  struct timespec idle = { 0, IDLE_NS };
+  int epfd = epoll_for(cqueue_spsc_get_push_fd(args->q));
+  uint64_t data;
+  uint64_t *p;
+
+  for (data=1; data <= args->limit; data++) {
+    while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL) {
+      // full: arm, and only wait if the queue is still full
+      if (!cqueue_spsc_arm_push_fd(args->q)) {
+        wait_for(epfd);
+        args->waits++;
+      }
+    }
+    *p = data;
+    cqueue_spsc_push_slot_finish(args->q);
+
+    if (data % BURST == 0)
+      nanosleep(&idle, NULL);
+  }
+
+  close(epfd);
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  int epfd = epoll_for(cqueue_spsc_get_pop_fd(args->q));
+  uint64_t expected = 1;
+  uint64_t *p;
+
+  while (expected <= args->limit) {
+    // drain everything that is there
+    while ((p = cqueue_spsc_trypop_slot(args->q)) != NULL) {
+      if (*p != expected) {
+        printf("Error: expected %" PRIu64 ", got %" PRIu64 "\n", expected, *p);
+        exit(EXIT_FAILURE);
+      }
+      cqueue_spsc_pop_slot_finish(args->q);
+      expected++;
+    }
+
+    // empty: arm, and only wait if the queue is still empty
+    if (expected <= args->limit && !cqueue_spsc_arm_pop_fd(args->q)) {
+      wait_for(epfd);
+      args->waits++;
+    }
+  }
+
+  close(epfd);
+  pthread_exit(NULL);
+}
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue_exec.h"
+
+#define THIEVES 3
+#define WORKERS 4
+#define FIB_N 22
+#define FIB_CUTOFF 8
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_deque *q;
+  uint64_t limit;
+  uint64_t sum;           // sum of the args of the tasks taken
+  uint64_t count;         // number of tasks taken
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+struct fib_args {
+  unsigned n;
+  uint64_t result;
+  _Atomic size_t *pending;
+};
+
+static cqueue_exec *exec;
+static _Atomic int owner_done;
+
+void *owner(void *targ);
+void *thief(void *targ);
+static void nop_task(void *arg);
+static void fib_task(void *arg);
+static uint64_t fib(unsigned n);
+static uint64_t fib_serial(unsigned n);
+
+int main(int argc, char** argv) {
+  struct thread_args oargs, targs[THIEVES];
+  pthread_t ot, tt[THIEVES];
+  uint64_t sum, count, expected;
+  cqueue_deque *q;
+  long passes;
+  int i, mode;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // every task pushed by the owner is taken exactly once, by the owner or
+  // by one of the thieves; start small so the deque grows under them
+  q = cqueue_deque_new(4, 1024);
+  if (!q) {
+    printf("Error: cqueue_deque_new failed\n");
+    exit(EXIT_FAILURE);
+  }
+  atomic_init(&owner_done, 0);
+  oargs.q = q;
+  oargs.limit = passes;
+  oargs.sum = oargs.count = 0;
+  for (i=0; i < THIEVES; i++) {
+    targs[i] = oargs;
+    pthread_create(&tt[i], NULL, &thief, &targs[i]);
+  }
+  pthread_create(&ot, NULL, &owner, &oargs);
+  pthread_join(ot, NULL);
+  sum = oargs.sum;
+  count = oargs.count;
+  for (i=0; i < THIEVES; i++) {
+    pthread_join(tt[i], NULL);
+    sum += targs[i].sum;
+    count += targs[i].count;
+  }
+  if (count != (uint64_t)passes || sum != (uint64_t)passes * (passes + 1) / 2) {
+    printf("Error: %" PRIu64 " tasks taken, expected %ld\n", count, passes);
+    exit(EXIT_FAILURE);
+  }
+  printf("deque: %ld tasks, %" PRIu64 " stolen\n", passes, count - oargs.count);
+  cqueue_deque_delete(&q);
+
+  // fork-join through the executor in both modes
+  expected = fib_serial(FIB_N);
+  for (mode = CQUEUE_EXEC_STEAL; mode <= CQUEUE_EXEC_SHARED; mode++) {
+    exec = cqueue_exec_new(WORKERS, 256, mode);
+    if (!exec) {
+      printf("Error: cqueue_exec_new failed\n");
+      exit(EXIT_FAILURE);
+    }
+    if (fib(FIB_N) != expected) {
+      printf("Error: fib(%d) mismatch\n", FIB_N);
+      exit(EXIT_FAILURE);
+    }
+    printf("exec %s: fib(%d) = %" PRIu64 "\n",
+           mode == CQUEUE_EXEC_STEAL ? "steal" : "shared", FIB_N, expected);
+    cqueue_exec_delete(&exec);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *owner(void *targ) {
+  struct thread_args *args = targ;
+  cqueue_task task;
+  uint64_t data;
+
+  // push in bursts and pop some back, like a worker spawning children
+  for (data=1; data <= args->limit; data++) {
+    while (cqueue_deque_push(args->q, nop_task, (void *)(uintptr_t)data))
+      sched_yield();
+    if (data % 3 == 0 && !cqueue_deque_pop(args->q, &task)) {
+      args->sum += (uintptr_t)task.arg;
+      args->count++;
+    }
+  }
+  while (!cqueue_deque_pop(args->q, &task)) {
+    args->sum += (uintptr_t)task.arg;
+    args->count++;
+  }
+
+  atomic_store_explicit(&owner_done, 1, memory_order_release);
+  pthread_exit(NULL);
+}
+
+void *thief(void *targ) {
+  struct thread_args *args = targ;
+  cqueue_task task;
+  int ret;
+
+  while (1) {
+    ret = cqueue_deque_steal(args->q, &task);
+    if (!ret) {
+      if (task.fn != nop_task) {
+        printf("Error: stole a torn task\n");
+        exit(EXIT_FAILURE);
+      }
+      args->sum += (uintptr_t)task.arg;
+      args->count++;
+    } else if (ret < 0) {
+      if (atomic_load_explicit(&owner_done, memory_order_acquire))
+        break;
+      sched_yield();
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+void nop_task(void *arg) {
+  (void)arg;
+}
+
+void fib_task(void *arg) {
+  struct fib_args *a = arg;
+
+  a->result = fib(a->n);
+  atomic_fetch_sub_explicit(a->pending, 1, memory_order_release);
+}
+
+uint64_t fib(unsigned n) {
+  _Atomic size_t pending;
+  struct fib_args child;
+  uint64_t result;
+
+  if (n < FIB_CUTOFF)
+    return fib_serial(n);
+
+  atomic_init(&pending, 1);
+  child.n = n - 1;
+  child.pending = &pending;
+  cqueue_exec_submit(exec, fib_task, &child);
+  result = fib(n - 2);
+  cqueue_exec_wait(exec, &pending);
+  return result + child.result;
+}
+
+uint64_t fib_serial(unsigned n) {
+  return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
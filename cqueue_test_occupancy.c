@@ -0,0 +1,171 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+
+#define CAPACITY 16
+#define BUFFERS 12      // not a power of 2, unlike the pool's rings
+
+typedef enum {
+  SPSC,
+  UNBOUNDED,
+  POOL            // free buffers rather than used slots
+} queue_type;
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  queue_type type;
+  void *q;
+  uint64_t limit;
+  uint64_t sum;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static const char *names[] = { "spsc", "unbounded", "pool" };
+static _Atomic int consumer_done;
+
+void *producer(void *targ);
+void *consumer(void *targ);
+static void check_occupancy(const struct thread_args *args, const char *who);
+
+int main(int argc, char** argv) {
+  struct thread_args pargs, cargs;
+  uint64_t polls;
+  pthread_t pt, ct;
+  queue_type type;
+  long passes;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // a third thread, which synchronizes with neither side, polls occupancy
+  for (type = SPSC; type <= POOL; type++) {
+    if (type == SPSC)
+      cargs.q = cqueue_spsc_new(CAPACITY, sizeof(uint64_t));
+    else if (type == UNBOUNDED)
+      cargs.q = cqueue_spsc_unbounded_new(CAPACITY, sizeof(uint64_t), 0);
+    else
+      cargs.q = cqueue_pool_new(BUFFERS, sizeof(uint64_t), NULL);
+    if (!cargs.q) {
+      printf("Error: %s queue allocation failed\n", names[type]);
+      exit(EXIT_FAILURE);
+    }
+    pargs.q = cargs.q;
+    pargs.type = cargs.type = type;
+    pargs.limit = cargs.limit = passes;
+    cargs.sum = 0;
+    polls = 0;
+    atomic_store(&consumer_done, 0);
+
+    pthread_create(&ct, NULL, &consumer, &cargs);
+    pthread_create(&pt, NULL, &producer, &pargs);
+    while (!atomic_load_explicit(&consumer_done, memory_order_acquire)) {
+      check_occupancy(&cargs, "monitor");
+      if (++polls % 64 == 0)
+        sched_yield();
+    }
+    pthread_join(pt, NULL);
+    pthread_join(ct, NULL);
+
+    if (cargs.sum != (uint64_t)passes * (passes + 1) / 2) {
+      printf("Error: %s checksum mismatch\n", names[type]);
+      exit(EXIT_FAILURE);
+    }
+    printf("%s: %" PRIu64 " polls of %ld pushes\n", names[type], polls,
+           passes);
+
+    if (type == SPSC)
+      cqueue_spsc_delete((cqueue_spsc **)&cargs.q);
+    else if (type == UNBOUNDED)
+      cqueue_spsc_unbounded_delete((cqueue_spsc_unbounded **)&cargs.q);
+    else
+      cqueue_pool_delete((cqueue_pool **)&cargs.q);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t *p;
+
+  for (uint64_t data=1; data <= args->limit; data++) {
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypush_slot(args->q)) == NULL)
+        sched_yield();
+      *p = data;
+      cqueue_spsc_push_slot_finish(args->q);
+    } else if (args->type == UNBOUNDED) {
+      while ((p = cqueue_spsc_unbounded_trypush_slot(args->q)) == NULL)
+        sched_yield();
+      *p = data;
+      cqueue_spsc_unbounded_push_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_pool_tryalloc(args->q)) == NULL)
+        sched_yield();
+      *p = data;
+      cqueue_pool_send(args->q, p, sizeof(*p));
+    }
+    // the producer may poll its own queue too
+    check_occupancy(args, "producer");
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t *p;
+  size_t len;
+
+  for (uint64_t i=0; i < args->limit; i++) {
+    if (args->type == SPSC) {
+      while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+        sched_yield();
+      args->sum += *p;
+      cqueue_spsc_pop_slot_finish(args->q);
+    } else if (args->type == UNBOUNDED) {
+      while ((p = cqueue_spsc_unbounded_trypop_slot(args->q)) == NULL)
+        sched_yield();
+      args->sum += *p;
+      cqueue_spsc_unbounded_pop_slot_finish(args->q);
+    } else {
+      while ((p = cqueue_pool_tryrecv(args->q, &len)) == NULL)
+        sched_yield();
+      args->sum += *p;
+      cqueue_pool_free(args->q, p);
+    }
+    check_occupancy(args, "consumer");
+  }
+
+  atomic_store_explicit(&consumer_done, 1, memory_order_release);
+  pthread_exit(NULL);
+}
+
+/*! Check the occupancy of args->q is within its capacity, for an unbounded
+ queue has not wrapped below 0, or for a pool that the free buffers are
+ within n_buffers
+*/
+void check_occupancy(const struct thread_args *args, const char *who) {
+  size_t n, max;
+
+  if (args->type == SPSC) {
+    n = cqueue_spsc_get_no_used_slots(args->q);
+    max = ((cqueue_spsc *)args->q)->capacity;
+  } else if (args->type == UNBOUNDED) {
+    n = cqueue_spsc_unbounded_get_no_used_slots(args->q);
+    max = args->limit;
+  } else {
+    n = cqueue_pool_get_no_free(args->q);
+    max = ((cqueue_pool *)args->q)->n_buffers;
+  }
+  if (n > max) {
+    printf("Error: %s %s occupancy %zu exceeds %zu\n", names[args->type], who,
+           n, max);
+    exit(EXIT_FAILURE);
+  }
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <sched.h>
 #include "cqueue.h"
 
 #define NUM_THREADS 2
@@ -84,7 +85,7 @@ void *passer(void *targ) {
     while ((p = cqueue_spsc_trypop_slot(args->in)) == NULL) {
       // yielding hurts when NUM_THREADS == NUM_CPUS, however it lowers
       // the real time to completion when NUM_THREADS > NUM_CPUS
-      pthread_yield();
+      sched_yield();
     }
     data = *p;
     cqueue_spsc_pop_slot_finish(args->in);
@@ -104,7 +105,7 @@ void *passer(void *targ) {
     cqueue_spsc_push_slot_finish(args->out);
 
     args->passes++;
-    pthread_yield();
+    sched_yield();
   }
 
   for (int i=0; i < NUM_THREADS; i++)
@@ -0,0 +1,167 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue_pipeline.h"
+
+static uint64_t sink_sum;
+
+static int add_one(void *arg, const void *in, void *out);
+static int drop_odd(void *arg, const void *in, void *out);
+static int widen(void *arg, const void *in, void *out);
+static int sink(void *arg, const void *in, void *out);
+static void push_all(cqueue_pipeline *p, long passes, uint64_t *sum);
+static void drain(cqueue_pipeline *p, uint64_t *sum);
+static void check_stats(cqueue_pipeline *p);
+static void print_stats(cqueue_pipeline *p);
+static void fail(const char *msg);
+
+int main(int argc, char** argv) {
+  cqueue_stage stages[3] = {
+    { add_one, NULL, sizeof(uint32_t), 64, 16, -1 },
+    { drop_odd, NULL, sizeof(uint32_t), 64, 8, -1 },
+    { sink, &sink_sum, 0, 0, 32, -1 },
+  };
+  cqueue_pipeline *p;
+  uint64_t expected, sum;
+  long passes;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // invalid descriptions
+  if (cqueue_pipeline_new(stages, 0, sizeof(uint32_t), 64))
+    fail("pipeline without stages");
+  if (cqueue_pipeline_new(stages, 3, 0, 64))
+    fail("pipeline without input");
+  stages[1].out_size = 0;
+  if (cqueue_pipeline_new(stages, 3, sizeof(uint32_t), 64))
+    fail("middle stage without output");
+  stages[1].out_size = sizeof(uint32_t);
+
+  // 1..passes, plus one, keeping the even ones, summed by the last stage
+  expected = 0;
+  for (uint64_t i=2; i <= (uint64_t)passes + 1; i += 2)
+    expected += i;
+
+  p = cqueue_pipeline_new(stages, 3, sizeof(uint32_t), 64);
+  if (!p)
+    fail("cqueue_pipeline_new failed");
+  if (cqueue_pipeline_get_output(p))
+    fail("output queue behind a sink");
+  push_all(p, passes, NULL);
+  cqueue_pipeline_finish(p);
+  if (sink_sum != expected)
+    fail("sink sum mismatch");
+  print_stats(p);
+  cqueue_pipeline_delete(&p);
+
+  // a single stage pinned to cpu 0, its output popped meanwhile
+  stages[0].fn = widen;
+  stages[0].out_size = sizeof(uint64_t);
+  stages[0].cpu = 0;
+  p = cqueue_pipeline_new(stages, 1, sizeof(uint32_t), 64);
+  if (!p)
+    fail("cqueue_pipeline_new failed");
+  sum = 0;
+  push_all(p, passes, &sum);
+  while (cqueue_spsc_get_no_used_slots(cqueue_pipeline_get_input(p)))
+    drain(p, &sum);
+  cqueue_pipeline_finish(p);
+  drain(p, &sum);
+  if (sum != (uint64_t)passes * (passes + 1) / 2)
+    fail("output sum mismatch");
+  print_stats(p);
+  cqueue_pipeline_delete(&p);
+
+  exit(EXIT_SUCCESS);
+}
+
+int add_one(void *arg, const void *in, void *out) {
+  (void)arg;
+  *(uint32_t *)out = *(const uint32_t *)in + 1;
+  return 1;
+}
+
+int drop_odd(void *arg, const void *in, void *out) {
+  (void)arg;
+  if (*(const uint32_t *)in & 1)
+    return 0;
+  *(uint32_t *)out = *(const uint32_t *)in;
+  return 1;
+}
+
+int widen(void *arg, const void *in, void *out) {
+  (void)arg;
+  *(uint64_t *)out = *(const uint32_t *)in;
+  return 1;
+}
+
+int sink(void *arg, const void *in, void *out) {
+  (void)out;
+  *(uint64_t *)arg += *(const uint32_t *)in;
+  return 0;
+}
+
+/*! Push 1..passes to the pipeline, adding its output to sum meanwhile
+ unless sum is NULL
+*/
+void push_all(cqueue_pipeline *p, long passes, uint64_t *sum) {
+  cqueue_spsc *in = cqueue_pipeline_get_input(p);
+  uint32_t *v;
+
+  for (uint32_t i=1; i <= (uint32_t)passes; i++) {
+    while ((v = cqueue_spsc_trypush_slot(in)) == NULL) {
+      if (sum)
+        drain(p, sum);
+      check_stats(p);
+      sched_yield();
+    }
+    *v = i;
+    cqueue_spsc_push_slot_finish(in);
+  }
+}
+
+/*! Add the output waiting in the pipeline's output queue to sum
+*/
+void drain(cqueue_pipeline *p, uint64_t *sum) {
+  cqueue_spsc *out = cqueue_pipeline_get_output(p);
+  uint64_t *v;
+
+  while ((v = cqueue_spsc_trypop_slot(out)) != NULL) {
+    *sum += *v;
+    cqueue_spsc_pop_slot_finish(out);
+  }
+}
+
+/*! Check the occupancy of every stage, read from a thread that is not the
+ consumer of most of the queues, is within their capacity
+*/
+void check_stats(cqueue_pipeline *p) {
+  cqueue_pipeline_stats stats;
+
+  for (size_t i=0; cqueue_pipeline_get_stats(p, i, &stats) == 0; i++)
+    if (stats.occupancy > stats.capacity)
+      fail("occupancy exceeds capacity");
+}
+
+void print_stats(cqueue_pipeline *p) {
+  cqueue_pipeline_stats stats;
+
+  for (size_t i=0; cqueue_pipeline_get_stats(p, i, &stats) == 0; i++) {
+    printf("stage %zu: %" PRIu64 " in, %" PRIu64 " out, %" PRIu64 " idle, %"
+           PRIu64 " stalls, %.3f Mmsgs/s, %zu/%zu queued\n", i,
+           stats.processed, stats.emitted, stats.idle, stats.stalls,
+           stats.rate / 1e6, stats.occupancy, stats.capacity);
+    if (stats.occupancy)
+      fail("input left behind");
+  }
+}
+
+void fail(const char *msg) {
+  printf("Error: %s\n", msg);
+  exit(EXIT_FAILURE);
+}
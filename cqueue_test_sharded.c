@@ -0,0 +1,170 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue_sharded.h"
+
+#define SHARDS 4
+#define KEYS 64
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t sum;
+  uint64_t last[KEYS];    // the last element seen of each key
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+void *consumer(void *targ);
+static void check_policies(void);
+static void fail(const char *msg);
+
+int main(int argc, char** argv) {
+  struct thread_args cargs[SHARDS];
+  pthread_t ct[SHARDS];
+  cqueue_sharded *s;
+  uint64_t data, sum;
+  uint64_t *p;
+  size_t shard;
+  long passes;
+  int i;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  check_policies();
+
+  // each key sticks to one shard, so its consumer sees it in order;
+  // element 0 tells the consumers to stop
+  s = cqueue_sharded_new(SHARDS, 64, sizeof(uint64_t), CQUEUE_SHARDED_HASH, 0);
+  if (!s)
+    fail("cqueue_sharded_new failed");
+  for (i=0; i < SHARDS; i++) {
+    cargs[i].q = cqueue_sharded_get_shard(s, i);
+    cargs[i].sum = 0;
+    for (int k=0; k < KEYS; k++)
+      cargs[i].last[k] = 0;
+    pthread_create(&ct[i], NULL, &consumer, &cargs[i]);
+  }
+  for (data=1; data <= (uint64_t)passes; data++) {
+    while ((p = cqueue_sharded_trypush_slot(s, data % KEYS, &shard)) == NULL)
+      sched_yield();
+    *p = data;
+    cqueue_sharded_push_slot_finish(s, shard);
+  }
+  for (i=0; i < SHARDS; i++) {
+    while ((p = cqueue_spsc_trypush_slot(cargs[i].q)) == NULL)
+      sched_yield();
+    *p = 0;
+    cqueue_spsc_push_slot_finish(cargs[i].q);
+  }
+
+  sum = 0;
+  for (i=0; i < SHARDS; i++) {
+    pthread_join(ct[i], NULL);
+    printf("shard %d: sum %" PRIu64 "\n", i, cargs[i].sum);
+    sum += cargs[i].sum;
+  }
+  if (sum != (uint64_t)passes * (passes + 1) / 2)
+    fail("checksum mismatch");
+  cqueue_sharded_delete(&s);
+
+  exit(EXIT_SUCCESS);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  uint64_t data;
+  uint64_t *p;
+
+  while (1) {
+    while ((p = cqueue_spsc_trypop_slot(args->q)) == NULL)
+      sched_yield();
+    data = *p;
+    cqueue_spsc_pop_slot_finish(args->q);
+    if (!data)
+      break;
+    if (data <= args->last[data % KEYS])
+      fail("elements of a key out of order");
+    args->last[data % KEYS] = data;
+    args->sum += data;
+  }
+
+  pthread_exit(NULL);
+}
+
+void check_policies(void) {
+  cqueue_sharded *s;
+  size_t shard, first;
+  int i;
+
+  // round robin visits every shard in turn
+  s = cqueue_sharded_new(3, 2, sizeof(int), CQUEUE_SHARDED_ROUND_ROBIN, 0);
+  if (!s)
+    fail("cqueue_sharded_new failed");
+  for (i=0; i < 6; i++) {
+    if (!cqueue_sharded_trypush_slot(s, 0, &shard) || shard != (size_t)i % 3)
+      fail("round robin out of turn");
+    cqueue_sharded_push_slot_finish(s, shard);
+  }
+  // all full, and without spill a full shard is not skipped
+  if (cqueue_sharded_trypush_slot(s, 0, &shard))
+    fail("pushed to a full shard");
+  cqueue_spsc_trypop_slot(cqueue_sharded_get_shard(s, 2));
+  cqueue_spsc_pop_slot_finish(cqueue_sharded_get_shard(s, 2));
+  if (cqueue_sharded_trypush_slot(s, 0, &shard))
+    fail("skipped a full shard without spill");
+  cqueue_sharded_delete(&s);
+
+  // with spill, a full shard is skipped
+  s = cqueue_sharded_new(3, 2, sizeof(int), CQUEUE_SHARDED_HASH, 1);
+  if (!s)
+    fail("cqueue_sharded_new failed");
+  if (!cqueue_sharded_trypush_slot(s, 42, &first))
+    fail("push failed");
+  cqueue_sharded_push_slot_finish(s, first);
+  if (!cqueue_sharded_trypush_slot(s, 42, &shard) || shard != first)
+    fail("hash moved a key");
+  cqueue_sharded_push_slot_finish(s, shard);
+  if (!cqueue_sharded_trypush_slot(s, 42, &shard) || shard != (first + 1) % 3)
+    fail("spill did not go to the next shard");
+  cqueue_sharded_push_slot_finish(s, shard);
+  cqueue_sharded_delete(&s);
+
+  // least loaded fills the shard a consumer drains
+  s = cqueue_sharded_new(4, 8, sizeof(int), CQUEUE_SHARDED_LEAST_LOADED, 0);
+  if (!s)
+    fail("cqueue_sharded_new failed");
+  for (i=0; i < 16; i++) {
+    if (!cqueue_sharded_trypush_slot(s, 0, &shard))
+      fail("push failed");
+    cqueue_sharded_push_slot_finish(s, shard);
+  }
+  for (i=0; i < 4; i++) {
+    if (cqueue_spsc_get_no_used_slots(cqueue_sharded_get_shard(s, i)) != 4)
+      fail("least loaded did not balance");
+  }
+  for (i=0; i < 4; i++) {
+    cqueue_spsc_trypop_slot(cqueue_sharded_get_shard(s, 1));
+    cqueue_spsc_pop_slot_finish(cqueue_sharded_get_shard(s, 1));
+  }
+  // estimates are at most a round of pushes stale
+  for (i=0; i < 8; i++) {
+    if (!cqueue_sharded_trypush_slot(s, 0, &shard))
+      fail("push failed");
+    cqueue_sharded_push_slot_finish(s, shard);
+  }
+  if (cqueue_spsc_get_no_used_slots(cqueue_sharded_get_shard(s, 1)) < 4)
+    fail("least loaded ignored the drained shard");
+  cqueue_sharded_delete(&s);
+
+  printf("policies: ok\n");
+}
+
+void fail(const char *msg) {
+  printf("Error: %s\n", msg);
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>   // PRIu64
+#include <unistd.h>     // fork, close
+#include <sys/mman.h>   // memfd_create, shm_unlink
+#include <sys/wait.h>   // waitpid
+#include "cqueue.h"
+
+#define SHM_NAME "/cqueue_test_shm"
+
+static void pass(cqueue_spsc *q, int fd, const char *name, uint64_t limit);
+static void consumer(int fd, const char *name, uint64_t limit);
+
+int main(int argc, char** argv) {
+  cqueue_spsc *q;
+  long passes;
+  int fd;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // anonymous file, the consumer attaches through the inherited fd
+  fd = memfd_create("cqueue_test_shm", 0);
+  q = fd < 0 ? NULL : cqueue_spsc_new_shm_fd(fd, 64, sizeof(uint64_t));
+  if (!q) {
+    printf("Error: cqueue_spsc_new_shm_fd failed\n");
+    exit(EXIT_FAILURE);
+  }
+  if (cqueue_spsc_attach_shm_fd(fd, sizeof(uint32_t))) {
+    printf("Error: attached with a mismatched elem_size\n");
+    exit(EXIT_FAILURE);
+  }
+  pass(q, fd, NULL, passes);
+  cqueue_spsc_delete(&q);
+  close(fd);
+  printf("memfd: %ld elements passed\n", passes);
+
+  // named object, the consumer attaches by name
+  shm_unlink(SHM_NAME);
+  q = cqueue_spsc_new_shm(SHM_NAME, 64, sizeof(uint64_t));
+  if (!q) {
+    printf("Error: cqueue_spsc_new_shm failed\n");
+    exit(EXIT_FAILURE);
+  }
+  if (cqueue_spsc_new_shm(SHM_NAME, 64, sizeof(uint64_t))) {
+    printf("Error: created an existing shared memory object\n");
+    exit(EXIT_FAILURE);
+  }
+  pass(q, -1, SHM_NAME, passes);
+  cqueue_spsc_delete(&q);
+  shm_unlink(SHM_NAME);
+  printf("shm_open: %ld elements passed\n", passes);
+
+  exit(EXIT_SUCCESS);
+}
+
+/*! Push limit elements through q to a consumer process that attaches to it
+  by fd, or by name if name is not NULL
+*/
+static void pass(cqueue_spsc *q, int fd, const char *name, uint64_t limit) {
+  uint64_t data;
+  uint64_t *p;
+  int status;
+  pid_t pid;
+
+  cqueue_spsc_set_wait(q, CQUEUE_WAIT_PARK, 100);
+
+  // don't let the child flush a copy of our buffered output
+  fflush(stdout);
+  pid = fork();
+  if (!pid)
+    consumer(fd, name, limit);
+
+  for (data=1; data <= limit; data++) {
+    p = cqueue_spsc_push_slot(q);
+    *p = data;
+    cqueue_spsc_push_slot_finish(q);
+  }
+
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS) {
+    printf("Error: consumer process failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void consumer(int fd, const char *name, uint64_t limit) {
+  cqueue_spsc *q;
+  uint64_t data;
+  uint64_t *p;
+
+  if (name)
+    q = cqueue_spsc_attach_shm(name, sizeof(uint64_t));
+  else
+    q = cqueue_spsc_attach_shm_fd(fd, sizeof(uint64_t));
+  if (!q) {
+    printf("Error: attaching to the queue failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (data=1; data <= limit; data++) {
+    p = cqueue_spsc_pop_slot(q);
+    if (*p != data) {
+      printf("Error: expected %" PRIu64 ", got %" PRIu64 "\n", data, *p);
+      exit(EXIT_FAILURE);
+    }
+    cqueue_spsc_pop_slot_finish(q);
+  }
+
+  cqueue_spsc_delete(&q);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,125 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "cqueue_typed.h"
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#define PASSFAIL(fn) \
+  if(fn) \
+    printf("PASS: %s\n", #fn); \
+  else \
+    printf("FAIL: %s\n", #fn);
+
+// counts live instances to check that the queue destroys what it holds
+struct counted {
+  static int live;
+  int v;
+  explicit counted(int v) : v(v) { live++; }
+  counted(const counted& o) : v(o.v) { live++; }
+  counted& operator=(const counted&) = default;
+  ~counted() { live--; }
+};
+int counted::live = 0;
+
+static_assert(!std::is_copy_constructible<cqueue::spsc<int, 4>>::value,
+              "cqueue::spsc must not be copyable");
+static_assert(!std::is_copy_assignable<cqueue::spsc<int, 4>>::value,
+              "cqueue::spsc must not be copyable");
+static_assert(std::is_nothrow_move_constructible<cqueue::spsc<int, 4>>::value,
+              "cqueue::spsc must be movable");
+static_assert(std::is_nothrow_move_assignable<cqueue::spsc<int, 4>>::value,
+              "cqueue::spsc must be movable");
+
+int typed_push_pop_pass();
+int typed_raii_pass();
+int typed_move_only_pass();
+int typed_threads_pass();
+
+
+int main() {
+  PASSFAIL(typed_push_pop_pass());
+  PASSFAIL(typed_raii_pass());
+  PASSFAIL(typed_move_only_pass());
+  PASSFAIL(typed_threads_pass());
+
+  return 0;
+}
+
+int typed_push_pop_pass() {
+  cqueue::spsc<std::string, 2> q;
+  std::string s;
+
+  assert(q.capacity() == 2);
+  assert(!q.try_pop(s));
+  assert(q.try_push("a"));
+  assert(q.try_emplace(3, 'b'));
+  assert(!q.try_push("c"));
+  assert(q.size() == 2);
+
+  assert(q.try_pop(s) && s == "a");
+  assert(q.front() && *q.front() == "bbb");
+  q.pop();
+  assert(!q.front());
+  assert(q.size() == 0);
+  return 1;
+}
+
+int typed_raii_pass() {
+  {
+    cqueue::spsc<counted, 4> q;
+    counted c(0);
+
+    assert(q.try_emplace(1));
+    assert(q.try_emplace(2));
+    assert(q.try_emplace(3));
+    assert(counted::live == 4);
+    assert(q.try_pop(c) && c.v == 1);
+    assert(counted::live == 3);
+  }
+  // the two elements left in the queue were destroyed with it
+  assert(counted::live == 0);
+  return 1;
+}
+
+int typed_move_only_pass() {
+  cqueue::spsc<std::unique_ptr<int>, 4> a;
+  std::unique_ptr<int> p;
+
+  assert(a.try_push(std::make_unique<int>(7)));
+
+  // moving hands over the ring and its elements
+  cqueue::spsc<std::unique_ptr<int>, 4> b(std::move(a));
+  assert(b.size() == 1);
+  a = std::move(b);
+  assert(a.try_pop(p) && *p == 7);
+  return 1;
+}
+
+int typed_threads_pass() {
+  cqueue::spsc<unsigned long, 64> q;
+  const unsigned long n = 100000;
+  unsigned long sum = 0, v;
+
+  std::thread producer([&q, n] {
+    for (unsigned long i=1; i <= n; i++)
+      while (!q.try_push(i))
+        std::this_thread::yield();
+  });
+  for (unsigned long i=1; i <= n; i++) {
+    while (!q.try_pop(v))
+      std::this_thread::yield();
+    assert(v == i);
+    // the consumer sees pop_idx, but push_idx may still be in flight
+    assert(q.size() <= q.capacity());
+    sum += v;
+  }
+  producer.join();
+
+  return sum == n * (n + 1) / 2;
+}
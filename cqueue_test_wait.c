@@ -0,0 +1,99 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>   // PRIu64
+#include "cqueue.h"
+
+#define IDLE_NS 50000000  // how long the producer leaves the consumer idle
+
+struct thread_args {
+  char pad1[LEVEL1_DCACHE_LINESIZE/2];
+  cqueue_spsc *q;
+  uint64_t limit;
+  double cpu_secs;
+  char pad2[LEVEL1_DCACHE_LINESIZE/2];
+};
+
+static const char *names[] = { "spin", "pause", "yield", "park" };
+
+void *producer(void *targ);
+void *consumer(void *targ);
+
+int main(int argc, char** argv) {
+  struct thread_args pargs, cargs;
+  pthread_t pt, ct;
+  cqueue_spsc *q;
+  long passes;
+
+  if (argc != 2 || (passes = atol(argv[1])) < 1) {
+    printf("Error: %s requires an int parameter that specifies the number of passes\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%-8s %20s\n", "wait", "idle consumer cpu s");
+  for (int w = CQUEUE_WAIT_SPIN; w <= CQUEUE_WAIT_PARK; w++) {
+    q = cqueue_spsc_new(64, sizeof(uint64_t));
+    if (!q) {
+      printf("Error: cqueue_spsc_new failed\n");
+      exit(EXIT_FAILURE);
+    }
+    cqueue_spsc_set_wait(q, w, 1000);
+
+    pargs.q = cargs.q = q;
+    pargs.limit = cargs.limit = passes;
+    pthread_create(&ct, NULL, &consumer, &cargs);
+    pthread_create(&pt, NULL, &producer, &pargs);
+    pthread_join(pt, NULL);
+    pthread_join(ct, NULL);
+
+    printf("%-8s %20.6f\n", names[w], cargs.cpu_secs);
+    cqueue_spsc_delete(&q);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+void *producer(void *targ) {
+  struct thread_args *args = targ;
+  struct timespec idle = { 0, IDLE_NS };
+  uint64_t data;
+  uint64_t *p;
+
+  // leave the consumer idle for a while, then push everything with the
+  // blocking calls, which wait on a full queue
+  nanosleep(&idle, NULL);
+  for (data=1; data <= args->limit; data++) {
+    p = cqueue_spsc_push_slot(args->q);
+    *p = data;
+    cqueue_spsc_push_slot_finish(args->q);
+  }
+
+  pthread_exit(NULL);
+}
+
+void *consumer(void *targ) {
+  struct thread_args *args = targ;
+  struct timespec start, end;
+  uint64_t expected;
+  uint64_t *p;
+
+  // measure the cpu time burnt waiting for the first element
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+  p = cqueue_spsc_pop_slot(args->q);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+  args->cpu_secs = (end.tv_sec - start.tv_sec)
+                   + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  for (expected=1; expected <= args->limit; expected++) {
+    if (expected > 1)
+      p = cqueue_spsc_pop_slot(args->q);
+    if (*p != expected) {
+      printf("Error: expected %" PRIu64 ", got %" PRIu64 "\n", expected, *p);
+      exit(EXIT_FAILURE);
+    }
+    cqueue_spsc_pop_slot_finish(args->q);
+  }
+
+  pthread_exit(NULL);
+}
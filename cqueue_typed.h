@@ -0,0 +1,296 @@
+/*!
+  \file
+  \copyright Copyright (c) 2014, Richard Fujiyama
+  Licensed under the terms of the New BSD license.
+
+  Compile-time specialized spsc queues, header only.
+
+  The functions of cqueue.c load capacity and elem_size from the queue on
+  every call and cannot be inlined into the caller. The queues generated
+  here have the element type and capacity built in: the slot address is a
+  shift and a mask of constants, and the push and pop fast paths inline to
+  a handful of instructions. They use the same slot protocol as
+  cqueue_spsc, but none of its options (wait strategies, eventfds, sets,
+  shared memory, stats).
+
+  In C, CQUEUE_SPSC_DEFINE(name, type, capacity) defines the queue type
+  name and static inline functions name_new(), name_delete(), name_init(),
+  name_trypush_slot(), name_push_slot_finish(), name_trypop_slot(),
+  name_pop_slot_finish(), name_trypush(), name_trypop() and
+  name_get_no_used_slots(), which behave like their cqueue_spsc
+  counterparts.
+
+  In C++, cqueue::spsc<T, Capacity> is a move-only owner of such a queue
+  that constructs and destroys its elements properly.
+
+  The two are separate implementations of the same slot protocol, and a
+  change to one must be made to the other. The template cannot be built on
+  the macro: C11 _Atomic and <stdatomic.h> are not available to C++17, and
+  the macro's slots hold a type that is assigned, not one constructed in
+  place and destroyed.
+*/
+
+#ifndef _CQUEUE_TYPED_
+#define _CQUEUE_TYPED_
+
+#ifndef __cplusplus
+
+#include "cqueue.h"
+
+/*! Define a spsc queue of capacity elements of type, called name
+
+  \param name the name of the queue type and the prefix of its functions
+  \param type the element type, anything that can be assigned
+  \param capacity the number of slots, a power of 2 constant
+*/
+#define CQUEUE_SPSC_DEFINE(name, type, capacity) \
+_Static_assert((capacity) > 0 && ((capacity) & ((capacity) - 1)) == 0, \
+               #name ": capacity must be a power of 2"); \
+\
+/* each slot takes whole cachelines, as in cqueue_spsc */ \
+typedef struct name##_slot { \
+  _Alignas(LEVEL1_DCACHE_LINESIZE) _Atomic size_t used; \
+  type data; \
+} name##_slot; \
+\
+typedef struct name { \
+  _Atomic size_t push_idx; \
+  char pad1[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)]; \
+  _Atomic size_t pop_idx; \
+  char pad2[LEVEL1_DCACHE_LINESIZE - sizeof(_Atomic size_t)]; \
+  name##_slot slots[capacity]; \
+} name; \
+\
+static inline void name##_init(name *q) { \
+  atomic_init(&q->push_idx, 0); \
+  atomic_init(&q->pop_idx, 0); \
+  for (size_t i=0; i < (capacity); i++) \
+    atomic_init(&q->slots[i].used, 0); \
+} \
+\
+static inline name* name##_new(void) { \
+  name *q = aligned_alloc(LEVEL1_DCACHE_LINESIZE, sizeof(name)); \
+  if (q) \
+    name##_init(q); \
+  return q; \
+} \
+\
+static inline void name##_delete(name **p) { \
+  free(*p); \
+  *p = NULL; \
+} \
+\
+static inline type* name##_trypush_slot(name *q) { \
+  name##_slot *slot = &q->slots[atomic_load_explicit(&q->push_idx, \
+                                  memory_order_relaxed) & ((capacity) - 1)]; \
+  if (atomic_load_explicit(&slot->used, memory_order_acquire)) \
+    return NULL; \
+  return &slot->data; \
+} \
+\
+static inline void name##_push_slot_finish(name *q) { \
+  size_t push_idx = atomic_load_explicit(&q->push_idx, memory_order_relaxed); \
+  atomic_store_explicit(&q->slots[push_idx & ((capacity) - 1)].used, 1, \
+                        memory_order_release); \
+  atomic_store_explicit(&q->push_idx, push_idx + 1, memory_order_relaxed); \
+} \
+\
+static inline type* name##_trypop_slot(name *q) { \
+  name##_slot *slot = &q->slots[atomic_load_explicit(&q->pop_idx, \
+                                  memory_order_relaxed) & ((capacity) - 1)]; \
+  if (!atomic_load_explicit(&slot->used, memory_order_acquire)) \
+    return NULL; \
+  return &slot->data; \
+} \
+\
+static inline void name##_pop_slot_finish(name *q) { \
+  size_t pop_idx = atomic_load_explicit(&q->pop_idx, memory_order_relaxed); \
+  atomic_store_explicit(&q->slots[pop_idx & ((capacity) - 1)].used, 0, \
+                        memory_order_release); \
+  atomic_store_explicit(&q->pop_idx, pop_idx + 1, memory_order_relaxed); \
+} \
+\
+static inline int name##_trypush(name *q, type v) { \
+  type *p = name##_trypush_slot(q); \
+  if (!p) \
+    return -1; \
+  *p = v; \
+  name##_push_slot_finish(q); \
+  return 0; \
+} \
+\
+static inline int name##_trypop(name *q, type *v) { \
+  type *p = name##_trypop_slot(q); \
+  if (!p) \
+    return -1; \
+  *v = *p; \
+  name##_pop_slot_finish(q); \
+  return 0; \
+} \
+\
+/* the indices are stored relaxed after the used flags, see \
+   cqueue_spsc_get_no_used_slots() */ \
+static inline size_t name##_get_no_used_slots(name *q) { \
+  size_t pop = atomic_load_explicit(&q->pop_idx, memory_order_acquire); \
+  size_t push = atomic_load_explicit(&q->push_idx, memory_order_acquire); \
+  if ((ptrdiff_t)(push - pop) < 0) \
+    return 0; \
+  if (push - pop > (capacity)) \
+    return (capacity); \
+  return push - pop; \
+}
+
+#else  // __cplusplus
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef LEVEL1_DCACHE_LINESIZE
+//! see cqueue.h
+#define LEVEL1_DCACHE_LINESIZE 64
+#endif
+
+namespace cqueue {
+
+/*! A spsc queue of Capacity elements of type T
+
+  Owns its ring, which is allocated on construction (throwing
+  std::bad_alloc on failure) and released with any elements left in it on
+  destruction. Move-only: moving hands over the ring, after which the
+  source must only be assigned to or destroyed.
+
+  try_push() and try_emplace() must only be called by a single producer,
+  try_pop() and front()/pop() by a single consumer.
+*/
+template <typename T, std::size_t Capacity>
+class spsc {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of 2");
+
+  // each slot takes whole cachelines, as in cqueue_spsc
+  struct alignas(LEVEL1_DCACHE_LINESIZE) slot {
+    std::atomic<std::size_t> used;
+    alignas(T) unsigned char data[sizeof(T)];
+  };
+
+  struct ring {
+    alignas(LEVEL1_DCACHE_LINESIZE) std::atomic<std::size_t> push_idx;
+    alignas(LEVEL1_DCACHE_LINESIZE) std::atomic<std::size_t> pop_idx;
+    slot slots[Capacity];
+  };
+
+  static constexpr std::size_t mask = Capacity - 1;
+
+  ring *r_;
+
+  T* at(std::size_t idx) const {
+    return std::launder(reinterpret_cast<T*>(r_->slots[idx & mask].data));
+  }
+
+public:
+  spsc() : r_(new ring) {
+    r_->push_idx.store(0, std::memory_order_relaxed);
+    r_->pop_idx.store(0, std::memory_order_relaxed);
+    for (std::size_t i=0; i < Capacity; i++)
+      r_->slots[i].used.store(0, std::memory_order_relaxed);
+  }
+
+  ~spsc() {
+    if (!r_)
+      return;
+    while (front())
+      pop();
+    delete r_;
+  }
+
+  spsc(const spsc&) = delete;
+  spsc& operator=(const spsc&) = delete;
+
+  spsc(spsc&& other) noexcept : r_(other.r_) {
+    other.r_ = nullptr;
+  }
+
+  spsc& operator=(spsc&& other) noexcept {
+    std::swap(r_, other.r_);
+    return *this;
+  }
+
+  static constexpr std::size_t capacity() {
+    return Capacity;
+  }
+
+  //! constructs an element in place, returns false when the queue is full
+  template <typename... Args>
+  bool try_emplace(Args&&... args) {
+    std::size_t idx = r_->push_idx.load(std::memory_order_relaxed);
+    slot &s = r_->slots[idx & mask];
+
+    if (s.used.load(std::memory_order_acquire))
+      return false;
+    ::new (static_cast<void*>(s.data)) T(std::forward<Args>(args)...);
+    s.used.store(1, std::memory_order_release);
+    r_->push_idx.store(idx + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool try_push(const T& v) {
+    return try_emplace(v);
+  }
+
+  bool try_push(T&& v) {
+    return try_emplace(std::move(v));
+  }
+
+  //! the oldest element, or nullptr when the queue is empty
+  T* front() {
+    std::size_t idx = r_->pop_idx.load(std::memory_order_relaxed);
+
+    if (!r_->slots[idx & mask].used.load(std::memory_order_acquire))
+      return nullptr;
+    return at(idx);
+  }
+
+  //! destroys the oldest element, front() must have returned it
+  void pop() {
+    std::size_t idx = r_->pop_idx.load(std::memory_order_relaxed);
+
+    at(idx)->~T();
+    r_->slots[idx & mask].used.store(0, std::memory_order_release);
+    r_->pop_idx.store(idx + 1, std::memory_order_relaxed);
+  }
+
+  //! moves the oldest element to v, returns false when the queue is empty
+  bool try_pop(T& v) {
+    T *p = front();
+
+    if (!p)
+      return false;
+    v = std::move(*p);
+    pop();
+    return true;
+  }
+
+  //! number of elements, a snapshot that may be stale when returned
+  std::size_t size() const {
+    std::size_t pop = r_->pop_idx.load(std::memory_order_acquire);
+    std::size_t push = r_->push_idx.load(std::memory_order_acquire);
+
+    // the indices are stored relaxed after the used flags, so either may
+    // be seen behind the other, see cqueue_spsc_get_no_used_slots()
+    if (static_cast<std::ptrdiff_t>(push - pop) < 0)
+      return 0;
+    if (push - pop > Capacity)
+      return Capacity;
+    return push - pop;
+  }
+};
+
+}  // namespace cqueue
+
+#endif  // __cplusplus
+
+#endif  // _CQUEUE_TYPED_
+// vim: et:ts=3:sw=3:sts=3